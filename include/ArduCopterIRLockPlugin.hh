@@ -30,6 +30,9 @@ namespace gazebo
   class ArduCopterIRLockPluginPrivate;
 
   /// \brief A camera sensor plugin for fiducial detection
+  ///
+  /// An optional <realtime> block tunes the buffer and busy-poll settings
+  /// of the irlock socket, see ArduPilotRealtime.
   class GAZEBO_VISIBLE ArduCopterIRLockPlugin : public SensorPlugin
   {
     /// \brief Constructor
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTBLADEBANK_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTBLADEBANK_HH_
+
+#include <cstddef>
+#include <vector>
+#include <ignition/math/Helpers.hh>
+#include <ignition/math/Quaternion.hh>
+#include <ignition/math/Vector3.hh>
+
+namespace gazebo
+{
+  /// \brief Parameters of one blade element, LiftDragPlugin's with its
+  /// defaults
+  class ArduPilotBlade
+  {
+    /// \brief Zero-lift angle of attack, <a0>
+    public: double a0 = 0.0;
+
+    /// \brief Stall angle of attack, <alpha_stall>
+    public: double alphaStall = 0.5 * IGN_PI;
+
+    /// \brief Lift slope before stall, <cla>
+    public: double cla = 1.0;
+
+    /// \brief Lift slope after stall, <cla_stall>
+    public: double claStall = 0.0;
+
+    /// \brief Drag slope before stall, <cda>
+    public: double cda = 0.01;
+
+    /// \brief Drag slope after stall, <cda_stall>
+    public: double cdaStall = 1.0;
+
+    /// \brief Blade area, <area>
+    public: double area = 1.0;
+
+    /// \brief Air density, <air_density>
+    public: double airDensity = 1.2041;
+
+    /// \brief Center of pressure, link frame, <cp>
+    public: ignition::math::Vector3d cp;
+
+    /// \brief Forward (zero lift) direction, link frame, <forward>
+    public: ignition::math::Vector3d forward =
+      ignition::math::Vector3d::UnitX;
+
+    /// \brief Upward (positive lift) direction, link frame, <upward>
+    public: ignition::math::Vector3d upward =
+      ignition::math::Vector3d::UnitZ;
+
+    /// \brief Whether upward follows the inflow, <radial_symmetry>
+    public: bool radialSymmetry = false;
+  };
+
+  /// \brief Motion of a rotor link for one step, and the force and torque
+  /// of its blades about its center of gravity
+  class ArduPilotBladeLink
+  {
+    /// \brief Set the motion and clear the force and torque
+    /// \param[in] _rot Link orientation, world frame.
+    /// \param[in] _cogVel Center of gravity velocity, world frame.
+    /// \param[in] _angVel Angular velocity, world frame.
+    public: void Set(const ignition::math::Quaterniond &_rot,
+      const ignition::math::Vector3d &_cogVel,
+      const ignition::math::Vector3d &_angVel);
+
+    /// \brief Link to world rotation matrix, row major
+    public: double rot[9];
+
+    /// \brief Center of gravity velocity, world frame
+    public: double vel[3];
+
+    /// \brief Angular velocity, world frame
+    public: double angVel[3];
+
+    /// \brief Force to apply at the center of gravity, world frame
+    public: double force[3];
+
+    /// \brief Torque to apply, world frame
+    public: double torque[3];
+  };
+
+  /// \brief Blade elements of every rotor of a model, evaluated together.
+  ///
+  /// Forces are LiftDragPlugin's, including its quirks: the cos^2 sweep
+  /// correction, the spanwise velocity removed along the inflow and a
+  /// pitching moment of zero. Blade data is kept one array per field and
+  /// processed in plain scalar passes, there is no SIMD kernel: the stall
+  /// branches and the acos of each blade do not map onto vector lanes.
+  class ArduPilotBladeBank
+  {
+    /// \brief Add a blade
+    /// \param[in] _blade Blade parameters.
+    /// \param[in] _cog Center of gravity of its link, link frame.
+    /// \param[in] _link Index of its link in the array given to Update().
+    public: void Add(const ArduPilotBlade &_blade,
+      const ignition::math::Vector3d &_cog, const unsigned int _link);
+
+    /// \brief Number of blades added
+    /// \return Blade count.
+    public: size_t Size() const;
+
+    /// \brief Compute every blade force from the motion of its link and
+    /// add it, with its moment about the link center of gravity, to the
+    /// link's force and torque
+    /// \param[in,out] _links Rotor links, motion set.
+    public: void Update(ArduPilotBladeLink *_links);
+
+    /// \brief Force on a blade in the last Update()
+    /// \param[in] _blade Blade index.
+    /// \return Force, world frame.
+    public: ignition::math::Vector3d Force(const size_t _blade) const;
+
+    /// \brief Blade airspeeds and forces, world frame
+    private: void ComputeForces();
+
+    /// \brief Number of blades
+    private: size_t size = 0;
+
+    /// \brief Index of the blade's link
+    private: std::vector<unsigned int> link;
+
+    /// \brief Center of pressure relative to the link center of gravity,
+    /// link frame, x y z
+    private: std::vector<double> cp[3];
+
+    /// \brief Forward (zero lift) direction, link frame
+    private: std::vector<double> forward[3];
+
+    /// \brief Upward (positive lift) direction, link frame
+    private: std::vector<double> upward[3];
+
+    /// \brief Whether upward follows the inflow
+    private: std::vector<char> radial;
+
+    /// \brief Zero-lift angle of attack
+    private: std::vector<double> alpha0;
+
+    /// \brief Stall angle of attack
+    private: std::vector<double> alphaStall;
+
+    /// \brief Lift slope before stall
+    private: std::vector<double> cla;
+
+    /// \brief Lift slope after stall
+    private: std::vector<double> claStall;
+
+    /// \brief Drag slope before stall
+    private: std::vector<double> cda;
+
+    /// \brief Drag slope after stall
+    private: std::vector<double> cdaStall;
+
+    /// \brief Half the air density times the blade area
+    private: std::vector<double> halfRhoArea;
+
+    /// \brief World frame lever arm from the link center of gravity
+    private: std::vector<double> arm[3];
+
+    /// \brief World frame velocity of the center of pressure
+    private: std::vector<double> vel[3];
+
+    /// \brief World frame forward direction
+    private: std::vector<double> forwardI[3];
+
+    /// \brief World frame upward direction
+    private: std::vector<double> upwardI[3];
+
+    /// \brief World frame force on the blade
+    private: std::vector<double> force[3];
+  };
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTFANOUT_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTFANOUT_HH_
+
+#include <string>
+#include <vector>
+#include <sdf/sdf.hh>
+#include "include/ArduPilotSocketAddress.hh"
+
+struct ap_snapshot;
+
+namespace gazebo
+{
+  /// \brief Prefix selecting a shared-memory snapshot slot in an
+  /// <fdmMirror> address, e.g. "shm:/ardupilot_iris_state", see
+  /// ap_snapshot_read() in shim/.
+  static const char kSnapshotPrefix[] = "shm:";
+
+  /// \brief Copies of every state packet for local consumers other than
+  /// the lockstep partner (loggers, visualisers, ground stations), set up
+  /// by repeated <fdmMirror> elements:
+  ///
+  ///   <fdmMirror>
+  ///     <addr>239.255.0.1</addr>  IPv4 unicast or multicast group,
+  ///     <port>9010</port>         unix:<path> or shm:<name>
+  ///     <ttl>1</ttl>              multicast only, default 1
+  ///   </fdmMirror>
+  ///
+  /// The packet encoded for ArduPilot is reused as is: every socket
+  /// destination of a family gets the same buffer from one sendmmsg(), and
+  /// snapshot slots are overwritten in place. Mirror sockets are never
+  /// bound nor read, so only the primary transport's replies drive the
+  /// simulation. Sends never block, a full socket buffer drops the copy.
+  class ArduPilotFanout
+  {
+    /// \brief Destructor
+    public: ~ArduPilotFanout();
+
+    /// \brief Open every <fdmMirror> of _sdf
+    /// \param[in] _sdf Plugin sdf.
+    /// \param[in] _modelName Model name for messages.
+    /// \return False if a mirror is invalid or cannot be opened.
+    public: bool Load(sdf::ElementPtr _sdf, const std::string &_modelName);
+
+    /// \brief Whether no mirror is configured
+    /// \return True if Send() has nothing to do.
+    public: bool Empty() const;
+
+    /// \brief Send one encoded state packet to every mirror
+    /// \param[in] _buf Packet, as sent to ArduPilot.
+    /// \param[in] _size Size of the packet.
+    public: void Send(const void *_buf, size_t _size);
+
+    /// \brief Copies dropped because a socket buffer was full or a send
+    /// failed, since Load().
+    /// \return Dropped copy count.
+    public: uint64_t DroppedCount() const;
+
+    /// \brief Socket destinations of one address family
+    private: struct Group
+    {
+      /// \brief Unbound send socket
+      int fd = -1;
+
+      /// \brief Destination addresses
+      std::vector<struct sockaddr_storage> addrs;
+
+      /// \brief Destination address lengths
+      std::vector<socklen_t> addrLens;
+    };
+
+    /// \brief Open the send socket of a group on first use
+    /// \param[in,out] _group Group to open.
+    /// \param[in] _family AF_INET or AF_UNIX.
+    /// \return False if the socket cannot be created.
+    private: static bool OpenGroup(Group &_group, const int _family);
+
+    /// \brief Send to every destination of a group
+    /// \param[in] _group Destinations.
+    /// \param[in] _buf Packet.
+    /// \param[in] _size Size of the packet.
+    private: void SendGroup(Group &_group, const void *_buf, size_t _size);
+
+    /// \brief IPv4 unicast and multicast destinations
+    private: Group inet;
+
+    /// \brief Unix-domain datagram destinations
+    private: Group local;
+
+    /// \brief Shared-memory snapshot slots
+    private: std::vector<struct ap_snapshot *> snapshots;
+
+    /// \brief Model name for messages
+    private: std::string modelName;
+
+    /// \brief Dropped copies
+    private: uint64_t droppedCount = 0;
+  };
+}
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTFDMEXTENSIONS_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTFDMEXTENSIONS_HH_
+
+#include <cstdint>
+#include <string>
+#include <sdf/sdf.hh>
+#include <gazebo/physics/physics.hh>
+#include <gazebo/sensors/sensors.hh>
+#include "include/ArduPilotTransport.hh"
+
+namespace gazebo
+{
+  /// \brief Fills the optional GPS, airspeed, battery, rangefinder and
+  /// ESC rpm fields of v2 and json state messages. Each is off by
+  /// default and, unless a Gazebo sensor is named for it, computed from
+  /// the model state the plugin already reads for the base frame, so no
+  /// extra sensor has to be updated by the sensor manager:
+  ///
+  /// <fdmGps>          GPS position: home from the world's
+  ///                   <spherical_coordinates>, offset by the NED position
+  ///                   on a locally flat earth
+  /// <gpsName>         use this GpsSensor instead, implies <fdmGps>
+  /// <fdmAirspeed>     airspeed: model speed relative to the world wind
+  /// <fdmBattery>      battery: open-circuit voltage falling linearly from
+  ///                   <batteryVoltage> (default 12.6) to
+  ///                   <batteryEmptyVoltage> (default 10.5) as the
+  ///                   <batteryCapacityAh> (default 5) is drawn, less the
+  ///                   sag across <batteryResistance> (default 0.02 ohm);
+  ///                   the current is the mechanical power of the motor
+  ///                   joints divided by <batteryEfficiency> (default 0.8)
+  /// <fdmRangefinder>  down-facing rangefinder: height above the z = 0
+  ///                   ground plane along the body down axis, sent only
+  ///                   within <rangefinderMaxRange> (default 40) and a
+  ///                   60 degree tilt
+  /// <rangefinderName> use this RaySensor instead, implies
+  ///                   <fdmRangefinder>
+  /// <fdmEscRpm>       ESC telemetry: rotor speed of every VELOCITY and
+  ///                   ROTOR control at its servo channel, the joint
+  ///                   velocity or modelled rotor speed low-passed at the
+  ///                   control's <frequencyCutoff>, sampled every physics
+  ///                   step, for ArduPilot's harmonic notch
+  ///
+  /// A field that has no valid value on a step is left out of that frame.
+  class ArduPilotFdmExtensions
+  {
+    /// \brief Read the enabled fields from the plugin sdf
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _model Model the plugin is attached to.
+    /// \param[in] _supported Fields the wire format can carry, see
+    /// ArduPilotProtocol::ExtensionFields().
+    /// \return False if a named sensor cannot be found.
+    public: bool Load(sdf::ElementPtr _sdf, physics::ModelPtr _model,
+      const uint32_t _supported);
+
+    /// \brief Fields enabled in the sdf
+    /// \return ArduPilotFdmField bits, 0 if none.
+    public: uint32_t Fields() const;
+
+    /// \brief Whether Fill() needs the motor power
+    /// \return True with <fdmBattery>.
+    public: bool NeedsMotorPower() const;
+
+    /// \brief Whether Fill() needs the ESC rpm
+    /// \return True with <fdmEscRpm>.
+    public: bool NeedsEscRpm() const;
+
+    /// \brief Compute the optional fields for one state frame
+    /// \param[in] _pkt Base state of this frame, NED.
+    /// \param[in] _velWorld Model velocity in the Gazebo world frame.
+    /// \param[in] _motorPowerW Mechanical power of the motor joints, W.
+    /// \param[in] _escRpm Rotor speed per servo channel, rpm.
+    /// \param[in] _escCount Number of values in _escRpm.
+    /// \param[out] _ext Optional fields, with the valid ones flagged.
+    public: void Fill(const fdmPacket &_pkt,
+      const ignition::math::Vector3d &_velWorld, const double _motorPowerW,
+      const double *_escRpm, const unsigned _escCount, fdmExtension &_ext);
+
+    /// \brief Model the plugin is attached to
+    private: physics::ModelPtr model;
+
+    /// \brief Model name used to prefix messages
+    private: std::string modelName;
+
+    /// \brief Enabled fields
+    private: uint32_t fields = 0;
+
+    /// \brief GPS sensor, flat-earth estimate if null
+    private: sensors::GpsSensorPtr gpsSensor;
+
+    /// \brief Home latitude, degrees
+    private: double homeLatitude = 0.0;
+
+    /// \brief Home longitude, degrees
+    private: double homeLongitude = 0.0;
+
+    /// \brief Home altitude, meters
+    private: double homeAltitude = 0.0;
+
+    /// \brief Degrees of latitude per meter north
+    private: double latitudePerMeter = 0.0;
+
+    /// \brief Degrees of longitude per meter east at the home latitude
+    private: double longitudePerMeter = 0.0;
+
+    /// \brief Rangefinder sensor, geometric estimate if null
+    private: sensors::RaySensorPtr rangefinderSensor;
+
+    /// \brief Longest range reported by the geometric rangefinder
+    private: double rangefinderMaxRange = 40.0;
+
+    /// \brief Battery voltage at full charge
+    private: double batteryVoltage = 12.6;
+
+    /// \brief Battery voltage at empty charge
+    private: double batteryEmptyVoltage = 10.5;
+
+    /// \brief Battery capacity, ampere hours
+    private: double batteryCapacityAh = 5.0;
+
+    /// \brief Battery internal resistance, ohms
+    private: double batteryResistance = 0.02;
+
+    /// \brief Electrical to mechanical power efficiency of the motors
+    private: double batteryEfficiency = 0.8;
+
+    /// \brief Charge drawn so far, ampere hours
+    private: double batteryDrawnAh = 0.0;
+
+    /// \brief Sim time of the previous battery update, negative before
+    /// the first one
+    private: double batteryLastTime = -1.0;
+  };
+}
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTFILTERBANK_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTFILTERBANK_HH_
+
+#include <cstddef>
+#include <vector>
+
+namespace gazebo
+{
+  /// \brief One-pole low-pass filters of a vehicle, processed together.
+  ///
+  /// Each filter is an ignition::math::OnePole, y = a0 * x + b1 * y with
+  /// b1 = exp(-2 pi fc / fs) and a0 = 1 - b1, and gives the same output.
+  /// Coefficients and state are kept one array per field, padded to
+  /// kLanes, and processed kLanes filters per instruction with AVX2 or
+  /// SSE2 where the cpu has them.
+  class ArduPilotFilterBank
+  {
+    /// \brief Filters per vector, arrays are padded to a multiple of it
+    public: static const size_t kLanes = 4;
+
+    /// \brief Add a filter
+    /// \param[in] _fc Cutoff frequency.
+    /// \param[in] _fs Sampling rate, same unit as _fc.
+    /// \return Lane of the new filter.
+    public: size_t Add(const double _fc, const double _fs);
+
+    /// \brief Number of filters added
+    /// \return Filter count.
+    public: size_t Size() const;
+
+    /// \brief Set every filter output
+    /// \param[in] _value Output value.
+    public: void Set(const double _value);
+
+    /// \brief Raw inputs, to be filled before Process
+    /// \return Array of Size() inputs, padded.
+    public: double *Inputs();
+
+    /// \brief Feed the inputs in Inputs() through every filter
+    /// \return Array of Size() outputs.
+    public: const double *Process();
+
+    /// \brief Outputs of the last Process
+    /// \return Array of Size() outputs.
+    public: const double *Outputs() const;
+
+    /// \brief Code path Process uses on this cpu
+    /// \return avx2, sse2 or scalar.
+    public: static const char *Isa();
+
+    /// \brief Number of filters
+    private: size_t size = 0;
+
+    /// \brief Input gains, 1 - b1
+    private: std::vector<double> a0;
+
+    /// \brief Feedback gains
+    private: std::vector<double> b1;
+
+    /// \brief Raw inputs
+    private: std::vector<double> inputs;
+
+    /// \brief Filter outputs and state
+    private: std::vector<double> outputs;
+  };
+}
+#endif
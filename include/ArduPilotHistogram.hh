@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTHISTOGRAM_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTHISTOGRAM_HH_
+
+#include <cstdint>
+
+namespace gazebo
+{
+  /// \brief Fixed-size log-linear histogram of durations in nanoseconds,
+  /// in the style of HdrHistogram: every power of two is split into
+  /// kSubBuckets linear buckets, so any recorded value is reported within
+  /// about 3% and recording is a couple of shifts and an increment.
+  class ArduPilotHistogram
+  {
+    /// \brief Record a duration
+    /// \param[in] _ns Nanoseconds, values past about 18 minutes are
+    /// recorded in the last bucket.
+    public: void Record(const uint64_t _ns);
+
+    /// \brief Number of recorded values
+    /// \return Count.
+    public: uint64_t Count() const;
+
+    /// \brief Largest recorded value
+    /// \return Nanoseconds.
+    public: uint64_t Max() const;
+
+    /// \brief Value at a percentile
+    /// \param[in] _percentile Percentile, 0 to 100.
+    /// \return Nanoseconds, midpoint of the bucket holding the percentile,
+    /// 0 if nothing was recorded.
+    public: uint64_t Percentile(const double _percentile) const;
+
+    /// \brief log2 of the number of linear buckets per power of two
+    private: static const unsigned kSubBucketBits = 5;
+
+    /// \brief Linear buckets per power of two
+    private: static const unsigned kSubBuckets = 1u << kSubBucketBits;
+
+    /// \brief Largest power of two tracked, 2^40 ns
+    private: static const unsigned kMaxMagnitude = 40;
+
+    /// \brief Total number of buckets
+    private: static const unsigned kBucketCount =
+      (kMaxMagnitude - kSubBucketBits + 2) * kSubBuckets;
+
+    /// \brief Bucket holding a value
+    /// \param[in] _ns Value.
+    /// \return Bucket index.
+    private: static unsigned Bucket(const uint64_t _ns);
+
+    /// \brief Smallest value of a bucket
+    /// \param[in] _bucket Bucket index.
+    /// \return Nanoseconds.
+    private: static uint64_t LowestValue(const unsigned _bucket);
+
+    /// \brief Bucket counts
+    private: uint64_t counts[kBucketCount] = {0};
+
+    /// \brief Number of recorded values
+    private: uint64_t count = 0;
+
+    /// \brief Largest recorded value
+    private: uint64_t max = 0;
+  };
+}
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTIMU_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTIMU_HH_
+
+#include <string>
+#include <sdf/sdf.hh>
+#include <gazebo/physics/physics.hh>
+
+namespace gazebo
+{
+  /// \brief IMU computed in the plugin from the kinematics of its link at
+  /// the current physics step, in place of an ImuSensor updated by the
+  /// sensor manager on its own thread and rate. Read from the plugin sdf:
+  ///
+  /// <imuSynthetic>   true to use it, no ImuSensor is looked up then,
+  ///                  default false
+  /// <imuLinkName>    link the IMU is fixed to, default the canonical link
+  /// <imuPose>        IMU pose in that link frame, x forward, y right,
+  ///                  z down like the ImuSensor it replaces, default at
+  ///                  the link origin, rotated by the plugin's
+  ///                  <modelXYZToAirplaneXForwardZDown>
+  /// <imuGyroBias>    constant angular velocity bias, rad/s, default zero
+  /// <imuAccelBias>   constant specific force bias, m/s^2, default zero
+  /// <imuGyroNoise>   white noise standard deviation on each angular
+  ///                  velocity axis, rad/s, default 0
+  /// <imuAccelNoise>  white noise standard deviation on each specific
+  ///                  force axis, m/s^2, default 0
+  ///
+  /// The specific force is the change of the world linear velocity of the
+  /// IMU point over the last physics step, less gravity, and the angular
+  /// velocity the mean of the link's world angular velocity at both ends
+  /// of the step, like the delta velocity and delta angle of a real IMU.
+  /// Update() has to run on every physics step for this, Measure() only
+  /// returns its result. Noise is drawn from ignition::math::Rand, seeded
+  /// by gazebo's --seed.
+  class ArduPilotImu
+  {
+    /// \brief Read the IMU parameters from the plugin sdf
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _model Model the plugin is attached to.
+    /// \param[in] _bodyRotation Rotation of the x forward, y right, z down
+    /// body in the model frame, the IMU orientation without <imuPose>.
+    /// \return False if the link cannot be found.
+    public: bool Load(sdf::ElementPtr _sdf, physics::ModelPtr _model,
+      const ignition::math::Quaterniond &_bodyRotation);
+
+    /// \brief IMU pose in its link frame, from <imuPose> if given
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _bodyRotation Orientation used without <imuPose>.
+    /// \return IMU pose.
+    public: static ignition::math::Pose3d LoadPose(sdf::ElementPtr _sdf,
+      const ignition::math::Quaterniond &_bodyRotation);
+
+    /// \brief Forget the last step, e.g. after a world reset. The next
+    /// Update() then reads the vehicle as unaccelerated.
+    public: void Reset();
+
+    /// \brief Measure the step that just ended, call once per physics step
+    /// \param[in] _dt Length of that step, s, ignored if not positive.
+    public: void Update(const double _dt);
+
+    /// \brief Measurement of the last Update()
+    /// \param[out] _angularVel Angular velocity, IMU frame, rad/s.
+    /// \param[out] _linearAccel Specific force, IMU frame, m/s^2.
+    public: void Measure(ignition::math::Vector3d &_angularVel,
+      ignition::math::Vector3d &_linearAccel) const;
+
+    /// \brief Noise-free IMU reading of one step from the world velocities
+    /// of the IMU point at its ends
+    /// \param[in] _lastLinearVel IMU point velocity at the step start,
+    /// world frame, m/s.
+    /// \param[in] _lastAngularVel Angular velocity at the step start, world
+    /// frame, rad/s.
+    /// \param[in] _linearVel IMU point velocity at the step end, m/s.
+    /// \param[in] _angularVel Angular velocity at the step end, rad/s.
+    /// \param[in] _imuRot IMU orientation in the world at the step end.
+    /// \param[in] _gravity World gravity, m/s^2.
+    /// \param[in] _dt Step length, s, must be positive.
+    /// \param[out] _imuAngularVel Angular velocity, IMU frame, rad/s.
+    /// \param[out] _imuLinearAccel Specific force, IMU frame, m/s^2.
+    public: static void Difference(
+      const ignition::math::Vector3d &_lastLinearVel,
+      const ignition::math::Vector3d &_lastAngularVel,
+      const ignition::math::Vector3d &_linearVel,
+      const ignition::math::Vector3d &_angularVel,
+      const ignition::math::Quaterniond &_imuRot,
+      const ignition::math::Vector3d &_gravity, const double _dt,
+      ignition::math::Vector3d &_imuAngularVel,
+      ignition::math::Vector3d &_imuLinearAccel);
+
+    /// \brief Link the IMU is fixed to
+    private: physics::LinkPtr link;
+
+    /// \brief IMU rotation in the link frame
+    private: ignition::math::Quaterniond rotation;
+
+    /// \brief IMU position in the link frame
+    private: ignition::math::Vector3d position;
+
+    /// \brief World gravity
+    private: ignition::math::Vector3d gravity;
+
+    /// \brief Angular velocity bias, rad/s
+    private: ignition::math::Vector3d gyroBias;
+
+    /// \brief Specific force bias, m/s^2
+    private: ignition::math::Vector3d accelBias;
+
+    /// \brief Angular velocity noise standard deviation, rad/s
+    private: double gyroNoise = 0.0;
+
+    /// \brief Specific force noise standard deviation, m/s^2
+    private: double accelNoise = 0.0;
+
+    /// \brief Whether the last velocities below are from the previous step
+    private: bool lastValid = false;
+
+    /// \brief IMU point velocity at the previous step, world frame
+    private: ignition::math::Vector3d lastLinearVel;
+
+    /// \brief Angular velocity at the previous step, world frame
+    private: ignition::math::Vector3d lastAngularVel;
+
+    /// \brief Angular velocity measured by the last Update(), IMU frame
+    private: ignition::math::Vector3d angularVel;
+
+    /// \brief Specific force measured by the last Update(), IMU frame
+    private: ignition::math::Vector3d linearAccel;
+  };
+}
+#endif
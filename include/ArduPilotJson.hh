@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTJSON_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTJSON_HH_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace gazebo
+{
+  /// \brief Longest text Number() writes: sign, 13 integer digits, point
+  /// and 6 fraction digits, or a %.17g fallback
+  static const size_t kJsonNumberMaxSize = 32;
+
+  /// \brief Append-only writer of JSON text into a caller-provided buffer,
+  /// for building one state message per step without allocating. Keys
+  /// and punctuation are written as precomputed literal fragments; numbers
+  /// are formatted in fixed point with 6 decimals through integer
+  /// arithmetic instead of printf. Writes that would not fit are dropped
+  /// and reported by Overflow().
+  class ArduPilotJsonWriter
+  {
+    /// \brief Constructor
+    /// \param[in] _buf Buffer to write into.
+    /// \param[in] _size Size of the buffer.
+    public: ArduPilotJsonWriter(char *_buf, const size_t _size)
+      : start(_buf), out(_buf), end(_buf + _size)
+    {
+    }
+
+    /// \brief Append a string literal as is
+    /// \param[in] _text Literal, without its terminating nul.
+    public: template <size_t N>
+      void Literal(const char (&_text)[N])
+    {
+      if (this->Reserve(N - 1))
+      {
+        memcpy(this->out, _text, N - 1);
+        this->out += N - 1;
+      }
+    }
+
+    /// \brief Append a number. JSON has no inf or nan, those are written
+    /// as 0.
+    /// \param[in] _value Value to append.
+    public: void Number(const double _value)
+    {
+      if (!this->Reserve(kJsonNumberMaxSize))
+      {
+        return;
+      }
+      if (!std::isfinite(_value))
+      {
+        *this->out++ = '0';
+        return;
+      }
+      if (std::fabs(_value) >= 9.0e12)
+      {
+        // beyond what fits in an int64 with 6 decimals, never on the hot
+        // path in practice
+        this->out += snprintf(this->out, kJsonNumberMaxSize, "%.17g",
+          _value);
+        return;
+      }
+
+      // round half away from zero; a value rounding to 0 loses its sign
+      const double magnitude = std::fabs(_value) * 1e6 + 0.5;
+      const uint64_t scaled = static_cast<uint64_t>(magnitude);
+      if (_value < 0.0 && scaled != 0)
+      {
+        *this->out++ = '-';
+      }
+      uint64_t integer = scaled / 1000000u;
+      uint32_t fraction = static_cast<uint32_t>(scaled % 1000000u);
+
+      char digits[20];
+      int count = 0;
+      do
+      {
+        digits[count++] = static_cast<char>('0' + integer % 10);
+        integer /= 10;
+      }
+      while (integer);
+      while (count)
+      {
+        *this->out++ = digits[--count];
+      }
+
+      if (fraction)
+      {
+        *this->out++ = '.';
+        int length = 6;
+        for (int i = 5; i >= 0; --i)
+        {
+          digits[i] = static_cast<char>('0' + fraction % 10);
+          fraction /= 10;
+        }
+        while (digits[length - 1] == '0')
+        {
+          --length;
+        }
+        memcpy(this->out, digits, length);
+        this->out += length;
+      }
+    }
+
+    /// \brief Append comma separated numbers
+    /// \param[in] _values Values to append.
+    /// \param[in] _count Number of values.
+    public: void Numbers(const double *_values, const unsigned _count)
+    {
+      for (unsigned i = 0; i < _count; ++i)
+      {
+        if (i)
+        {
+          this->Literal(",");
+        }
+        this->Number(_values[i]);
+      }
+    }
+
+    /// \brief Number of bytes written
+    /// \return Size of the text.
+    public: size_t Size() const
+    {
+      return static_cast<size_t>(this->out - this->start);
+    }
+
+    /// \brief Whether a write was dropped for lack of space
+    /// \return True if the text is incomplete.
+    public: bool Overflow() const
+    {
+      return this->overflow;
+    }
+
+    /// \brief Check that _size more bytes fit
+    /// \param[in] _size Bytes about to be written.
+    /// \return False, and flag the overflow, if they do not fit.
+    private: bool Reserve(const size_t _size)
+    {
+      if (this->overflow ||
+          static_cast<size_t>(this->end - this->out) < _size)
+      {
+        this->overflow = true;
+        return false;
+      }
+      return true;
+    }
+
+    /// \brief Start of the buffer
+    private: char *start;
+
+    /// \brief Write position
+    private: char *out;
+
+    /// \brief End of the buffer
+    private: char *end;
+
+    /// \brief Set once a write was dropped
+    private: bool overflow = false;
+  };
+}
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTLOCKSTEPWAIT_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTLOCKSTEPWAIT_HH_
+
+#include <chrono>
+#include <cstdint>
+#include <sdf/sdf.hh>
+#include "include/ArduPilotTransport.hh"
+
+namespace gazebo
+{
+  /// \brief How the physics thread waits for the next servo packet.
+  ///
+  /// Configured by an optional <lockstepWait> block:
+  /// <spinUs>            busy-poll the transport for up to this long
+  /// <yieldUs>           then poll and yield the cpu for up to this long
+  /// <timeoutMs>         then block until this deadline (default 1000)
+  /// <missSleepNs>       sleep after a missed packet (default 100)
+  /// <adaptiveSpin>      spin only around the arrival time expected from
+  ///                     recent inter-packet intervals (default false)
+  ///
+  /// The defaults reproduce the former fixed 1000 ms behaviour. Only used
+  /// while ArduPilot is online, ArduPilotPlugin never waits while it is
+  /// offline.
+  class ArduPilotLockstepWait
+  {
+    /// \brief Read the policy from the plugin sdf
+    /// \param[in] _sdf Plugin sdf element.
+    public: void Load(sdf::ElementPtr _sdf);
+
+    /// \brief Wait for the next servo packet according to the policy
+    /// \param[in] _transport Transport to receive from.
+    /// \param[out] _size Size of the returned packet.
+    /// \return Newest packet, or nullptr if none arrived in time.
+    public: const ServoPacket *Receive(ArduPilotTransport &_transport,
+      ssize_t &_size);
+
+    /// \brief Sleep to apply after a missed packet
+    /// \return Nanoseconds.
+    public: uint32_t MissSleepNs() const;
+
+    /// \brief Clock used to time the wait phases
+    private: typedef std::chrono::steady_clock Clock;
+
+    /// \brief Spin budget for this wait
+    /// \param[in] _start Time the wait started.
+    /// \return Time at which spinning stops.
+    private: Clock::time_point SpinDeadline(const Clock::time_point &_start)
+      const;
+
+    /// \brief Record the arrival of a packet
+    /// \param[in] _now Arrival time.
+    private: void RecordArrival(const Clock::time_point &_now);
+
+    /// \brief Maximum busy-poll time
+    private: std::chrono::microseconds spin{0};
+
+    /// \brief Maximum poll-and-yield time after spinning
+    private: std::chrono::microseconds yield{0};
+
+    /// \brief Blocking timeout while online
+    private: uint32_t timeoutMs = 1000;
+
+    /// \brief Sleep after a missed packet
+    private: uint32_t missSleepNs = 100;
+
+    /// \brief Spin around the expected arrival time only
+    private: bool adaptiveSpin = false;
+
+    /// \brief Arrival time of the previous packet
+    private: Clock::time_point lastArrival;
+
+    /// \brief Whether lastArrival is valid
+    private: bool haveArrival = false;
+
+    /// \brief Smoothed inter-packet interval, seconds
+    private: double intervalMean = 0;
+
+    /// \brief Smoothed absolute deviation of the interval, seconds
+    private: double intervalDev = 0;
+  };
+}
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTLOG_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTLOG_HH_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <gazebo/util/system.hh>
+
+/// \brief Longest message kept by the asynchronous log, longer ones are
+/// truncated
+#define ARDUPILOT_LOG_LINE_SIZE 256
+
+/// \brief Rate-limited, asynchronous counterparts of gzerr, gzwarn, gzmsg
+/// and gzdbg for the simulation hot path. The argument is the minimum
+/// interval between two messages of the same call site, in milliseconds.
+/// Messages are formatted into a fixed buffer only when the call site is
+/// not rate limited, queued without locking and written to the Gazebo
+/// console by a background thread. A message following suppressed ones
+/// reports how many were suppressed.
+#define aperr(_intervalMs) \
+  ARDUPILOT_LOG_(gazebo::ArduPilotLog::ERR, _intervalMs)
+#define apwarn(_intervalMs) \
+  ARDUPILOT_LOG_(gazebo::ArduPilotLog::WARN, _intervalMs)
+#define apmsg(_intervalMs) \
+  ARDUPILOT_LOG_(gazebo::ArduPilotLog::MSG, _intervalMs)
+#define apdbg(_intervalMs) \
+  ARDUPILOT_LOG_(gazebo::ArduPilotLog::DBG, _intervalMs)
+
+/// \brief Implementation of the log macros, a for statement so that the
+/// macro is safe in an unbraced if / else.
+#define ARDUPILOT_LOG_(_level, _intervalMs) \
+  for (uint64_t _apLogPass = \
+         gazebo::ArduPilotLog::Allow(__FILE__, __LINE__, _intervalMs); \
+       _apLogPass; _apLogPass = 0) \
+    gazebo::ArduPilotLogLine(_level, __FILE__, __LINE__, _apLogPass - 1)
+
+namespace gazebo
+{
+  /// \brief Asynchronous console shared by every plugin in the process,
+  /// see the aperr / apwarn / apmsg / apdbg macros.
+  class GAZEBO_VISIBLE ArduPilotLog
+  {
+    /// \brief Message severity, mapped to the Gazebo console streams
+    public: enum Level
+    {
+      /// \brief gzerr
+      ERR,
+
+      /// \brief gzwarn
+      WARN,
+
+      /// \brief gzmsg
+      MSG,
+
+      /// \brief gzdbg
+      DBG
+    };
+
+    /// \brief Rate limit a call site
+    /// \param[in] _file Source file of the call site.
+    /// \param[in] _line Source line of the call site.
+    /// \param[in] _intervalMs Minimum interval between two messages.
+    /// \return 0 if the message is suppressed, otherwise one more than the
+    /// number of messages suppressed since the last one was let through.
+    public: static uint64_t Allow(const char *_file, const int _line,
+      const uint32_t _intervalMs);
+
+    /// \brief Queue a formatted message
+    /// \param[in] _level Severity.
+    /// \param[in] _file Source file of the call site.
+    /// \param[in] _line Source line of the call site.
+    /// \param[in] _suppressed Messages suppressed before this one.
+    /// \param[in] _text Message.
+    /// \param[in] _size Message length.
+    public: static void Push(const Level _level, const char *_file,
+      const int _line, const uint64_t _suppressed, const char *_text,
+      const size_t _size);
+
+    /// \brief Write out every queued message now. Plugins call this on
+    /// unload so no message refers to a file name in an unloaded library.
+    public: static void Flush();
+  };
+
+  /// \brief One message being formatted, queued when destroyed
+  class ArduPilotLogLine
+  {
+    /// \brief Constructor
+    /// \param[in] _level Severity.
+    /// \param[in] _file Source file of the call site.
+    /// \param[in] _line Source line of the call site.
+    /// \param[in] _suppressed Messages suppressed before this one.
+    public: ArduPilotLogLine(const ArduPilotLog::Level _level,
+      const char *_file, const int _line, const uint64_t _suppressed)
+      : level(_level), file(_file), line(_line), suppressed(_suppressed)
+    {
+    }
+
+    /// \brief Destructor, queues the message
+    public: ~ArduPilotLogLine()
+    {
+      ArduPilotLog::Push(this->level, this->file, this->line,
+        this->suppressed, this->text, this->size);
+    }
+
+    /// \brief Append a string
+    /// \param[in] _s String.
+    /// \return This line.
+    public: ArduPilotLogLine &operator<<(const char *_s)
+    {
+      while (_s && *_s && this->size < sizeof(this->text))
+      {
+        this->text[this->size++] = *_s++;
+      }
+      return *this;
+    }
+
+    /// \brief Append a string
+    /// \param[in] _s String.
+    /// \return This line.
+    public: ArduPilotLogLine &operator<<(const std::string &_s)
+    {
+      return *this << _s.c_str();
+    }
+
+    /// \brief Append a character
+    /// \param[in] _c Character.
+    /// \return This line.
+    public: ArduPilotLogLine &operator<<(const char _c)
+    {
+      if (this->size < sizeof(this->text))
+      {
+        this->text[this->size++] = _c;
+      }
+      return *this;
+    }
+
+    /// \brief Append a number
+    /// \param[in] _v Integer or floating point value.
+    /// \return This line.
+    public: template <typename T>
+      typename std::enable_if<std::is_arithmetic<T>::value,
+        ArduPilotLogLine &>::type operator<<(const T _v)
+    {
+      char buf[32];
+      if (std::is_floating_point<T>::value)
+      {
+        std::snprintf(buf, sizeof(buf), "%g", static_cast<double>(_v));
+      }
+      else if (std::is_signed<T>::value)
+      {
+        std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(_v));
+      }
+      else
+      {
+        std::snprintf(buf, sizeof(buf), "%llu",
+          static_cast<unsigned long long>(_v));
+      }
+      return *this << static_cast<const char *>(buf);
+    }
+
+    /// \brief Severity
+    private: const ArduPilotLog::Level level;
+
+    /// \brief Source file of the call site
+    private: const char *file;
+
+    /// \brief Source line of the call site
+    private: const int line;
+
+    /// \brief Messages suppressed before this one
+    private: const uint64_t suppressed;
+
+    /// \brief Formatted message
+    private: char text[ARDUPILOT_LOG_LINE_SIZE];
+
+    /// \brief Length of text
+    private: size_t size = 0;
+  };
+}
+#endif
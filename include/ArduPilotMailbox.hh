@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTMAILBOX_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTMAILBOX_HH_
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <unistd.h>
+#endif
+#ifdef __linux__
+  #include <sys/eventfd.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+namespace gazebo
+{
+  /// \brief Wait-free single-producer / single-consumer mailbox holding the
+  /// newest value only (triple buffering). The producer fills Back() and
+  /// calls Publish(); the consumer calls Fetch() and reads Front(). Neither
+  /// side ever blocks or sees a partially written value, and values the
+  /// consumer did not fetch in time are simply overwritten.
+  template <typename T>
+  class ArduPilotMailbox
+  {
+    /// \brief Buffer the producer writes the next value into
+    /// \return Back buffer.
+    public: T &Back()
+    {
+      return this->buffers[this->back];
+    }
+
+    /// \brief Make the back buffer the newest value
+    public: void Publish()
+    {
+      const uint8_t prev = this->middle.exchange(this->back | kFresh,
+        std::memory_order_acq_rel);
+      this->back = prev & kIndexMask;
+    }
+
+    /// \brief Take the newest value if one was published since the last
+    /// fetch
+    /// \return True if Front() changed.
+    public: bool Fetch()
+    {
+      if (!(this->middle.load(std::memory_order_acquire) & kFresh))
+      {
+        return false;
+      }
+      const uint8_t prev = this->middle.exchange(this->front,
+        std::memory_order_acq_rel);
+      this->front = prev & kIndexMask;
+      return true;
+    }
+
+    /// \brief Value the consumer last fetched
+    /// \return Front buffer.
+    public: const T &Front() const
+    {
+      return this->buffers[this->front];
+    }
+
+    /// \brief Index bits of middle
+    private: static const uint8_t kIndexMask = 0x3;
+
+    /// \brief Set in middle when it holds a value not yet fetched
+    private: static const uint8_t kFresh = 0x4;
+
+    /// \brief The three buffers
+    private: T buffers[3];
+
+    /// \brief Buffer exchanged between producer and consumer
+    private: std::atomic<uint8_t> middle{1};
+
+    /// \brief Keep the producer and consumer indices on separate cache
+    /// lines
+    private: char pad0[64];
+
+    /// \brief Buffer owned by the producer
+    private: uint8_t back = 0;
+
+    /// \brief Keep the producer and consumer indices on separate cache
+    /// lines
+    private: char pad1[64];
+
+    /// \brief Buffer owned by the consumer
+    private: uint8_t front = 2;
+  };
+
+  /// \brief Wakeup event between two threads, an eventfd on Linux and a
+  /// pipe on other POSIX systems.
+  class ArduPilotEvent
+  {
+    /// \brief Constructor
+    public: ArduPilotEvent()
+    {
+      #if defined(__linux__)
+      this->fds[0] = this->fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      #elif !defined(_WIN32)
+      if (pipe(this->fds) == 0)
+      {
+        for (int fd : this->fds)
+        {
+          fcntl(fd, F_SETFD, FD_CLOEXEC);
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        }
+      }
+      #endif
+    }
+
+    /// \brief Destructor
+    public: ~ArduPilotEvent()
+    {
+      #ifndef _WIN32
+      if (this->fds[0] != -1)
+      {
+        close(this->fds[0]);
+      }
+      if (this->fds[1] != this->fds[0] && this->fds[1] != -1)
+      {
+        close(this->fds[1]);
+      }
+      #endif
+    }
+
+    /// \brief Whether the event could be created
+    /// \return True if usable.
+    public: bool Valid() const
+    {
+      return this->fds[0] != -1;
+    }
+
+    /// \brief Wake the waiting thread
+    public: void Signal()
+    {
+      #ifndef _WIN32
+      const uint64_t one = 1;
+      if (write(this->fds[1], &one, sizeof(one)) < 0)
+      {
+        // already signalled, the reader has not cleared it yet
+      }
+      #endif
+    }
+
+    /// \brief Wait until signalled, and clear the signal
+    /// \param[in] _timeoutMs Milliseconds to wait.
+    /// \return True if signalled before the timeout.
+    public: bool Wait(const int _timeoutMs)
+    {
+      #ifndef _WIN32
+      struct pollfd pfd;
+      pfd.fd = this->fds[0];
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, _timeoutMs) != 1)
+      {
+        return false;
+      }
+      uint64_t value;
+      while (read(this->fds[0], &value, sizeof(value)) > 0)
+      {
+        // a pipe may hold several signals
+      }
+      return true;
+      #else
+      (void)_timeoutMs;
+      return false;
+      #endif
+    }
+
+    /// \brief Read end, and write end (same fd for an eventfd)
+    private: int fds[2] = {-1, -1};
+  };
+}
+#endif
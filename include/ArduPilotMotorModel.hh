@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTMOTORMODEL_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTMOTORMODEL_HH_
+
+#include <string>
+#include <vector>
+#include <sdf/sdf.hh>
+
+namespace gazebo
+{
+  /// \brief Rotor thrust and drag torque looked up from the rotor speed,
+  /// and the first-order response of the rotor speed to its command.
+  ///
+  /// Read from an sdf element:
+  /// <thrustTable>   pairs of rotor speed (rad/s) and thrust (N), in
+  ///                 increasing speed order, interpolated linearly and
+  ///                 held past the ends
+  /// <torqueTable>   pairs of rotor speed (rad/s) and drag torque (Nm),
+  ///                 default none (no torque)
+  /// <timeConstant>  motor time constant, seconds, default 0 (the speed
+  ///                 follows its command immediately)
+  class ArduPilotMotorModel
+  {
+    /// \brief Read the tables and time constant
+    /// \param[in] _sdf Element holding them.
+    /// \param[in] _modelName Model name used to prefix messages.
+    /// \return False if a table is malformed.
+    public: bool Load(sdf::ElementPtr _sdf, const std::string &_modelName);
+
+    /// \brief Whether a thrust table was given
+    /// \return True if Thrust() is not always 0.
+    public: bool HasThrust() const;
+
+    /// \brief Thrust at a rotor speed
+    /// \param[in] _speed Rotor speed magnitude, rad/s.
+    /// \return Thrust, N.
+    public: double Thrust(const double _speed) const;
+
+    /// \brief Drag torque at a rotor speed
+    /// \param[in] _speed Rotor speed magnitude, rad/s.
+    /// \return Torque magnitude, Nm.
+    public: double Torque(const double _speed) const;
+
+    /// \brief Fraction of the gap to its command the rotor speed closes
+    /// in one step, to be computed once per step for all rotors
+    /// \param[in] _dt Step size, seconds.
+    /// \return 1 - exp(-dt / timeConstant), 1 without lag.
+    public: double LagFactor(const double _dt) const;
+
+    /// \brief Parse a table of (x, y) pairs
+    /// \param[in] _text Whitespace separated numbers.
+    /// \param[out] _x Abscissas.
+    /// \param[out] _y Ordinates.
+    /// \return False on an odd count, a non-number or decreasing x.
+    private: static bool ParseTable(const std::string &_text,
+      std::vector<double> &_x, std::vector<double> &_y);
+
+    /// \brief Interpolate a table
+    /// \param[in] _x Abscissas.
+    /// \param[in] _y Ordinates.
+    /// \param[in] _at Abscissa to interpolate at.
+    /// \return Interpolated ordinate, 0 for an empty table.
+    private: static double Interpolate(const std::vector<double> &_x,
+      const std::vector<double> &_y, const double _at);
+
+    /// \brief Thrust table speeds
+    private: std::vector<double> thrustSpeeds;
+
+    /// \brief Thrust table values
+    private: std::vector<double> thrustValues;
+
+    /// \brief Torque table speeds
+    private: std::vector<double> torqueSpeeds;
+
+    /// \brief Torque table values
+    private: std::vector<double> torqueValues;
+
+    /// \brief Motor time constant, seconds
+    private: double timeConstant = 0.0;
+  };
+}
+#endif
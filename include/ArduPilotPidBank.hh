@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTPIDBANK_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTPIDBANK_HH_
+
+#include <cstddef>
+#include <vector>
+#include <gazebo/common/PID.hh>
+
+namespace gazebo
+{
+  /// \brief All PID loops of a vehicle, updated together.
+  ///
+  /// Gains, limits and state are kept one array per field, padded to
+  /// kLanes, so a step updates kLanes loops per instruction with AVX2 or
+  /// SSE2 where the cpu has them, and a plain loop otherwise. Every path
+  /// runs the same operations in the same order as common::PID::Update,
+  /// including its handling of non-finite errors, a zero step and limits
+  /// of zero meaning unlimited, so the commands match common::PID bit for
+  /// bit.
+  class ArduPilotPidBank
+  {
+    /// \brief Loops per vector, arrays are padded to a multiple of it
+    public: static const size_t kLanes = 4;
+
+    /// \brief Add a loop with the gains and limits of a PID
+    /// \param[in] _pid Configured PID, its state is not copied.
+    /// \return Lane of the new loop.
+    public: size_t Add(const common::PID &_pid);
+
+    /// \brief Number of loops added
+    /// \return Loop count.
+    public: size_t Size() const;
+
+    /// \brief Error inputs, to be filled before Update
+    /// \return Array of Size() errors, padded.
+    public: double *Errors();
+
+    /// \brief Update every loop with the errors in Errors()
+    /// \param[in] _dt Step size, seconds, as common::PID sees it: callers
+    /// passing a double to common::PID::Update get it rounded to
+    /// nanoseconds by common::Time.
+    /// \return Array of Size() commands.
+    public: const double *Update(const double _dt);
+
+    /// \brief Clear the integral and derivative state of every loop
+    public: void Reset();
+
+    /// \brief Code path Update uses on this cpu
+    /// \return avx2, sse2 or scalar.
+    public: static const char *Isa();
+
+    /// \brief Number of loops
+    private: size_t size = 0;
+
+    /// \brief Proportional gains
+    private: std::vector<double> pGain;
+
+    /// \brief Integral gains
+    private: std::vector<double> iGain;
+
+    /// \brief Derivative gains
+    private: std::vector<double> dGain;
+
+    /// \brief Integral term upper limits
+    private: std::vector<double> iMax;
+
+    /// \brief Integral term lower limits
+    private: std::vector<double> iMin;
+
+    /// \brief Command upper limits, +inf where common::PID ignores a zero
+    /// limit
+    private: std::vector<double> cmdMax;
+
+    /// \brief Command lower limits, -inf where common::PID ignores a zero
+    /// limit
+    private: std::vector<double> cmdMin;
+
+    /// \brief Integral of the error
+    private: std::vector<double> iErr;
+
+    /// \brief Error of the previous update
+    private: std::vector<double> pErrLast;
+
+    /// \brief Error inputs
+    private: std::vector<double> errors;
+
+    /// \brief Command outputs
+    private: std::vector<double> cmds;
+  };
+}
+#endif
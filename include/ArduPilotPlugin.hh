@@ -20,11 +20,11 @@
 #include <sdf/sdf.hh>
 #include <gazebo/common/common.hh>
 #include <gazebo/physics/physics.hh>
+#include "include/ArduPilotVehicleState.hh"
 
 namespace gazebo
 {
   // Forward declare private data class
-  class ArduPilotSocketPrivate;
   class ArduPilotPluginPrivate;
 
   /// \brief Interface ArduPilot from ardupilot stack
@@ -36,7 +36,8 @@ namespace gazebo
   ///    channel            attribute, ardupilot control channel
   ///    multiplier         command multiplier
   ///    <!-- output to Gazebo -->
-  ///    type               type of control, VELOCITY, POSITION or EFFORT
+  ///    type               type of control, VELOCITY, POSITION, EFFORT or
+  ///                       ROTOR
   ///    <p_gain>           velocity pid p gain
   ///    <i_gain>           velocity pid i gain
   ///    <d_gain>           velocity pid d gain
@@ -46,12 +47,79 @@ namespace gazebo
   ///    <cmd_min>          velocity pid min command torque
   ///    <jointName>        motor joint, torque applied here
   ///    <turningDirection> rotor turning direction, 'cw' or 'ccw'
-  ///    frequencyCutoff    filter incoming joint state
-  ///    samplingRate       sampling rate for filtering incoming joint state
+  ///    frequencyCutoff    low-pass cutoff of the joint velocity sent as
+  ///                       ESC rpm, see <fdmEscRpm>
+  ///    samplingRate       ignored, the filter samples at the physics
+  ///                       rate (1 / max_step_size)
   ///    <rotorVelocitySlowdownSim> for rotor aliasing problem, experimental
+  ///    <!-- ROTOR: no joint, the command is the rotor speed in rad/s -->
+  ///    <thrustTable>, <torqueTable>, <timeConstant> motor model, see
+  ///                       ArduPilotMotorModel, thrust and drag torque act
+  ///                       on the canonical link
+  ///    <rotorPosition>    rotor position in the canonical link frame
+  ///    <rotorAxis>        thrust axis in that frame, default 0 0 1
+  ///    <visualName>       scoped name of a prop visual spun for display
+  ///                       only, speed divided by rotorVelocitySlowdownSim
+  ///    <visualPose>       its pose at rest, default at <rotorPosition>
+  /// <rotorVisualRate> sim rate the ROTOR prop visuals are published at,
+  ///               Hz, default 30
   /// <imuName>     scoped name for the imu sensor
+  /// <imuSynthetic> compute the IMU from its link at every step instead,
+  ///               with <imuLinkName>, <imuPose>, bias and noise, no imu
+  ///               sensor needed, see ArduPilotImu
   /// <connectionTimeoutMaxCount> timeout before giving up on
   ///                             controller synchronization
+  /// <offlineProbeMinUs>, <offlineProbeMaxUs> while ArduPilot is offline,
+  ///               physics never waits for it: the link is checked without
+  ///               blocking at an interval doubling from min (default 1000)
+  ///               to max (default 20000), and goes online on the first
+  ///               packet
+  /// <exchangeEveryNSteps> receive commands and send state only every N
+  ///               physics steps, forces are still applied every step,
+  ///               default 1
+  /// <exchangeRate> alternative to <exchangeEveryNSteps>, exchange rate in
+  ///               Hz, N is derived from the physics max step size
+  /// <lockstep>    false to never wait for ArduPilot, default true
+  /// <commandExtrapolation> free-running mode, hold (default) or linear
+  /// <maxCommandAgeMs> free-running mode, sim time a stale command is
+  ///               extrapolated for before being held, default 100
+  /// <connectionTimeoutMs> free-running mode, wall time without a command
+  ///               before giving up on the controller, default 1000
+  /// <stepTiming>  record lock, wait, command, forces and send durations of
+  ///               every step in histograms, published as text on
+  ///               ~/<model>/step_timing and logged on unload, default false
+  /// <stepTimingPeriod> sim seconds between publications, default 1
+  /// <transport>   link to ArduPilot, udp (default) or shm
+  /// <listen_addr> address servo packets are received on, IPv4 or
+  ///               unix:<path> for a unix-domain datagram socket
+  /// <fdm_addr>    address state is sent to, IPv4 or unix:<path>
+  /// <fdm_port_in>, <fdm_port_out> udp ports, unused with unix:<path>
+  /// <fdmMirror>   repeatable, also send every state packet to <addr> and
+  ///               <port>: IPv4 unicast or multicast, unix:<path> or
+  ///               shm:<name> for a snapshot slot; replies are never read,
+  ///               see ArduPilotFanout
+  /// <ioThread>    receive and send on dedicated I/O threads instead of
+  ///               the physics thread, default false
+  /// <sharedReactor> serve this vehicle's udp link from one epoll set and
+  ///               sendmmsg() batch shared by all vehicles, default false
+  /// <lockstepWait> spin / yield / block policy for the servo packet wait,
+  ///               see ArduPilotLockstepWait
+  /// <realtime>    cpu pinning and SCHED_FIFO for the physics and I/O
+  ///               threads, socket buffer and busy-poll settings, see
+  ///               ArduPilotRealtime
+  /// <protocol>    wire format, legacy (default, raw packet structs), v2
+  ///               (framed with magic, version and frame counters) or json
+  ///               (ArduPilot's JSON SITL interface), see ArduPilotProtocol
+  /// <replyToSender> send state to wherever servo packets come from,
+  ///               from the listen socket, default true for json
+  /// <fdmFloat32>  v2 only, send state fields as float32, default false
+  /// <fdmGps>, <fdmAirspeed>, <fdmBattery>, <fdmRangefinder>, <fdmEscRpm>
+  ///               v2 (json all but gps), add these optional fields to the
+  ///               state, computed from the model state unless <gpsName> /
+  ///               <rangefinderName> name a sensor, see
+  ///               ArduPilotFdmExtensions
+  /// <shm_name>    shared memory segment for the shm transport, default
+  ///               /ardupilot_gazebo_<model name>, see shim/
   class GAZEBO_VISIBLE ArduPilotPlugin : public ModelPlugin
   {
     /// \brief Constructor.
@@ -63,6 +131,34 @@ namespace gazebo
     // Documentation Inherited.
     public: virtual void Load(physics::ModelPtr _model, sdf::ElementPtr _sdf);
 
+    /// \brief Number of backed-up servo packets that were drained and
+    /// discarded in favour of a newer one since the plugin was loaded.
+    /// \return Drained packet count.
+    public: uint64_t DrainedPacketCount() const;
+
+    /// \brief Round-trip time from sending state to the kernel arrival of
+    /// the servo packet that answered it, over the most recent exchanges.
+    /// \param[out] _p50Us Median, microseconds.
+    /// \param[out] _p99Us 99th percentile, microseconds.
+    /// \param[out] _maxUs Maximum, microseconds.
+    /// \return False if the transport does not measure round trips or
+    /// nothing was measured yet.
+    public: bool RoundTripSummary(double &_p50Us, double &_p99Us,
+      double &_maxUs) const;
+
+    /// \brief Number of physics steps that ran on a stale command in
+    /// free-running mode since the plugin was loaded.
+    /// \return Stale step count.
+    public: uint64_t StaleStepCount() const;
+
+    /// \brief Vehicle state of the current physics step, gathered once per
+    /// step and shared with SendState; call from the physics thread.
+    /// Pose and velocity are always of the current step. Called before
+    /// this plugin's own update of the step, the synthetic IMU, motor power
+    /// and ESC rpm are still those of the previous step.
+    /// \return NED pose and velocity, IMU, motor power and ESC rpm.
+    public: ArduPilotVehicleState VehicleState() const;
+
     /// \brief Update the control surfaces controllers.
     /// \param[in] _info Update information provided by the server.
     private: void OnUpdate();
@@ -77,10 +173,14 @@ namespace gazebo
     /// \brief Receive motor commands from ArduPilot
     private: void ReceiveMotorCommand();
 
+    /// \brief Free-running mode, no new command arrived for this physics
+    /// step: count it and hold or extrapolate the last commands
+    private: void HoldStaleCommands();
+
     /// \brief Send state to ArduPilot
     private: void SendState() const;
 
-    /// \brief Init ardupilot socket
+    /// \brief Init ardupilot transport, udp sockets or shared memory
     private: bool InitArduPilotSockets(sdf::ElementPtr _sdf) const;
 
     /// \brief Private data pointer.
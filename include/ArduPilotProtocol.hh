@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTPROTOCOL_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTPROTOCOL_HH_
+
+#include <cstdint>
+#include <string>
+#include <sdf/sdf.hh>
+#include "include/ArduPilotTransport.hh"
+
+namespace gazebo
+{
+  /// \brief Header starting every v2 frame, in host byte order.
+  ///
+  /// Servo frame (ArduPilot -> gazebo):
+  ///   header, then channelCount float32 servo commands.
+  /// State frame (gazebo -> ArduPilot):
+  ///   header with channelCount 0, then every field whose bit is set in
+  ///   fields, in bit order. Fields are float64, or float32 when
+  ///   kFrameFloat32 is set in flags; the timestamp, latitude and longitude
+  ///   are always float64. The fields after FDM_POSITION are optional and
+  ///   may come and go from one frame to the next.
+  struct ArduPilotFrameHeader
+  {
+    /// \brief kFrameMagic
+    uint32_t magic;
+
+    /// \brief kFrameVersion
+    uint8_t version;
+
+    /// \brief kFrameFloat32 or 0
+    uint8_t flags;
+
+    /// \brief Number of servo channels, 0 in state frames
+    uint16_t channelCount;
+
+    /// \brief Per-direction frame counter, incremented by the sender
+    uint32_t frameCount;
+
+    /// \brief Field-presence bitmask, ArduPilotFdmField
+    uint32_t fields;
+  };
+
+  /// \brief "APGZ"
+  static const uint32_t kFrameMagic = 0x5a475041;
+
+  /// \brief Current framing version
+  static const uint8_t kFrameVersion = 2;
+
+  /// \brief Payload fields are float32
+  static const uint8_t kFrameFloat32 = 0x01;
+
+  /// \brief Fields a state frame may carry, in wire order
+  enum ArduPilotFdmField : uint32_t
+  {
+    /// \brief timestamp, 1 value, always float64
+    FDM_TIMESTAMP = 1u << 0,
+
+    /// \brief imuAngularVelocityRPY, 3 values
+    FDM_IMU_GYRO = 1u << 1,
+
+    /// \brief imuLinearAccelerationXYZ, 3 values
+    FDM_IMU_ACCEL = 1u << 2,
+
+    /// \brief imuOrientationQuat, 4 values
+    FDM_ORIENTATION = 1u << 3,
+
+    /// \brief velocityXYZ, 3 values
+    FDM_VELOCITY = 1u << 4,
+
+    /// \brief positionXYZ, 3 values
+    FDM_POSITION = 1u << 5,
+
+    /// \brief latitude, longitude (both always float64), altitude
+    FDM_GPS = 1u << 6,
+
+    /// \brief airspeed, 1 value
+    FDM_AIRSPEED = 1u << 7,
+
+    /// \brief batteryVoltage, batteryCurrent, 2 values
+    FDM_BATTERY = 1u << 8,
+
+    /// \brief rangefinder, 1 value
+    FDM_RANGEFINDER = 1u << 9,
+
+    /// \brief escCount as uint32, then escCount escRpm values
+    FDM_ESC_RPM = 1u << 10
+  };
+
+  /// \brief Fields present in every state frame
+  static const uint32_t kFdmBaseFields = FDM_TIMESTAMP | FDM_IMU_GYRO |
+    FDM_IMU_ACCEL | FDM_ORIENTATION | FDM_VELOCITY | FDM_POSITION;
+
+  /// \brief Optional fields, carried by fdmExtension
+  static const uint32_t kFdmExtensionFields = FDM_GPS | FDM_AIRSPEED |
+    FDM_BATTERY | FDM_RANGEFINDER | FDM_ESC_RPM;
+
+  /// \brief Header of a servo packet of ArduPilot's JSON SITL interface
+  /// (SIM_JSON), followed by 16 or 32 uint16 pwm values depending on the
+  /// magic
+  struct ArduPilotJsonServoHeader
+  {
+    /// \brief kJsonServoMagic16 or kJsonServoMagic32
+    uint16_t magic;
+
+    /// \brief Physics rate ArduPilot expects, Hz
+    uint16_t frameRate;
+
+    /// \brief Incremented by ArduPilot for every packet
+    uint32_t frameCount;
+  };
+
+  /// \brief JSON servo packet with 16 channels
+  static const uint16_t kJsonServoMagic16 = 18458;
+
+  /// \brief JSON servo packet with 32 channels
+  static const uint16_t kJsonServoMagic32 = 29569;
+
+  /// \brief v2 servo frames further behind the last one received than
+  /// this are taken for a restarted ArduPilot rather than reordered
+  static const int32_t kServoReorderWindow = 64;
+
+  /// \brief Encodes state packets and decodes servo packets for the
+  /// configured wire format, <protocol> "legacy" (default, raw structs),
+  /// "v2" (ArduPilotFrameHeader framing) or "json" (ArduPilot's JSON SITL
+  /// interface: pwm servo packets in, one line of JSON state out), and
+  /// keeps frame statistics.
+  class ArduPilotProtocol
+  {
+    /// \brief Read the format from the plugin sdf
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _modelName Model name used to prefix messages.
+    /// \return False if the protocol is unknown.
+    public: bool Load(sdf::ElementPtr _sdf, const std::string &_modelName);
+
+    /// \brief Whether v2 framing is in use
+    /// \return True for v2.
+    public: bool Framed() const;
+
+    /// \brief Whether the JSON format is in use
+    /// \return True for json.
+    public: bool Json() const;
+
+    /// \brief Optional fields the format can carry
+    /// \return ArduPilotFdmField bits of kFdmExtensionFields.
+    public: uint32_t ExtensionFields() const;
+
+    /// \brief Extract the servo channels of a received packet
+    /// \param[in] _pkt Received packet.
+    /// \param[in] _size Received size.
+    /// \param[out] _channels First servo command.
+    /// \return Number of channels, -1 if the frame is malformed.
+    public: ssize_t DecodeServo(const ServoPacket &_pkt, const ssize_t _size,
+      const float *&_channels);
+
+    /// \brief Serialize a state packet
+    /// \param[in] _pkt State to send.
+    /// \param[in] _ext Optional state to send, v2 only.
+    /// \param[out] _size Number of bytes to send.
+    /// \return Bytes to send, _pkt itself for the legacy format or an
+    /// internal buffer valid until the next call, nullptr if the state
+    /// does not fit and nothing must be sent.
+    public: const void *EncodeFdm(const fdmPacket &_pkt,
+      const fdmExtension &_ext, size_t &_size);
+
+    /// \brief Forget the last servo frame counter, so that the next frame
+    /// is accepted whatever its counter, e.g. once ArduPilot went offline
+    public: void ResetFrameState();
+
+    /// \brief Servo frames missing between received frame counters
+    public: uint64_t Gaps() const;
+
+    /// \brief Servo frames received twice
+    public: uint64_t Duplicates() const;
+
+    /// \brief Servo frames older than one already received
+    public: uint64_t Reordered() const;
+
+    /// \brief Servo frames with a bad magic, version or length
+    public: uint64_t Mismatches() const;
+
+    /// \brief Append the fields of _pkt and _ext selected by _fields to
+    /// out
+    /// \tparam T float or double
+    /// \param[in] _pkt State to send.
+    /// \param[in] _ext Optional state to send.
+    /// \param[in] _fields ArduPilotFdmField bits to send.
+    /// \param[in,out] _out Write position.
+    private: template <typename T>
+      void EncodeFields(const fdmPacket &_pkt, const fdmExtension &_ext,
+        const uint32_t _fields, unsigned char *&_out) const;
+
+    /// \brief Decode a JSON servo packet
+    /// \param[in] _pkt Received packet.
+    /// \param[in] _size Received size.
+    /// \param[out] _channels First servo command.
+    /// \return Number of channels, -1 if the packet is malformed.
+    private: ssize_t DecodeJsonServo(const ServoPacket &_pkt,
+      const ssize_t _size, const float *&_channels);
+
+    /// \brief Serialize a state packet as JSON
+    /// \param[in] _pkt State to send.
+    /// \param[in] _ext Optional state to send.
+    /// \param[out] _size Number of bytes to send.
+    /// \return Bytes to send, nullptr if the message overflows the buffer.
+    private: const void *EncodeJsonFdm(const fdmPacket &_pkt,
+      const fdmExtension &_ext, size_t &_size);
+
+    /// \brief Model name used to prefix messages
+    private: std::string modelName;
+
+    /// \brief v2 framing
+    private: bool framed = false;
+
+    /// \brief JSON SITL format
+    private: bool json = false;
+
+    /// \brief Send state fields as float32
+    private: bool float32 = false;
+
+    /// \brief Fields sent in each state frame
+    private: uint32_t fields = kFdmBaseFields;
+
+    /// \brief Next state frame counter
+    private: uint32_t fdmFrameCount = 0;
+
+    /// \brief Last servo frame counter received
+    private: uint32_t lastServoFrame = 0;
+
+    /// \brief Whether lastServoFrame is valid
+    private: bool haveServoFrame = false;
+
+    /// \brief Frame statistics
+    private: uint64_t gaps = 0;
+
+    /// \brief Frame statistics
+    private: uint64_t duplicates = 0;
+
+    /// \brief Frame statistics
+    private: uint64_t reordered = 0;
+
+    /// \brief Frame statistics
+    private: uint64_t mismatches = 0;
+
+    /// \brief Encoded state frame
+    private: unsigned char buffer[FDM_PACKET_MAX_SIZE];
+
+    /// \brief Servo commands converted from JSON pwm values
+    private: float jsonChannels[32];
+  };
+}
+#endif
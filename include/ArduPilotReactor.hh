@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTREACTOR_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTREACTOR_HH_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotTransport.hh"
+
+namespace gazebo
+{
+  class ArduPilotReactorTransport;
+
+  /// \brief Process-wide poller shared by every ArduPilotPlugin that sets
+  /// <sharedReactor>. All receive sockets sit in one epoll set: whichever
+  /// vehicle first needs a servo packet waits on the set and drains every
+  /// socket that became ready, so the other vehicles find their command
+  /// already there. State packets are queued and sent to all vehicles with
+  /// one sendmmsg() once every registered vehicle has queued its packet,
+  /// or at the end of the world update.
+  ///
+  /// Linux only. All calls are expected from the physics thread, a mutex
+  /// only guards against plugins updated from other threads.
+  class ArduPilotReactor
+  {
+    /// \brief Get the reactor, creating it for the first vehicle
+    /// \return Shared reactor, nullptr if epoll is unavailable.
+    public: static std::shared_ptr<ArduPilotReactor> Instance();
+
+    /// \brief Destructor
+    public: ~ArduPilotReactor();
+
+    /// \brief Add a vehicle
+    /// \param[in] _vehicle Vehicle transport.
+    /// \return True on success.
+    public: bool Register(ArduPilotReactorTransport *_vehicle);
+
+    /// \brief Apply a vehicle's <sndBuf> to the shared send sockets, the
+    /// largest one requested by any vehicle is kept
+    /// \param[in] _realtime Settings of the vehicle.
+    public: void TuneSend(const ArduPilotRealtime &_realtime);
+
+    /// \brief Remove a vehicle
+    /// \param[in] _vehicle Vehicle transport.
+    public: void Unregister(ArduPilotReactorTransport *_vehicle);
+
+    /// \brief Wait until _vehicle has a servo packet or the timeout
+    /// expires, receiving for every vehicle that becomes ready meanwhile.
+    /// \param[in] _vehicle Vehicle that needs a packet.
+    /// \param[in] _timeoutMs Milliseconds to wait.
+    public: void Poll(ArduPilotReactorTransport *_vehicle,
+      const uint32_t _timeoutMs);
+
+    /// \brief Queue a state packet for _vehicle
+    /// \param[in] _vehicle Sending vehicle.
+    /// \param[in] _buf Data to send.
+    /// \param[in] _size Size of the data.
+    /// \return Bytes queued or -1 if too large.
+    public: ssize_t Queue(ArduPilotReactorTransport *_vehicle,
+      const void *_buf, size_t _size);
+
+    /// \brief Send every queued state packet
+    public: void Flush();
+
+    /// \brief Constructor, use Instance()
+    private: ArduPilotReactor();
+
+    /// \brief Flush with the lock held
+    private: void FlushLocked();
+
+    /// \brief epoll set of all receive sockets
+    private: int epollFd = -1;
+
+    /// \brief Unconnected sockets state packets are sent from, per family
+    private: int sendFdInet = -1;
+
+    /// \brief Unconnected sockets state packets are sent from, per family
+    private: int sendFdUnix = -1;
+
+    /// \brief SO_SNDBUF applied to the send sockets, 0 for the default
+    private: int sndBuf = 0;
+
+    /// \brief Registered vehicles
+    private: std::vector<ArduPilotReactorTransport *> vehicles;
+
+    /// \brief Vehicles with a queued state packet
+    private: std::vector<ArduPilotReactorTransport *> queued;
+
+    /// \brief Flushes leftovers at the end of each world update
+    private: event::ConnectionPtr updateEndConnection;
+
+    /// \brief Guards all of the above
+    private: std::mutex mutex;
+  };
+
+  /// \brief Socket transport whose I/O is done by the shared
+  /// ArduPilotReactor
+  class ArduPilotReactorTransport : public ArduPilotTransport
+  {
+    /// \brief Destructor
+    public: ~ArduPilotReactorTransport();
+
+    // Documentation Inherited.
+    public: bool Open(sdf::ElementPtr _sdf,
+      const std::string &_modelName) override;
+
+    // Documentation Inherited.
+    public: const ServoPacket *ReceiveLatest(uint32_t _timeoutMs,
+      ssize_t &_size) override;
+
+    // Documentation Inherited.
+    public: ssize_t Send(const void *_buf, size_t _size) override;
+
+    // Documentation Inherited.
+    public: uint64_t DrainedPacketCount() const override;
+
+    // Documentation Inherited.
+    public: const ArduPilotRoundTrip *RoundTrip() const override;
+
+    /// \brief Sockets and receive ring
+    private: ArduPilotSocketTransport socket;
+
+    /// \brief Shared reactor
+    private: std::shared_ptr<ArduPilotReactor> reactor;
+
+    /// \brief Newest servo packet received by the reactor, not yet consumed
+    private: const ServoPacket *pending = nullptr;
+
+    /// \brief Size of pending
+    private: ssize_t pendingSize = -1;
+
+    /// \brief Destination of state packets
+    private: struct sockaddr_storage peer;
+
+    /// \brief Length of peer
+    private: socklen_t peerLen = 0;
+
+    /// \brief Queued state packet
+    private: unsigned char out[FDM_PACKET_MAX_SIZE];
+
+    /// \brief Size of the queued state packet, 0 if none
+    private: size_t outSize = 0;
+
+    /// \brief Packets overwritten before being consumed
+    private: uint64_t skipped = 0;
+
+    friend class ArduPilotReactor;
+  };
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTREALTIME_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTREALTIME_HH_
+
+#include <string>
+#include <vector>
+#include <sdf/sdf.hh>
+
+namespace gazebo
+{
+  /// \brief Host tuning for the lockstep I/O path.
+  ///
+  /// Configured by an optional <realtime> block:
+  /// <cpus>          cores the lockstep threads may run on, e.g. "2 3"
+  /// <fifoPriority>  SCHED_FIFO priority of the lockstep threads, 1-99,
+  ///                 default 0 (keep the normal scheduler)
+  /// <rcvBuf>        SO_RCVBUF of the sockets in bytes, default 0 (kernel
+  ///                 default)
+  /// <sndBuf>        SO_SNDBUF of the sockets in bytes, default 0
+  /// <busyPollUs>    SO_BUSY_POLL of the sockets, default 0 (off)
+  ///
+  /// With <sharedReactor> the state is sent from the reactor's shared
+  /// sockets: they get the largest <sndBuf> of any vehicle, the other
+  /// settings apply to each vehicle's servo socket.
+  ///
+  /// Every setting is best effort: the plugin keeps running when the host
+  /// refuses one (missing CAP_SYS_NICE or CAP_NET_ADMIN, a buffer capped by
+  /// net.core.rmem_max / wmem_max, an offline core), and the refusal is
+  /// reported once. Thread settings are Linux only.
+  class ArduPilotRealtime
+  {
+    /// \brief Read the <realtime> block of the plugin sdf
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _name Name used to prefix messages.
+    public: void Load(sdf::ElementPtr _sdf, const std::string &_name);
+
+    /// \brief Whether any thread setting was requested
+    /// \return True if ApplyToThread() has something to do.
+    public: bool ThreadSettings() const;
+
+    /// \brief Pin the calling thread and raise its priority as configured
+    /// \param[in] _thread Thread description for messages.
+    public: void ApplyToThread(const std::string &_thread) const;
+
+    /// \brief Apply the socket buffer and busy-poll settings to a socket
+    /// \param[in] _fd Socket handle.
+    /// \param[in] _socket Socket description for messages.
+    public: void ApplyToSocket(const int _fd, const std::string &_socket)
+      const;
+
+    /// \brief Apply only the send buffer setting, to a socket that never
+    /// receives
+    /// \param[in] _fd Socket handle.
+    /// \param[in] _socket Socket description for messages.
+    public: void ApplyToSendSocket(const int _fd,
+      const std::string &_socket) const;
+
+    /// \brief Requested SO_SNDBUF
+    /// \return Bytes, 0 for the kernel default.
+    public: int SendBuffer() const;
+
+    /// \brief Set one socket buffer size, reading it back to detect a
+    /// silent cap
+    /// \param[in] _fd Socket handle.
+    /// \param[in] _option SO_RCVBUF or SO_SNDBUF.
+    /// \param[in] _bytes Requested size.
+    /// \param[in] _socket Socket description for messages.
+    private: void SetBuffer(const int _fd, const int _option,
+      const int _bytes, const std::string &_socket) const;
+
+    /// \brief Name used to prefix messages
+    private: std::string name;
+
+    /// \brief Allowed cores, empty to leave the affinity alone
+    private: std::vector<int> cpus;
+
+    /// \brief SCHED_FIFO priority, 0 to leave the scheduler alone
+    private: int fifoPriority = 0;
+
+    /// \brief Requested SO_RCVBUF, 0 for the kernel default
+    private: int rcvBuf = 0;
+
+    /// \brief Requested SO_SNDBUF, 0 for the kernel default
+    private: int sndBuf = 0;
+
+    /// \brief Requested SO_BUSY_POLL, 0 for off
+    private: int busyPollUs = 0;
+  };
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTROTORAEROPLUGIN_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTROTORAEROPLUGIN_HH_
+
+#include <memory>
+#include <sdf/sdf.hh>
+#include <gazebo/common/common.hh>
+#include <gazebo/physics/physics.hh>
+
+namespace gazebo
+{
+  // Forward declare private data class
+  class ArduPilotRotorAeroPluginPrivate;
+
+  /// \brief Aerodynamics of all rotors of a model in one plugin, in place
+  /// of one LiftDragPlugin per blade.
+  ///
+  /// Every link is queried for its pose and velocity once per step, all
+  /// blades are evaluated in one pass over structure-of-arrays blade data
+  /// by ArduPilotBladeBank, and the summed force and torque are applied
+  /// once per link. That pass is scalar, there is no SIMD kernel.
+  ///
+  /// <rotor>           repeatable, one rotor:
+  ///   <link_name>     rotor link
+  ///   <blade>         repeatable, one blade element with LiftDragPlugin's
+  ///                   parameters and defaults: <a0>, <alpha_stall>, <cla>,
+  ///                   <cda>, <cla_stall>, <cda_stall>, <area>,
+  ///                   <air_density>, <cp>, <forward>, <upward>,
+  ///                   <radial_symmetry>. A parameter missing from the
+  ///                   <blade> is read from its <rotor>, then from the
+  ///                   plugin element, so shared coefficients are given
+  ///                   once. Forces match LiftDragPlugin's, whose pitching
+  ///                   moment is always zero; <cma> and control joints are
+  ///                   not supported.
+  ///   <thrustTable>   instead of blades, thrust and drag torque from the
+  ///   <torqueTable>   rotor speed, see ArduPilotMotorModel, with the
+  ///   <timeConstant>  speed lagging the joint velocity by timeConstant
+  ///   <joint_name>    table rotors: joint whose velocity is the rotor
+  ///                   speed
+  ///   <upward>        table rotors: thrust axis in the link frame,
+  ///                   default 0 0 1; the drag torque opposes the joint
+  ///                   rotation about it
+  class GAZEBO_VISIBLE ArduPilotRotorAeroPlugin : public ModelPlugin
+  {
+    /// \brief Constructor.
+    public: ArduPilotRotorAeroPlugin();
+
+    /// \brief Destructor.
+    public: ~ArduPilotRotorAeroPlugin();
+
+    // Documentation Inherited.
+    public: virtual void Load(physics::ModelPtr _model, sdf::ElementPtr _sdf);
+
+    /// \brief Compute and apply the rotor forces.
+    private: void OnUpdate();
+
+    /// \brief Private data pointer.
+    private: std::unique_ptr<ArduPilotRotorAeroPluginPrivate> dataPtr;
+  };
+}
+#endif
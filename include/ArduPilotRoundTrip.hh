@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTROUNDTRIP_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTROUNDTRIP_HH_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+/// \brief Number of recent round trips kept per vehicle
+#define ROUND_TRIP_WINDOW 4096
+
+namespace gazebo
+{
+  /// \brief Rolling distribution of the time from sending a state packet
+  /// to the kernel arrival of the servo packet ArduPilot answered it with.
+  ///
+  /// Sent() and Received() may be called from different I/O threads.
+  class ArduPilotRoundTrip
+  {
+    /// \brief Summary of the current window, in microseconds
+    public: struct Summary
+    {
+      /// \brief Samples in the window
+      uint64_t count = 0;
+
+      /// \brief Round trips measured since the start
+      uint64_t total = 0;
+
+      /// \brief Shortest round trip
+      double min = 0;
+
+      /// \brief Median
+      double p50 = 0;
+
+      /// \brief 90th percentile
+      double p90 = 0;
+
+      /// \brief 99th percentile
+      double p99 = 0;
+
+      /// \brief Longest round trip
+      double max = 0;
+    };
+
+    /// \brief Record that a state packet left at _ns
+    /// \param[in] _ns CLOCK_REALTIME nanoseconds.
+    public: void Sent(const int64_t _ns);
+
+    /// \brief Record the arrival of a servo packet. The first one to
+    /// arrive after an unanswered state packet is paired with it.
+    /// \param[in] _ns Kernel arrival time, CLOCK_REALTIME nanoseconds.
+    public: void Received(const int64_t _ns);
+
+    /// \brief Percentiles of the current window
+    /// \return Summary, count 0 if nothing was measured.
+    public: Summary Get() const;
+
+    /// \brief Current CLOCK_REALTIME, the clock of kernel timestamps
+    /// \return Nanoseconds.
+    public: static int64_t Now();
+
+    /// \brief Send time of the unanswered state packet, 0 if none
+    private: std::atomic<int64_t> sentNs{0};
+
+    /// \brief Protects the window
+    private: mutable std::mutex mutex;
+
+    /// \brief Ring of recent round trips, nanoseconds
+    private: int64_t window[ROUND_TRIP_WINDOW];
+
+    /// \brief Next window slot
+    private: unsigned head = 0;
+
+    /// \brief Round trips measured since the start
+    private: uint64_t total = 0;
+  };
+}
+#endif
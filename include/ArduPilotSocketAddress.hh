@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTSOCKETADDRESS_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTSOCKETADDRESS_HH_
+
+#ifdef _WIN32
+  #include <Winsock2.h>
+  #include <Ws2tcpip.h>
+#else
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <netinet/in.h>
+  #include <arpa/inet.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace gazebo
+{
+  /// \brief Prefix selecting a unix-domain datagram socket in an address
+  /// string, e.g. "unix:/run/sim/veh3.sock". Any other string is an IPv4
+  /// address.
+  static const char kUnixSocketPrefix[] = "unix:";
+
+  /// \brief Whether an address string names a unix-domain socket path
+  /// \param[in] _address Address string from sdf.
+  /// \return True for "unix:<path>".
+  inline bool IsUnixSocketAddress(const std::string &_address)
+  {
+    return _address.compare(0, sizeof(kUnixSocketPrefix) - 1,
+      kUnixSocketPrefix) == 0;
+  }
+
+  /// \brief Socket address family for an address string
+  /// \param[in] _address Address string from sdf.
+  /// \return AF_UNIX or AF_INET.
+  inline int SocketAddressFamily(const std::string &_address)
+  {
+    #ifndef _WIN32
+    if (IsUnixSocketAddress(_address))
+    {
+      return AF_UNIX;
+    }
+    #endif
+    return AF_INET;
+  }
+
+  /// \brief Fill a socket address from an sdf address string.
+  /// \param[in] _address "unix:<path>" or an IPv4 address.
+  /// \param[in] _port Port, ignored for unix-domain paths.
+  /// \param[out] _sockaddr New socket address structure.
+  /// \param[out] _len Length of the address in _sockaddr.
+  /// \return False if the path does not fit in sockaddr_un or unix-domain
+  /// sockets are unsupported on this platform.
+  inline bool MakeSocketAddress(const std::string &_address,
+    const uint16_t _port, struct sockaddr_storage &_sockaddr,
+    socklen_t &_len)
+  {
+    memset(&_sockaddr, 0, sizeof(_sockaddr));
+
+    if (IsUnixSocketAddress(_address))
+    {
+      #ifdef _WIN32
+      return false;
+      #else
+      const std::string path =
+        _address.substr(sizeof(kUnixSocketPrefix) - 1);
+      struct sockaddr_un *un =
+        reinterpret_cast<struct sockaddr_un *>(&_sockaddr);
+      if (path.empty() || path.size() >= sizeof(un->sun_path))
+      {
+        return false;
+      }
+      un->sun_family = AF_UNIX;
+      memcpy(un->sun_path, path.c_str(), path.size() + 1);
+      _len = static_cast<socklen_t>(
+        offsetof(struct sockaddr_un, sun_path) + path.size() + 1);
+      return true;
+      #endif
+    }
+
+    struct sockaddr_in *in =
+      reinterpret_cast<struct sockaddr_in *>(&_sockaddr);
+    #ifdef HAVE_SOCK_SIN_LEN
+      in->sin_len = sizeof(*in);
+    #endif
+    in->sin_port = htons(_port);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = inet_addr(_address.c_str());
+    _len = sizeof(*in);
+    return true;
+  }
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTTRACE_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTTRACE_HH_
+
+#include <string>
+#include <gazebo/util/system.hh>
+
+namespace gazebo
+{
+  /// \brief Opt-in timeline of the simulation loop in Chrome trace-event
+  /// JSON, viewable in chrome://tracing or Perfetto.
+  ///
+  /// Enabled for the whole process by setting ARDUPILOT_GAZEBO_TRACE to the
+  /// output file. Each thread appends begin/end events to its own
+  /// fixed-size ring, a background thread writes them out; events are
+  /// dropped rather than blocking when a ring is full. When disabled the
+  /// only cost is the Enabled() test.
+  ///
+  /// Built into the ArduPilotDiagnostics shared library so that every
+  /// plugin in the process writes to the same file.
+  class GAZEBO_VISIBLE ArduPilotTrace
+  {
+    /// \brief Whether tracing is on
+    /// \return True if ARDUPILOT_GAZEBO_TRACE was set and the file opened.
+    public: static inline bool Enabled()
+    {
+      return enabled;
+    }
+
+    /// \brief Keep a copy of a name for the lifetime of the process
+    /// \param[in] _name Vehicle or event name.
+    /// \return Pointer valid until the process exits.
+    public: static const char *Intern(const std::string &_name);
+
+    /// \brief Record the start of an event on the calling thread
+    /// \param[in] _name Event name, a string literal or Intern() result.
+    /// \param[in] _vehicle Vehicle name, from Intern().
+    /// \param[in] _simTime Sim time of the step, seconds.
+    /// \return False if the event was dropped, End() must then be skipped.
+    public: static bool Begin(const char *_name, const char *_vehicle,
+      const double _simTime);
+
+    /// \brief Record the end of the innermost event on the calling thread
+    /// \param[in] _name Event name given to Begin().
+    public: static void End(const char *_name);
+
+    /// \brief Write out every pending event now. Plugins call this on
+    /// unload so no event refers to a name in an unloaded library.
+    public: static void Flush();
+
+    /// \brief Set once when the library loads
+    private: static bool enabled;
+
+    friend class ArduPilotTraceWriter;
+  };
+
+  /// \brief Records a begin event on construction and the matching end
+  /// event on destruction, if tracing is enabled.
+  class ArduPilotTraceScope
+  {
+    /// \brief Constructor
+    /// \param[in] _name Event name, a string literal.
+    /// \param[in] _vehicle Vehicle name, from ArduPilotTrace::Intern().
+    /// \param[in] _simTime Sim time of the step, seconds.
+    public: ArduPilotTraceScope(const char *_name, const char *_vehicle,
+      const double _simTime)
+      : name(nullptr)
+    {
+      if (ArduPilotTrace::Enabled() &&
+          ArduPilotTrace::Begin(_name, _vehicle, _simTime))
+      {
+        this->name = _name;
+      }
+    }
+
+    /// \brief Destructor
+    public: ~ArduPilotTraceScope()
+    {
+      if (this->name)
+      {
+        ArduPilotTrace::End(this->name);
+      }
+    }
+
+    /// \brief Event name, nullptr when tracing is disabled or the begin
+    /// event was dropped
+    private: const char *name;
+  };
+}
+#endif
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTTRANSPORT_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTTRANSPORT_HH_
+
+#if defined(_MSC_VER)
+  #include <BaseTsd.h>
+  typedef SSIZE_T ssize_t;
+#else
+  #include <sys/types.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sdf/sdf.hh>
+#include "include/ArduPilotMailbox.hh"
+#include "include/ArduPilotRealtime.hh"
+#include "include/ArduPilotRoundTrip.hh"
+#include "include/ArduPilotSocketAddress.hh"
+
+#define MAX_MOTORS 255
+
+/// \brief Most ESC rpm values a state packet carries, indexed by servo
+/// channel
+#define MAX_ESCS 16
+
+/// \brief Number of servo packet slots drained in one batched receive
+#define SERVO_RING_SIZE 32
+
+/// \brief Largest state packet a transport has to carry
+#define FDM_PACKET_MAX_SIZE 2048
+
+struct ap_shm;
+
+namespace gazebo
+{
+  /// \brief A servo packet.
+  struct ServoPacket
+  {
+    /// \brief Motor speed data.
+    /// should rename to servo_command here and in ArduPilot SIM_Gazebo.cpp
+    float motorSpeed[MAX_MOTORS] = {0.0f};
+  };
+
+  /// \brief Flight Dynamics Model packet that is sent back to the ArduPilot
+  struct fdmPacket
+  {
+    /// \brief packet timestamp
+    double timestamp;
+
+    /// \brief IMU angular velocity
+    double imuAngularVelocityRPY[3];
+
+    /// \brief IMU linear acceleration
+    double imuLinearAccelerationXYZ[3];
+
+    /// \brief IMU quaternion orientation
+    double imuOrientationQuat[4];
+
+    /// \brief Model velocity in NED frame
+    double velocityXYZ[3];
+
+    /// \brief Model position in NED frame
+    double positionXYZ[3];
+  };
+
+  /// \brief Optional state appended to v2 state frames only, the legacy
+  /// fdmPacket layout is what ArduPilot's SIM_Gazebo expects and stays
+  /// untouched. A value is sent only when its ArduPilotFdmField bit is set
+  /// in fields, otherwise ArduPilot falls back to its own estimate.
+  struct fdmExtension
+  {
+    /// \brief ArduPilotFdmField bits of the values valid this step
+    uint32_t fields = 0;
+
+    /// \brief Model latitude in WGS84 system, degrees
+    double latitude = 0.0;
+
+    /// \brief Model longitude in WGS84 system, degrees
+    double longitude = 0.0;
+
+    /// \brief Model altitude above mean sea level, meters
+    double altitude = 0.0;
+
+    /// \brief Airspeed, e.g. from a Pitot tube, m/s
+    double airspeed = 0.0;
+
+    /// \brief Battery voltage
+    double batteryVoltage = 0.0;
+
+    /// \brief Battery current, amperes
+    double batteryCurrent = 0.0;
+
+    /// \brief Distance measured by a down-facing rangefinder, meters
+    double rangefinder = 0.0;
+
+    /// \brief Number of valid values in escRpm
+    uint32_t escCount = 0;
+
+    /// \brief Filtered rotor speed per servo channel, rpm, 0 for channels
+    /// that drive no rotor
+    double escRpm[MAX_ESCS] = {0.0};
+  };
+
+  /// \brief Datagram socket used by the socket transport, either UDP or
+  /// unix-domain depending on the address it is bound or connected to.
+  class ArduPilotSocketPrivate
+  {
+    /// \brief constructor
+    public: ArduPilotSocketPrivate();
+
+    /// \brief destructor
+    public: ~ArduPilotSocketPrivate();
+
+    /// \brief Bind to an adress and port
+    /// \param[in] _address IPv4 address or "unix:<path>" to bind to.
+    /// \param[in] _port Port to bind to, ignored for unix-domain paths.
+    /// \return True on success.
+    public: bool Bind(const std::string &_address, const uint16_t _port);
+
+    /// \brief Connect to an adress and port
+    /// \param[in] _address IPv4 address or "unix:<path>" to connect to.
+    /// \param[in] _port Port to connect to, ignored for unix-domain paths.
+    /// \return True on success.
+    public: bool Connect(const std::string &_address, const uint16_t _port);
+
+    /// \brief Send data
+    /// \param[in] _buf Data to send.
+    /// \param[in] _size Size of the data.
+    /// \return Bytes sent or -1 on error.
+    public: ssize_t Send(const void *_buf, size_t _size);
+
+    /// \brief Send data to a given address, from this socket's own address
+    /// \param[in] _buf Data to send.
+    /// \param[in] _size Size of the data.
+    /// \param[in] _addr Destination.
+    /// \param[in] _addrLen Length of _addr.
+    /// \return Bytes sent or -1 on error.
+    public: ssize_t SendTo(const void *_buf, size_t _size,
+      const struct sockaddr_storage &_addr, const socklen_t _addrLen);
+
+    /// \brief Receive data
+    /// \param[out] _buf Buffer that receives the data.
+    /// \param[in] _size Size of the buffer.
+    /// \param[in] _timeoutMS Milliseconds to wait for data.
+    public: ssize_t Recv(void *_buf, const size_t _size, uint32_t _timeoutMs);
+
+    /// \brief Wait until the socket has data to read
+    /// \param[in] _timeoutMs Milliseconds to wait for data.
+    /// \return True if data is pending.
+    public: bool WaitReadable(uint32_t _timeoutMs);
+
+    /// \brief Receive every pending datagram without blocking, one datagram
+    /// per slot, using a single recvmmsg() call where available.
+    /// \param[out] _slots Contiguous packet slots that receive the data.
+    /// \param[out] _sizes Received size of each datagram.
+    /// \param[in] _count Number of slots available.
+    /// \param[out] _stampsNs Optional kernel arrival time of each datagram,
+    /// CLOCK_REALTIME nanoseconds (SO_TIMESTAMPNS), or the read time where
+    /// the kernel provides none.
+    /// \param[out] _source Optional sender address of the last datagram.
+    /// \param[out] _sourceLen Length of _source, required with _source.
+    /// \return Number of datagrams received, 0 if nothing was pending.
+    public: unsigned RecvBatch(ServoPacket *_slots, ssize_t *_sizes,
+      const unsigned _count, int64_t *_stampsNs = nullptr,
+      struct sockaddr_storage *_source = nullptr,
+      socklen_t *_sourceLen = nullptr);
+
+    /// \brief Socket handle, for registering with a poller
+    /// \return File descriptor, -1 if not open.
+    public: int Fd() const;
+
+    /// \brief Create the socket for an address family
+    /// \param[in] _family AF_INET or AF_UNIX.
+    /// \return True on success.
+    private: bool Open(const int _family);
+
+    /// \brief Close the socket after a failed bind or connect
+    private: void Close();
+
+    /// \brief Socket handle
+    private: int fd;
+
+    /// \brief Peer address for unix-domain sockets. Those are not
+    /// connected so that ArduPilot may create its socket after gazebo.
+    private: struct sockaddr_storage peer;
+
+    /// \brief Length of peer, 0 if the socket is connected
+    private: socklen_t peerLen = 0;
+
+    /// \brief Unix-domain path bound by this socket, removed on close
+    private: std::string boundPath;
+  };
+
+  /// \brief Link carrying servo packets from ArduPilot and fdm packets
+  /// back to it. Selected with the <transport> element of the plugin.
+  class ArduPilotTransport
+  {
+    /// \brief Destructor
+    public: virtual ~ArduPilotTransport() = default;
+
+    /// \brief Create the transport named by the <transport> sdf element,
+    /// "udp" (default, datagram sockets, IPv4 or unix-domain) or "shm".
+    /// A udp transport with <sharedReactor> is served by the process-wide
+    /// ArduPilotReactor; otherwise <ioThread> wraps the transport in an
+    /// ArduPilotThreadedTransport.
+    /// \param[in] _sdf Plugin sdf element.
+    /// \return The transport, or nullptr if the type is unknown.
+    public: static std::unique_ptr<ArduPilotTransport> Create(
+      sdf::ElementPtr _sdf);
+
+    /// \brief Open the link using the plugin parameters
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _modelName Model name used to prefix messages.
+    /// \return True on success.
+    public: virtual bool Open(sdf::ElementPtr _sdf,
+      const std::string &_modelName) = 0;
+
+    /// \brief Wait up to _timeoutMs for servo packets, then consume
+    /// everything queued and keep only the newest packet.
+    /// \param[in] _timeoutMs Milliseconds to wait for the first packet.
+    /// \param[out] _size Size of the returned packet.
+    /// \return Newest packet, valid until the next call, or nullptr if
+    /// nothing arrived.
+    public: virtual const ServoPacket *ReceiveLatest(uint32_t _timeoutMs,
+      ssize_t &_size) = 0;
+
+    /// \brief Send a state packet to ArduPilot
+    /// \param[in] _buf Data to send.
+    /// \param[in] _size Size of the data.
+    /// \return Bytes sent or -1 on error.
+    public: virtual ssize_t Send(const void *_buf, size_t _size) = 0;
+
+    /// \brief Number of backed-up servo packets discarded in favour of a
+    /// newer one
+    public: virtual uint64_t DrainedPacketCount() const;
+
+    /// \brief State to servo packet round-trip distribution
+    /// \return Distribution, nullptr if the transport does not measure it.
+    public: virtual const ArduPilotRoundTrip *RoundTrip() const;
+
+    /// \brief Total number of backed-up servo packets discarded
+    protected: std::atomic<uint64_t> drainedPacketCount{0};
+  };
+
+  /// \brief Transport over a pair of datagram sockets: servo packets are
+  /// received on listen_addr:fdm_port_in, state is sent to
+  /// fdm_addr:fdm_port_out. Either address may be a "unix:<path>"
+  /// unix-domain socket, in which case its port is ignored.
+  ///
+  /// With <replyToSender> (the default for <protocol>json</protocol>, as
+  /// ArduPilot's JSON SITL sends from an ephemeral port and only accepts
+  /// replies from the port it sent to) state is instead sent from the
+  /// receive socket to wherever the newest servo packet came from, and
+  /// fdm_addr / fdm_port_out are unused.
+  class ArduPilotSocketTransport : public ArduPilotTransport
+  {
+    /// \brief Whether the plugin sdf asks for replies to the sender
+    /// \param[in] _sdf Plugin sdf element.
+    /// \return True with <replyToSender> or the json protocol.
+    public: static bool RepliesToSender(sdf::ElementPtr _sdf);
+
+    // Documentation Inherited.
+    public: bool Open(sdf::ElementPtr _sdf,
+      const std::string &_modelName) override;
+
+    /// \brief Bind and tune only the receive socket, for a transport that
+    /// sends the state from its own socket
+    /// \param[in] _sdf Plugin sdf element.
+    /// \param[in] _modelName Name used to prefix messages.
+    /// \return False if the socket cannot be bound.
+    public: bool OpenReceive(sdf::ElementPtr _sdf,
+      const std::string &_modelName);
+
+    /// \brief Host tuning read from the <realtime> block by OpenReceive()
+    /// \return Settings.
+    public: const ArduPilotRealtime &Realtime() const;
+
+    // Documentation Inherited.
+    public: const ServoPacket *ReceiveLatest(uint32_t _timeoutMs,
+      ssize_t &_size) override;
+
+    // Documentation Inherited.
+    public: ssize_t Send(const void *_buf, size_t _size) override;
+
+    /// \brief Consume everything queued on the receive socket without
+    /// waiting and keep only the newest packet.
+    /// \param[out] _size Size of the returned packet.
+    /// \return Newest packet, or nullptr if nothing was queued.
+    public: const ServoPacket *Drain(ssize_t &_size);
+
+    /// \brief Receive socket handle, for registering with a poller
+    /// \return File descriptor.
+    public: int ReceiveFd() const;
+
+    /// \brief Record that a state packet was sent now, for transports
+    /// that send on this transport's behalf
+    public: void Sent();
+
+    // Documentation Inherited.
+    public: const ArduPilotRoundTrip *RoundTrip() const override;
+
+    /// \brief Ardupilot Socket for receive motor command on gazebo
+    private: ArduPilotSocketPrivate socket_in;
+
+    /// \brief Ardupilot Socket to send state to Ardupilot
+    private: ArduPilotSocketPrivate socket_out;
+
+    /// \brief Send state to the sender of the newest servo packet
+    private: bool replyToSender = false;
+
+    /// \brief Host tuning of the sockets
+    private: ArduPilotRealtime realtime;
+
+    /// \brief Guards replyPeer, written on receive and read on send which
+    /// may be different threads with <ioThread>
+    private: std::mutex replyMutex;
+
+    /// \brief Sender of the newest servo packet
+    private: struct sockaddr_storage replyPeer;
+
+    /// \brief Length of replyPeer, 0 until a servo packet arrived
+    private: socklen_t replyPeerLen = 0;
+
+    /// \brief Preallocated ring of servo packet slots filled by batched
+    /// receives
+    private: ServoPacket servoRing[SERVO_RING_SIZE];
+
+    /// \brief Received size of each slot in servoRing
+    private: ssize_t servoRingSizes[SERVO_RING_SIZE];
+
+    /// \brief Kernel arrival time of each slot in servoRing
+    private: int64_t servoRingStamps[SERVO_RING_SIZE];
+
+    /// \brief Next servoRing slot to receive into
+    private: unsigned servoRingHead = 0;
+
+    /// \brief Round trips from state sent to servo packet arrival
+    private: ArduPilotRoundTrip roundTrip;
+  };
+
+  /// \brief Transport over a shared-memory ring pair (see shim/), for an
+  /// ArduPilot running on the same host. The segment is named by
+  /// <shm_name>, default "/ardupilot_gazebo_" followed by the model name.
+  class ArduPilotShmTransport : public ArduPilotTransport
+  {
+    /// \brief Destructor
+    public: ~ArduPilotShmTransport();
+
+    // Documentation Inherited.
+    public: bool Open(sdf::ElementPtr _sdf,
+      const std::string &_modelName) override;
+
+    // Documentation Inherited.
+    public: const ServoPacket *ReceiveLatest(uint32_t _timeoutMs,
+      ssize_t &_size) override;
+
+    // Documentation Inherited.
+    public: ssize_t Send(const void *_buf, size_t _size) override;
+
+    /// \brief Shared memory segment
+    private: struct ap_shm *shm = nullptr;
+
+    /// \brief Newest servo packet copied out of the segment
+    private: ServoPacket pkt;
+  };
+
+  /// \brief Runs another transport on dedicated I/O threads, enabled with
+  /// <ioThread>. A receiver thread owns the inner receive path and posts the
+  /// newest servo packet to a wait-free mailbox; the physics thread only
+  /// sleeps on an event when lockstep actually has to wait for it. State
+  /// packets are posted to a second mailbox and sent by a sender thread.
+  class ArduPilotThreadedTransport : public ArduPilotTransport
+  {
+    /// \brief Constructor
+    /// \param[in] _inner Transport to run on the I/O threads.
+    public: explicit ArduPilotThreadedTransport(
+      std::unique_ptr<ArduPilotTransport> _inner);
+
+    /// \brief Destructor, stops the I/O threads.
+    public: ~ArduPilotThreadedTransport();
+
+    // Documentation Inherited.
+    public: bool Open(sdf::ElementPtr _sdf,
+      const std::string &_modelName) override;
+
+    // Documentation Inherited.
+    public: const ServoPacket *ReceiveLatest(uint32_t _timeoutMs,
+      ssize_t &_size) override;
+
+    // Documentation Inherited.
+    public: ssize_t Send(const void *_buf, size_t _size) override;
+
+    /// \brief Packets drained by the inner transport plus packets the
+    /// receiver thread posted that were overwritten before being consumed
+    public: uint64_t DrainedPacketCount() const override;
+
+    // Documentation Inherited.
+    public: const ArduPilotRoundTrip *RoundTrip() const override;
+
+    /// \brief Receiver thread loop
+    private: void ReceiveLoop();
+
+    /// \brief Sender thread loop
+    private: void SendLoop();
+
+    /// \brief Servo packet handed from the receiver thread
+    private: struct ServoSlot
+    {
+      /// \brief Packet data
+      ServoPacket pkt;
+
+      /// \brief Received size
+      ssize_t size = -1;
+
+      /// \brief Number of packets the receiver thread has posted so far
+      uint64_t seq = 0;
+    };
+
+    /// \brief State packet handed to the sender thread
+    private: struct FdmSlot
+    {
+      /// \brief Packet data
+      unsigned char data[FDM_PACKET_MAX_SIZE];
+
+      /// \brief Packet size
+      size_t size = 0;
+    };
+
+    /// \brief Transport run on the I/O threads
+    private: std::unique_ptr<ArduPilotTransport> inner;
+
+    /// \brief Newest servo packet
+    private: ArduPilotMailbox<ServoSlot> servoBox;
+
+    /// \brief Newest state packet
+    private: ArduPilotMailbox<FdmSlot> fdmBox;
+
+    /// \brief Set while the physics thread sleeps on servoEvent
+    private: std::atomic<bool> physicsWaiting{false};
+
+    /// \brief Wakes the physics thread
+    private: ArduPilotEvent servoEvent;
+
+    /// \brief Wakes the sender thread
+    private: ArduPilotEvent fdmEvent;
+
+    /// \brief Sequence number of the last servo packet consumed
+    private: uint64_t lastSeq = 0;
+
+    /// \brief Cleared to stop the I/O threads
+    private: std::atomic<bool> running{false};
+
+    /// \brief Receiver thread
+    private: std::thread receiver;
+
+    /// \brief Sender thread
+    private: std::thread sender;
+
+    /// \brief Cpu pinning and scheduling of the I/O threads
+    private: ArduPilotRealtime realtime;
+  };
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef GAZEBO_PLUGINS_ARDUPILOTVEHICLESTATE_HH_
+#define GAZEBO_PLUGINS_ARDUPILOTVEHICLESTATE_HH_
+
+#include <cstdint>
+
+namespace gazebo
+{
+  /// \brief ESC channels in ArduPilotVehicleState, MAX_ESCS of the wire
+  /// formats
+  static const unsigned kMaxEscs = 16;
+
+  /// \brief Vehicle state of one physics step, gathered from gazebo in a
+  /// single pass and read by SendState and any other consumer instead of
+  /// querying the model again. One contiguous block aligned to a cache
+  /// line, fields in fdmPacket order first.
+  struct alignas(64) ArduPilotVehicleState
+  {
+    /// \brief Sim time of the step, seconds
+    double timestamp = 0.0;
+
+    /// \brief IMU angular velocity, body frame, rad/s
+    double imuAngularVelocity[3] = {0.0, 0.0, 0.0};
+
+    /// \brief IMU specific force, body frame, m/s^2
+    double imuLinearAcceleration[3] = {0.0, 0.0, 0.0};
+
+    /// \brief Rotation from the NED frame to the body frame, w x y z
+    double orientation[4] = {1.0, 0.0, 0.0, 0.0};
+
+    /// \brief Base link velocity, NED frame, m/s
+    double velocityNED[3] = {0.0, 0.0, 0.0};
+
+    /// \brief Body position, NED frame, m
+    double positionNED[3] = {0.0, 0.0, 0.0};
+
+    /// \brief Base link velocity, gazebo world frame, m/s
+    double velocityWorld[3] = {0.0, 0.0, 0.0};
+
+    /// \brief Mechanical power drawn by all rotors and joints, W
+    double motorPower = 0.0;
+
+    /// \brief Number of valid escRpm values
+    unsigned int escCount = 0;
+
+    /// \brief Low-passed rotor speed at each ESC servo channel, rpm
+    double escRpm[kMaxEscs] = {0.0};
+  };
+}
+#endif
@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "ardupilot_shm.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define AP_SHM_MAGIC 0x41505348u /* "APSH" */
+#define AP_SHM_VERSION 1u
+
+/* One direction of the link. head is also the futex word. */
+struct ap_shm_ring {
+    _Atomic uint32_t head;
+    _Atomic uint32_t waiting;
+    char pad0[56];
+    _Atomic uint32_t tail;
+    char pad1[60];
+    uint32_t sizes[AP_SHM_SLOT_COUNT];
+    unsigned char slots[AP_SHM_SLOT_COUNT][AP_SHM_SLOT_SIZE];
+};
+
+struct ap_shm_segment {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    char pad[48];
+    /* autopilot -> simulator */
+    struct ap_shm_ring servo;
+    /* simulator -> autopilot */
+    struct ap_shm_ring fdm;
+};
+
+struct ap_shm {
+    struct ap_shm_segment *seg;
+    struct ap_shm_ring *tx;
+    struct ap_shm_ring *rx;
+    enum ap_shm_role role;
+    char name[NAME_MAX];
+};
+
+static int futex_wait (_Atomic uint32_t *addr, uint32_t val,
+                       const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static int futex_wake (_Atomic uint32_t *addr) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+ap_shm_t *ap_shm_open (const char *name, enum ap_shm_role role) {
+    if (strlen(name) >= NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    int flags = O_RDWR;
+    if (role == AP_SHM_SIMULATOR)
+        flags |= O_CREAT;
+    int fd = shm_open(name, flags, 0600);
+    if (fd < 0)
+        return NULL;
+
+    const size_t len = sizeof(struct ap_shm_segment);
+    if (role == AP_SHM_SIMULATOR && ftruncate(fd, len) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < len) {
+        close(fd);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    struct ap_shm_segment *seg =
+        mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+        return NULL;
+
+    if (role == AP_SHM_SIMULATOR) {
+        // start from empty rings, the previous peer (if any) is gone
+        atomic_store(&seg->magic, 0);
+        memset(&seg->servo, 0, sizeof(seg->servo));
+        memset(&seg->fdm, 0, sizeof(seg->fdm));
+        seg->version = AP_SHM_VERSION;
+        seg->slot_size = AP_SHM_SLOT_SIZE;
+        seg->slot_count = AP_SHM_SLOT_COUNT;
+        atomic_store_explicit(&seg->magic, AP_SHM_MAGIC, memory_order_release);
+    }
+    else if (atomic_load_explicit(&seg->magic, memory_order_acquire)
+                 != AP_SHM_MAGIC ||
+             seg->version != AP_SHM_VERSION ||
+             seg->slot_size != AP_SHM_SLOT_SIZE ||
+             seg->slot_count != AP_SHM_SLOT_COUNT) {
+        // simulator not up yet, or built with a different layout
+        munmap(seg, len);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    struct ap_shm *shm = calloc(1, sizeof(*shm));
+    if (!shm) {
+        munmap(seg, len);
+        return NULL;
+    }
+    shm->seg = seg;
+    shm->role = role;
+    strcpy(shm->name, name);
+    if (role == AP_SHM_SIMULATOR) {
+        shm->tx = &seg->fdm;
+        shm->rx = &seg->servo;
+    }
+    else {
+        shm->tx = &seg->servo;
+        shm->rx = &seg->fdm;
+    }
+    return shm;
+}
+
+void ap_shm_close (ap_shm_t *shm) {
+    if (!shm)
+        return;
+    munmap(shm->seg, sizeof(struct ap_shm_segment));
+    if (shm->role == AP_SHM_SIMULATOR)
+        shm_unlink(shm->name);
+    free(shm);
+}
+
+int ap_shm_send (ap_shm_t *shm, const void *buf, size_t size) {
+    struct ap_shm_ring *ring = shm->tx;
+    if (size > AP_SHM_SLOT_SIZE)
+        return -1;
+
+    const uint32_t head =
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const uint32_t tail =
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= AP_SHM_SLOT_COUNT)
+        return -1;
+
+    const uint32_t slot = head % AP_SHM_SLOT_COUNT;
+    memcpy(ring->slots[slot], buf, size);
+    ring->sizes[slot] = (uint32_t)size;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_seq_cst);
+
+    // only pay for the syscall when the consumer is actually asleep
+    if (atomic_load_explicit(&ring->waiting, memory_order_seq_cst))
+        futex_wake(&ring->head);
+    return 0;
+}
+
+ssize_t ap_shm_recv_latest (ap_shm_t *shm, void *buf, size_t size,
+                            uint32_t timeout_ms, unsigned *drained) {
+    struct ap_shm_ring *ring = shm->rx;
+    const uint32_t tail =
+        atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail && timeout_ms > 0) {
+        struct timespec deadline, now, rel;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        atomic_store_explicit(&ring->waiting, 1, memory_order_seq_cst);
+        while ((head = atomic_load_explicit(&ring->head,
+                                            memory_order_seq_cst)) == tail) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            rel.tv_sec = deadline.tv_sec - now.tv_sec;
+            rel.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (rel.tv_nsec < 0) {
+                rel.tv_sec--;
+                rel.tv_nsec += 1000000000L;
+            }
+            if (rel.tv_sec < 0)
+                break;
+            if (futex_wait(&ring->head, tail, &rel) < 0 &&
+                errno == ETIMEDOUT)
+                break;
+        }
+        atomic_store_explicit(&ring->waiting, 0, memory_order_relaxed);
+    }
+
+    if (head == tail)
+        return -1;
+
+    // the producer never overwrites the slot at head - 1 until tail moves
+    // past it, so it is safe to copy before releasing the ring
+    const uint32_t slot = (head - 1) % AP_SHM_SLOT_COUNT;
+    size_t len = ring->sizes[slot];
+    if (len > size)
+        len = size;
+    memcpy(buf, ring->slots[slot], len);
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+
+    if (drained)
+        *drained = head - tail - 1;
+    return (ssize_t)len;
+}
+
+#define AP_SNAPSHOT_MAGIC 0x4150534eu /* "APSN" */
+
+struct ap_snapshot_segment {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    char pad0[52];
+    /* odd while the writer is copying, packets written * 2 otherwise */
+    _Atomic uint32_t seq;
+    uint32_t size;
+    char pad1[56];
+    unsigned char data[AP_SHM_SLOT_SIZE];
+};
+
+struct ap_snapshot {
+    struct ap_snapshot_segment *seg;
+    int writer;
+    char name[NAME_MAX];
+};
+
+ap_snapshot_t *ap_snapshot_open (const char *name, int writer) {
+    if (strlen(name) >= NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    int fd = shm_open(name, writer ? O_RDWR | O_CREAT : O_RDWR, 0600);
+    if (fd < 0)
+        return NULL;
+
+    const size_t len = sizeof(struct ap_snapshot_segment);
+    if (writer && ftruncate(fd, len) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < len) {
+        close(fd);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    struct ap_snapshot_segment *seg =
+        mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+        return NULL;
+
+    if (writer) {
+        atomic_store(&seg->magic, 0);
+        atomic_store(&seg->seq, 0);
+        seg->size = 0;
+        seg->version = AP_SHM_VERSION;
+        seg->slot_size = AP_SHM_SLOT_SIZE;
+        atomic_store_explicit(&seg->magic, AP_SNAPSHOT_MAGIC,
+                              memory_order_release);
+    }
+    else if (atomic_load_explicit(&seg->magic, memory_order_acquire)
+                 != AP_SNAPSHOT_MAGIC ||
+             seg->version != AP_SHM_VERSION ||
+             seg->slot_size != AP_SHM_SLOT_SIZE) {
+        munmap(seg, len);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    struct ap_snapshot *snap = calloc(1, sizeof(*snap));
+    if (!snap) {
+        munmap(seg, len);
+        return NULL;
+    }
+    snap->seg = seg;
+    snap->writer = writer;
+    strcpy(snap->name, name);
+    return snap;
+}
+
+void ap_snapshot_close (ap_snapshot_t *snap) {
+    if (!snap)
+        return;
+    munmap(snap->seg, sizeof(struct ap_snapshot_segment));
+    if (snap->writer)
+        shm_unlink(snap->name);
+    free(snap);
+}
+
+int ap_snapshot_write (ap_snapshot_t *snap, const void *buf, size_t size) {
+    struct ap_snapshot_segment *seg = snap->seg;
+    if (size > AP_SHM_SLOT_SIZE)
+        return -1;
+
+    const uint32_t seq = atomic_load_explicit(&seg->seq, memory_order_relaxed);
+    atomic_store_explicit(&seg->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(seg->data, buf, size);
+    seg->size = (uint32_t)size;
+    atomic_store_explicit(&seg->seq, seq + 2, memory_order_release);
+    return 0;
+}
+
+ssize_t ap_snapshot_read (ap_snapshot_t *snap, void *buf, size_t size,
+                          uint32_t *seq) {
+    struct ap_snapshot_segment *seg = snap->seg;
+    uint32_t before, after = 0;
+    size_t len;
+    do {
+        before = atomic_load_explicit(&seg->seq, memory_order_acquire);
+        if (before == 0)
+            return -1;
+        if (before & 1u)
+            continue;
+        len = seg->size;
+        if (len > size)
+            len = size;
+        if (len > AP_SHM_SLOT_SIZE)
+            len = AP_SHM_SLOT_SIZE;
+        memcpy(buf, seg->data, len);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&seg->seq, memory_order_relaxed);
+    } while ((before & 1u) || before != after);
+
+    if (seq)
+        *seq = before / 2;
+    return (ssize_t)len;
+}
+
+#else
+
+ap_shm_t *ap_shm_open (const char *name, enum ap_shm_role role) {
+    (void)name;
+    (void)role;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void ap_shm_close (ap_shm_t *shm) {
+    (void)shm;
+}
+
+int ap_shm_send (ap_shm_t *shm, const void *buf, size_t size) {
+    (void)shm;
+    (void)buf;
+    (void)size;
+    return -1;
+}
+
+ssize_t ap_shm_recv_latest (ap_shm_t *shm, void *buf, size_t size,
+                            uint32_t timeout_ms, unsigned *drained) {
+    (void)shm;
+    (void)buf;
+    (void)size;
+    (void)timeout_ms;
+    (void)drained;
+    return -1;
+}
+
+ap_snapshot_t *ap_snapshot_open (const char *name, int writer) {
+    (void)name;
+    (void)writer;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void ap_snapshot_close (ap_snapshot_t *snap) {
+    (void)snap;
+}
+
+int ap_snapshot_write (ap_snapshot_t *snap, const void *buf, size_t size) {
+    (void)snap;
+    (void)buf;
+    (void)size;
+    return -1;
+}
+
+ssize_t ap_snapshot_read (ap_snapshot_t *snap, void *buf, size_t size,
+                          uint32_t *seq) {
+    (void)snap;
+    (void)buf;
+    (void)size;
+    (void)seq;
+    return -1;
+}
+
+#endif
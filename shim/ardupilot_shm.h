@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef ARDUPILOT_SHM_H_
+#define ARDUPILOT_SHM_H_
+
+/*
+ * Shared-memory lockstep link between the Gazebo ArduPilotPlugin and a
+ * local autopilot process. The segment holds two single-producer /
+ * single-consumer rings: servo packets flow from the autopilot to the
+ * simulator, fdm packets flow back. A consumer waiting on an empty ring
+ * sleeps on a futex and is woken by the producer only when it is actually
+ * waiting.
+ *
+ * Linux only; ap_shm_open() returns NULL elsewhere.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum payload carried by one ring slot, in bytes. */
+#define AP_SHM_SLOT_SIZE 2048
+
+/* Number of slots in each direction. */
+#define AP_SHM_SLOT_COUNT 16
+
+enum ap_shm_role {
+    /* Gazebo side: creates the segment, sends fdm, receives servo. */
+    AP_SHM_SIMULATOR,
+    /* Autopilot side: attaches to the segment, sends servo, receives fdm. */
+    AP_SHM_AUTOPILOT,
+};
+
+typedef struct ap_shm ap_shm_t;
+
+/* Create (simulator) or attach to (autopilot) the segment called name,
+ * e.g. "/ardupilot_iris". Returns NULL on failure with errno set. */
+ap_shm_t *ap_shm_open(const char *name, enum ap_shm_role role);
+
+/* Unmap the segment. The simulator also unlinks it. */
+void ap_shm_close(ap_shm_t *shm);
+
+/* Publish one packet in this side's outgoing direction and wake the peer
+ * if it is waiting. Returns 0, or -1 if the packet is too large or the
+ * ring is full (the packet is dropped, like a full socket buffer). */
+int ap_shm_send(ap_shm_t *shm, const void *buf, size_t size);
+
+/* Wait up to timeout_ms for incoming packets, then consume everything
+ * queued and copy only the newest one into buf. If drained is not NULL it
+ * receives the number of older packets skipped. Returns the size of the
+ * packet copied, or -1 if nothing arrived before the timeout. */
+ssize_t ap_shm_recv_latest(ap_shm_t *shm, void *buf, size_t size,
+                           uint32_t timeout_ms, unsigned *drained);
+
+/*
+ * Latest-value snapshot of the fdm stream for read-only consumers such as
+ * loggers or visualisers. The simulator overwrites a single slot under a
+ * sequence lock; any number of readers copy it out and retry if it changed
+ * meanwhile, so readers never slow the simulator down and never see a
+ * torn packet. Nothing flows back to the simulator.
+ */
+
+typedef struct ap_snapshot ap_snapshot_t;
+
+/* Create (writer != 0) or attach to the snapshot segment called name.
+ * Returns NULL on failure with errno set. */
+ap_snapshot_t *ap_snapshot_open(const char *name, int writer);
+
+/* Unmap the segment. The writer also unlinks it. */
+void ap_snapshot_close(ap_snapshot_t *snap);
+
+/* Replace the snapshot. Returns 0, or -1 if the packet is too large. */
+int ap_snapshot_write(ap_snapshot_t *snap, const void *buf, size_t size);
+
+/* Copy the current snapshot into buf. If seq is not NULL it receives the
+ * number of packets written so far, so a poller can tell a new packet from
+ * the one it already has. Returns the size of the packet copied, or -1 if
+ * nothing was written yet. */
+ssize_t ap_snapshot_read(ap_snapshot_t *snap, void *buf, size_t size,
+                         uint32_t *seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ardupilot_shm.h"
+
+// Minimal SITL stand-in for the shared-memory transport: answers every
+// fdm packet from gazebo with a constant servo packet and reports the
+// achieved lockstep rate once per second.
+
+#define MAX_MOTORS 255
+
+struct ServoPacket {
+    float motorSpeed[MAX_MOTORS];
+};
+
+struct fdmPacket {
+    double timestamp;
+    double imuAngularVelocityRPY[3];
+    double imuLinearAccelerationXYZ[3];
+    double imuOrientationQuat[4];
+    double velocityXYZ[3];
+    double positionXYZ[3];
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void sigint_handler (int signum) {
+    (void)signum;
+    running = 0;
+}
+
+static double now_s () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main (int argc, char *argv[]) {
+    const char *name = "/ardupilot_gazebo";
+    int channels = 4;
+    float throttle = 0.5f;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i < argc - 1)
+            name = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i < argc - 1)
+            channels = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i < argc - 1)
+            throttle = strtof(argv[++i], NULL);
+        else {
+            printf("sitl_standin\n");
+            printf("    -n: shared memory name (default %s)\n", name);
+            printf("    -c: number of servo channels (default %d)\n", channels);
+            printf("    -t: constant servo command (default %.2f)\n", throttle);
+            return -1;
+        }
+    }
+    if (channels < 1 || channels > MAX_MOTORS) {
+        fprintf(stderr, "[ERROR] channel count must be in [1, %d]\n",
+                MAX_MOTORS);
+        return -1;
+    }
+
+    signal(SIGINT, sigint_handler);
+
+    ap_shm_t *shm;
+    while (!(shm = ap_shm_open(name, AP_SHM_AUTOPILOT))) {
+        if (errno != ENOENT && errno != EAGAIN) {
+            perror("failed to open shared memory");
+            return -1;
+        }
+        if (!running)
+            return 0;
+        usleep(100000);
+    }
+    printf("attached to %s\n", name);
+
+    struct ServoPacket servo = {0};
+    for (int i = 0; i < channels; i++)
+        servo.motorSpeed[i] = throttle;
+
+    struct fdmPacket fdm;
+    unsigned long frames = 0, drained_total = 0;
+    double last_report = now_s();
+
+    // kick off lockstep, gazebo waits for servo before sending state
+    ap_shm_send(shm, &servo, sizeof(float) * channels);
+
+    while (running) {
+        unsigned drained = 0;
+        if (ap_shm_recv_latest(shm, &fdm, sizeof(fdm), 1000, &drained) < 0) {
+            // gazebo paused or restarted, poke it again
+            ap_shm_send(shm, &servo, sizeof(float) * channels);
+            continue;
+        }
+        drained_total += drained;
+        ap_shm_send(shm, &servo, sizeof(float) * channels);
+        frames++;
+
+        const double t = now_s();
+        if (t - last_report >= 1.0) {
+            printf("sim time %10.3f  %8.0f Hz  drained %lu\n",
+                   fdm.timestamp, frames / (t - last_report), drained_total);
+            fflush(stdout);
+            frames = 0;
+            last_report = t;
+        }
+    }
+
+    ap_shm_close(shm);
+    return 0;
+}
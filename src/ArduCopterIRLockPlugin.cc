@@ -15,6 +15,8 @@
  *
 */
 
+#include <cerrno>
+#include <cstring>
 #include <memory>
 #include <functional>
 
@@ -29,6 +31,7 @@
   #include <netinet/in.h>
   #include <netinet/tcp.h>
   #include <arpa/inet.h>
+  #include <unistd.h>
   using raw_type = void;
 #endif
 
@@ -48,6 +51,10 @@
 #include <include/SelectionBuffer.hh>
 
 #include "include/ArduCopterIRLockPlugin.hh"
+#include "include/ArduPilotLog.hh"
+#include "include/ArduPilotRealtime.hh"
+#include "include/ArduPilotSocketAddress.hh"
+#include "include/ArduPilotTrace.hh"
 
 using namespace gazebo;
 GZ_REGISTER_SENSOR_PLUGIN(ArduCopterIRLockPlugin)
@@ -68,13 +75,22 @@ namespace gazebo
     /// \brief A list of fiducials tracked by this camera.
     public: std::vector<std::string> fiducials;
 
-    /// \brief Irlock address
+    /// \brief Irlock address, IPv4 or unix:<path>
     public: std::string irlock_addr;
 
     /// \brief Irlock port for receiver socket
     public: uint16_t irlock_port;
 
-    public: int handle;
+    /// \brief Irlock destination, resolved once from irlock_addr
+    public: struct sockaddr_storage irlock_sockaddr;
+
+    /// \brief Length of irlock_sockaddr
+    public: socklen_t irlock_sockaddr_len = 0;
+
+    public: int handle = -1;
+
+    /// \brief Parent link name as tagged on trace events
+    public: const char *traceVehicle = "";
 
     public: struct irlockPacket
             {
@@ -109,26 +125,6 @@ ArduCopterIRLockPlugin::ArduCopterIRLockPlugin()
     : SensorPlugin(),
       dataPtr(new ArduCopterIRLockPluginPrivate)
 {
-  // socket
-  this->dataPtr->handle = socket(AF_INET, SOCK_DGRAM /*SOCK_STREAM*/, 0);
-  #ifndef _WIN32
-  // Windows does not support FD_CLOEXEC
-  fcntl(this->dataPtr->handle, F_SETFD, FD_CLOEXEC);
-  #endif
-  int one = 1;
-  setsockopt(this->dataPtr->handle, IPPROTO_TCP, TCP_NODELAY,
-      reinterpret_cast<const char *>(&one), sizeof(one));
-  setsockopt(this->dataPtr->handle, SOL_SOCKET, SO_REUSEADDR,
-      reinterpret_cast<const char *>(&one), sizeof(one));
-
-  #ifdef _WIN32
-  u_long on = 1;
-  ioctlsocket(this->dataPtr->handle, FIONBIO,
-      reinterpret_cast<u_long FAR *>(&on));
-  #else
-  fcntl(this->dataPtr->handle, F_SETFL,
-      fcntl(this->dataPtr->handle, F_GETFL, 0) | O_NONBLOCK);
-  #endif
 }
 
 /////////////////////////////////////////////////
@@ -136,6 +132,16 @@ ArduCopterIRLockPlugin::~ArduCopterIRLockPlugin()
 {
   this->dataPtr->connections.clear();
   this->dataPtr->parentSensor.reset();
+  ArduPilotTrace::Flush();
+  ArduPilotLog::Flush();
+  if (this->dataPtr->handle != -1)
+  {
+    #ifdef _WIN32
+    closesocket(this->dataPtr->handle);
+    #else
+    close(this->dataPtr->handle);
+    #endif
+  }
 }
 
 /////////////////////////////////////////////////
@@ -172,6 +178,48 @@ void ArduCopterIRLockPlugin::Load(sensors::SensorPtr _sensor,
   this->dataPtr->irlock_port =
           _sdf->Get("irlock_port", 9005).first;
 
+  if (!MakeSocketAddress(this->dataPtr->irlock_addr,
+      this->dataPtr->irlock_port, this->dataPtr->irlock_sockaddr,
+      this->dataPtr->irlock_sockaddr_len))
+  {
+    gzerr << "Invalid irlock_addr [" << this->dataPtr->irlock_addr
+          << "]. ArduCopterIRLockPlugin will not be run." << std::endl;
+    return;
+  }
+
+  // socket, udp or unix-domain datagram depending on irlock_addr
+  this->dataPtr->handle = socket(
+      this->dataPtr->irlock_sockaddr.ss_family, SOCK_DGRAM, 0);
+  if (this->dataPtr->handle == -1)
+  {
+    gzerr << "Failed to create irlock socket: " << strerror(errno)
+          << ". ArduCopterIRLockPlugin will not be run." << std::endl;
+    return;
+  }
+  #ifndef _WIN32
+  // Windows does not support FD_CLOEXEC
+  fcntl(this->dataPtr->handle, F_SETFD, FD_CLOEXEC);
+  #endif
+  int one = 1;
+  setsockopt(this->dataPtr->handle, SOL_SOCKET, SO_REUSEADDR,
+      reinterpret_cast<const char *>(&one), sizeof(one));
+
+  #ifdef _WIN32
+  u_long on = 1;
+  ioctlsocket(this->dataPtr->handle, FIONBIO,
+      reinterpret_cast<u_long FAR *>(&on));
+  #else
+  fcntl(this->dataPtr->handle, F_SETFL,
+      fcntl(this->dataPtr->handle, F_GETFL, 0) | O_NONBLOCK);
+  #endif
+
+  ArduPilotRealtime realtime;
+  realtime.Load(_sdf, this->dataPtr->parentSensor->ParentName());
+  realtime.ApplyToSocket(this->dataPtr->handle, "irlock socket");
+
+  this->dataPtr->traceVehicle =
+    ArduPilotTrace::Intern(this->dataPtr->parentSensor->ParentName());
+
   this->dataPtr->parentSensor->SetActive(true);
 
   this->dataPtr->connections.push_back(
@@ -186,6 +234,10 @@ void ArduCopterIRLockPlugin::OnNewFrame(const unsigned char * /*_image*/,
     unsigned int /*_width*/, unsigned int /*_height*/, unsigned int /*_depth*/,
     const std::string &/*_format*/)
 {
+  ArduPilotTraceScope trace("ArduCopterIRLockPlugin::OnNewFrame",
+    this->dataPtr->traceVehicle,
+    this->dataPtr->parentSensor->LastMeasurementTime().Double());
+
   rendering::CameraPtr camera = this->dataPtr->parentSensor->Camera();
   rendering::ScenePtr scene = camera->GetScene();
 
@@ -226,7 +278,7 @@ void ArduCopterIRLockPlugin::OnNewFrame(const unsigned char * /*_image*/,
       }
       catch(Ogre::Exception &e)
       {
-        gzerr << "Ogre Error:" << e.getFullDescription() << "\n";
+        aperr(1000) << "Ogre Error:" << e.getFullDescription() << "\n";
         continue;
       }
     }
@@ -242,6 +294,10 @@ void ArduCopterIRLockPlugin::OnNewFrame(const unsigned char * /*_image*/,
 void ArduCopterIRLockPlugin::Publish(const std::string &/*_fiducial*/,
     unsigned int _x, unsigned int _y)
 {
+  ArduPilotTraceScope trace("ArduCopterIRLockPlugin::Publish",
+    this->dataPtr->traceVehicle,
+    this->dataPtr->parentSensor->LastMeasurementTime().Double());
+
   rendering::CameraPtr camera = this->dataPtr->parentSensor->Camera();
 
   const double imageWidth = this->dataPtr->parentSensor->ImageWidth();
@@ -270,13 +326,9 @@ void ArduCopterIRLockPlugin::Publish(const std::string &/*_fiducial*/,
   // std::cerr << "fiducial '" << _fiducial << "':" << _x << ", " << _y
   //     << ", pos: " << pkt.pos_x << ", " << pkt.pos_y << std::endl;
 
-  struct sockaddr_in sockaddr;
-  memset(&sockaddr, 0, sizeof(sockaddr));
-  sockaddr.sin_port = htons(this->dataPtr->irlock_port);
-  sockaddr.sin_family = AF_INET;
-  sockaddr.sin_addr.s_addr = inet_addr(this->dataPtr->irlock_addr.c_str());
   ::sendto(this->dataPtr->handle,
            reinterpret_cast<raw_type *>(&pkt),
            sizeof(pkt), 0,
-           (struct sockaddr *)&sockaddr, sizeof(sockaddr));
+           (struct sockaddr *)&this->dataPtr->irlock_sockaddr,
+           this->dataPtr->irlock_sockaddr_len);
 }
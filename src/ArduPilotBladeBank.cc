@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include "include/ArduPilotBladeBank.hh"
+
+using namespace gazebo;
+
+/// \brief Slowest blade airspeed LiftDragPlugin computes forces for, m/s
+static const double kMinBladeSpeed = 0.01;
+
+/// \brief Vectors shorter than this are left alone by
+/// ignition::math::Vector3::Normalize
+static const double kNormalizeEpsilon = 1e-6;
+
+/// \brief Normalize a vector in place as ignition::math::Vector3 does,
+/// leaving near-zero vectors alone
+static inline void Normalize(double &_x, double &_y, double &_z)
+{
+  const double length = std::sqrt(_x * _x + _y * _y + _z * _z);
+  if (length > kNormalizeEpsilon)
+  {
+    _x /= length;
+    _y /= length;
+    _z /= length;
+  }
+}
+
+/// \brief Zero a non-finite value, as ignition::math::Vector3::Correct
+static inline double Correct(const double _v)
+{
+  return std::isfinite(_v) ? _v : 0.0;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotBladeLink::Set(const ignition::math::Quaterniond &_rot,
+  const ignition::math::Vector3d &_cogVel,
+  const ignition::math::Vector3d &_angVel)
+{
+  const double w = _rot.W();
+  const double x = _rot.X();
+  const double y = _rot.Y();
+  const double z = _rot.Z();
+  this->rot[0] = 1.0 - 2.0 * (y * y + z * z);
+  this->rot[1] = 2.0 * (x * y - w * z);
+  this->rot[2] = 2.0 * (x * z + w * y);
+  this->rot[3] = 2.0 * (x * y + w * z);
+  this->rot[4] = 1.0 - 2.0 * (x * x + z * z);
+  this->rot[5] = 2.0 * (y * z - w * x);
+  this->rot[6] = 2.0 * (x * z - w * y);
+  this->rot[7] = 2.0 * (y * z + w * x);
+  this->rot[8] = 1.0 - 2.0 * (x * x + y * y);
+  for (unsigned int k = 0; k < 3; ++k)
+  {
+    this->vel[k] = _cogVel[k];
+    this->angVel[k] = _angVel[k];
+    this->force[k] = 0.0;
+    this->torque[k] = 0.0;
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotBladeBank::Add(const ArduPilotBlade &_blade,
+  const ignition::math::Vector3d &_cog, const unsigned int _link)
+{
+  const ignition::math::Vector3d cpArm = _blade.cp - _cog;
+  ignition::math::Vector3d forwardDir = _blade.forward;
+  forwardDir.Normalize();
+  ignition::math::Vector3d upwardDir = _blade.upward;
+  upwardDir.Normalize();
+
+  this->link.push_back(_link);
+  for (unsigned int k = 0; k < 3; ++k)
+  {
+    this->cp[k].push_back(cpArm[k]);
+    this->forward[k].push_back(forwardDir[k]);
+    this->upward[k].push_back(upwardDir[k]);
+    this->arm[k].push_back(0.0);
+    this->vel[k].push_back(0.0);
+    this->forwardI[k].push_back(0.0);
+    this->upwardI[k].push_back(0.0);
+    this->force[k].push_back(0.0);
+  }
+  this->radial.push_back(_blade.radialSymmetry);
+  this->alpha0.push_back(_blade.a0);
+  this->alphaStall.push_back(_blade.alphaStall);
+  this->cla.push_back(_blade.cla);
+  this->claStall.push_back(_blade.claStall);
+  this->cda.push_back(_blade.cda);
+  this->cdaStall.push_back(_blade.cdaStall);
+  this->halfRhoArea.push_back(0.5 * _blade.airDensity * _blade.area);
+  ++this->size;
+}
+
+/////////////////////////////////////////////////
+size_t ArduPilotBladeBank::Size() const
+{
+  return this->size;
+}
+
+/////////////////////////////////////////////////
+ignition::math::Vector3d ArduPilotBladeBank::Force(const size_t _blade)
+  const
+{
+  return ignition::math::Vector3d(this->force[0][_blade],
+    this->force[1][_blade], this->force[2][_blade]);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotBladeBank::Update(ArduPilotBladeLink *_links)
+{
+  // blade geometry to the world frame, velocity of each center of
+  // pressure from its link's motion
+  for (size_t i = 0; i < this->size; ++i)
+  {
+    const ArduPilotBladeLink &l = _links[this->link[i]];
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+      const double *r = l.rot + 3 * k;
+      this->arm[k][i] = r[0] * this->cp[0][i] + r[1] * this->cp[1][i] +
+        r[2] * this->cp[2][i];
+      this->forwardI[k][i] = r[0] * this->forward[0][i] +
+        r[1] * this->forward[1][i] + r[2] * this->forward[2][i];
+      this->upwardI[k][i] = r[0] * this->upward[0][i] +
+        r[1] * this->upward[1][i] + r[2] * this->upward[2][i];
+    }
+    this->vel[0][i] = l.vel[0] +
+      l.angVel[1] * this->arm[2][i] - l.angVel[2] * this->arm[1][i];
+    this->vel[1][i] = l.vel[1] +
+      l.angVel[2] * this->arm[0][i] - l.angVel[0] * this->arm[2][i];
+    this->vel[2][i] = l.vel[2] +
+      l.angVel[0] * this->arm[1][i] - l.angVel[1] * this->arm[0][i];
+  }
+
+  this->ComputeForces();
+
+  // sum blade forces and their moments about each link center of gravity
+  for (size_t i = 0; i < this->size; ++i)
+  {
+    ArduPilotBladeLink &l = _links[this->link[i]];
+    const double fx = this->force[0][i];
+    const double fy = this->force[1][i];
+    const double fz = this->force[2][i];
+    l.force[0] += fx;
+    l.force[1] += fy;
+    l.force[2] += fz;
+    l.torque[0] += this->arm[1][i] * fz - this->arm[2][i] * fy;
+    l.torque[1] += this->arm[2][i] * fx - this->arm[0][i] * fz;
+    l.torque[2] += this->arm[0][i] * fy - this->arm[1][i] * fx;
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotBladeBank::ComputeForces()
+{
+  for (size_t i = 0; i < this->size; ++i)
+  {
+    const double velX = this->vel[0][i];
+    const double velY = this->vel[1][i];
+    const double velZ = this->vel[2][i];
+    const double speed = std::sqrt(velX * velX + velY * velY + velZ * velZ);
+    if (speed <= kMinBladeSpeed)
+    {
+      this->force[0][i] = this->force[1][i] = this->force[2][i] = 0.0;
+      continue;
+    }
+    const double velIX = velX / speed;
+    const double velIY = velY / speed;
+    const double velIZ = velZ / speed;
+    const double fwdX = this->forwardI[0][i];
+    const double fwdY = this->forwardI[1][i];
+    const double fwdZ = this->forwardI[2][i];
+
+    double upX = this->upwardI[0][i];
+    double upY = this->upwardI[1][i];
+    double upZ = this->upwardI[2][i];
+    if (this->radial[i])
+    {
+      // inflow component perpendicular to forward
+      const double tmpX = fwdY * velIZ - fwdZ * velIY;
+      const double tmpY = fwdZ * velIX - fwdX * velIZ;
+      const double tmpZ = fwdX * velIY - fwdY * velIX;
+      upX = fwdY * tmpZ - fwdZ * tmpY;
+      upY = fwdZ * tmpX - fwdX * tmpZ;
+      upZ = fwdX * tmpY - fwdY * tmpX;
+      Normalize(upX, upY, upZ);
+    }
+
+    // normal to the lift-drag plane
+    double spanX = fwdY * upZ - fwdZ * upY;
+    double spanY = fwdZ * upX - fwdX * upZ;
+    double spanZ = fwdX * upY - fwdY * upX;
+    Normalize(spanX, spanY, spanZ);
+
+    const double sinSweep = ignition::math::clamp(
+      spanX * velIX + spanY * velIY + spanZ * velIZ, -1.0, 1.0);
+    // LiftDragPlugin's sweep correction, cos^2 of the sweep angle
+    const double cosSweep = 1.0 - sinSweep * sinSweep;
+
+    // velocity less its spanwise part, removed along the inflow as
+    // LiftDragPlugin does
+    const double spanVel = velX * spanX + velY * spanY + velZ * spanZ;
+    const double ldX = velX - spanVel * velIX;
+    const double ldY = velY - spanVel * velIY;
+    const double ldZ = velZ - spanVel * velIZ;
+
+    double dragX = -ldX;
+    double dragY = -ldY;
+    double dragZ = -ldZ;
+    Normalize(dragX, dragY, dragZ);
+
+    double liftX = spanY * ldZ - spanZ * ldY;
+    double liftY = spanZ * ldX - spanX * ldZ;
+    double liftZ = spanX * ldY - spanY * ldX;
+    Normalize(liftX, liftY, liftZ);
+
+    const double cosAlpha = ignition::math::clamp(
+      liftX * upX + liftY * upY + liftZ * upZ, -1.0, 1.0);
+    double alpha = liftX * fwdX + liftY * fwdY + liftZ * fwdZ >= 0.0 ?
+      this->alpha0[i] + std::acos(cosAlpha) :
+      this->alpha0[i] - std::acos(cosAlpha);
+    while (std::fabs(alpha) > 0.5 * IGN_PI)
+    {
+      alpha = alpha > 0 ? alpha - IGN_PI : alpha + IGN_PI;
+    }
+
+    const double q = this->halfRhoArea[i] * (ldX * ldX + ldY * ldY + ldZ * ldZ);
+    const double stall = this->alphaStall[i];
+    double cl;
+    double cd;
+    if (alpha > stall)
+    {
+      cl = std::max(0.0, (this->cla[i] * stall +
+        this->claStall[i] * (alpha - stall)) * cosSweep);
+      cd = (this->cda[i] * stall +
+        this->cdaStall[i] * (alpha - stall)) * cosSweep;
+    }
+    else if (alpha < -stall)
+    {
+      cl = std::min(0.0, (-this->cla[i] * stall +
+        this->claStall[i] * (alpha + stall)) * cosSweep);
+      cd = (-this->cda[i] * stall +
+        this->cdaStall[i] * (alpha + stall)) * cosSweep;
+    }
+    else
+    {
+      cl = this->cla[i] * alpha * cosSweep;
+      cd = this->cda[i] * alpha * cosSweep;
+    }
+    const double liftScale = cl * q;
+    const double dragScale = std::fabs(cd) * q;
+
+    this->force[0][i] = Correct(liftScale * liftX + dragScale * dragX);
+    this->force[1][i] = Correct(liftScale * liftY + dragScale * dragY);
+    this->force[2][i] = Correct(liftScale * liftZ + dragScale * dragZ);
+  }
+}
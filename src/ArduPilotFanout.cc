@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef _WIN32
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <gazebo/common/common.hh>
+#include "shim/ardupilot_shm.h"
+#include "include/ArduPilotFanout.hh"
+#include "include/ArduPilotLog.hh"
+
+using namespace gazebo;
+
+/// \brief Most destinations handed to one sendmmsg() call
+#define FANOUT_BATCH 16u
+
+/////////////////////////////////////////////////
+ArduPilotFanout::~ArduPilotFanout()
+{
+  #ifndef _WIN32
+  for (const int fd : {this->inet.fd, this->local.fd})
+  {
+    if (fd != -1)
+    {
+      close(fd);
+    }
+  }
+  #endif
+  for (struct ap_snapshot *snapshot : this->snapshots)
+  {
+    ap_snapshot_close(snapshot);
+  }
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotFanout::Load(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  this->modelName = _modelName;
+  if (!_sdf->HasElement("fdmMirror"))
+  {
+    return true;
+  }
+
+  #ifdef _WIN32
+  gzerr << "[" << _modelName << "] "
+        << "<fdmMirror> is not supported on this platform, aborting plugin.\n";
+  return false;
+  #else
+  for (sdf::ElementPtr mirrorSDF = _sdf->GetElement("fdmMirror"); mirrorSDF;
+       mirrorSDF = mirrorSDF->GetNextElement("fdmMirror"))
+  {
+    const std::string addr =
+      mirrorSDF->Get("addr", static_cast<std::string>("")).first;
+
+    if (addr.compare(0, sizeof(kSnapshotPrefix) - 1, kSnapshotPrefix) == 0)
+    {
+      const std::string name = addr.substr(sizeof(kSnapshotPrefix) - 1);
+      struct ap_snapshot *snapshot = ap_snapshot_open(name.c_str(), 1);
+      if (!snapshot)
+      {
+        gzerr << "[" << _modelName << "] "
+              << "failed to create fdm snapshot [" << name << "]: "
+              << strerror(errno) << ", aborting plugin.\n";
+        return false;
+      }
+      this->snapshots.push_back(snapshot);
+      gzmsg << "[" << _modelName << "] "
+            << "mirroring state to snapshot [" << name << "].\n";
+      continue;
+    }
+
+    const int family = SocketAddressFamily(addr);
+    const uint16_t port = mirrorSDF->Get("port", static_cast<uint32_t>(0)).first;
+    struct sockaddr_storage sockaddr;
+    socklen_t len = 0;
+    if (addr.empty() || (family == AF_INET && port == 0) ||
+        !MakeSocketAddress(addr, port, sockaddr, len) ||
+        (family == AF_INET &&
+         reinterpret_cast<struct sockaddr_in *>(&sockaddr)->sin_addr.s_addr
+           == INADDR_NONE))
+    {
+      gzerr << "[" << _modelName << "] "
+            << "invalid <fdmMirror> [" << addr << ":" << port
+            << "], aborting plugin.\n";
+      return false;
+    }
+
+    Group &group = family == AF_INET ? this->inet : this->local;
+    if (!OpenGroup(group, family))
+    {
+      gzerr << "[" << _modelName << "] "
+            << "failed to create <fdmMirror> socket: " << strerror(errno)
+            << ", aborting plugin.\n";
+      return false;
+    }
+
+    const bool multicast = family == AF_INET && IN_MULTICAST(ntohl(
+      reinterpret_cast<struct sockaddr_in *>(&sockaddr)->sin_addr.s_addr));
+    if (multicast)
+    {
+      // one ttl for the whole socket, the last multicast mirror wins
+      const int ttl = mirrorSDF->Get("ttl", 1).first;
+      const int loop = 1;
+      if (setsockopt(group.fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+            sizeof(ttl)) != 0 ||
+          setsockopt(group.fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+            sizeof(loop)) != 0)
+      {
+        gzwarn << "[" << _modelName << "] "
+               << "failed to configure multicast for <fdmMirror> ["
+               << addr << "]: " << strerror(errno) << ".\n";
+      }
+    }
+
+    group.addrs.push_back(sockaddr);
+    group.addrLens.push_back(len);
+    gzmsg << "[" << _modelName << "] "
+          << "mirroring state to " << (multicast ? "multicast group " : "")
+          << "[" << addr;
+    if (family == AF_INET)
+    {
+      gzmsg << ":" << port;
+    }
+    gzmsg << "].\n";
+  }
+  return true;
+  #endif
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotFanout::OpenGroup(Group &_group, const int _family)
+{
+  #ifdef _WIN32
+  (void)_group;
+  (void)_family;
+  return false;
+  #else
+  if (_group.fd == -1)
+  {
+    _group.fd = socket(_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  }
+  return _group.fd != -1;
+  #endif
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotFanout::Empty() const
+{
+  return this->inet.addrs.empty() && this->local.addrs.empty() &&
+    this->snapshots.empty();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotFanout::Send(const void *_buf, size_t _size)
+{
+  this->SendGroup(this->inet, _buf, _size);
+  this->SendGroup(this->local, _buf, _size);
+
+  for (struct ap_snapshot *snapshot : this->snapshots)
+  {
+    if (ap_snapshot_write(snapshot, _buf, _size) != 0)
+    {
+      ++this->droppedCount;
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotFanout::SendGroup(Group &_group, const void *_buf,
+  size_t _size)
+{
+  #ifdef __linux__
+  // every destination shares the one iovec over the encoded packet
+  struct iovec iov;
+  iov.iov_base = const_cast<void *>(_buf);
+  iov.iov_len = _size;
+
+  struct mmsghdr msgs[FANOUT_BATCH];
+  const unsigned total = static_cast<unsigned>(_group.addrs.size());
+  unsigned sent = 0;
+  while (sent < total)
+  {
+    const unsigned count = std::min(total - sent, FANOUT_BATCH);
+    for (unsigned i = 0; i < count; ++i)
+    {
+      memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_name = &_group.addrs[sent + i];
+      msgs[i].msg_hdr.msg_namelen = _group.addrLens[sent + i];
+      msgs[i].msg_hdr.msg_iov = &iov;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const int n = sendmmsg(_group.fd, msgs, count, MSG_DONTWAIT);
+    if (n <= 0)
+    {
+      // skip the destination that failed, a consumer that went away must
+      // not starve the ones after it
+      apwarn(1000) << "[" << this->modelName << "] "
+                   << "<fdmMirror> send failed: " << strerror(errno) << "\n";
+      ++this->droppedCount;
+      ++sent;
+      continue;
+    }
+    sent += n;
+  }
+  #elif !defined(_WIN32)
+  for (size_t i = 0; i < _group.addrs.size(); ++i)
+  {
+    if (sendto(_group.fd, _buf, _size, MSG_DONTWAIT,
+          reinterpret_cast<const struct sockaddr *>(&_group.addrs[i]),
+          _group.addrLens[i]) < 0)
+    {
+      ++this->droppedCount;
+    }
+  }
+  #else
+  (void)_group;
+  (void)_buf;
+  (void)_size;
+  #endif
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotFanout::DroppedCount() const
+{
+  return this->droppedCount;
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotFdmExtensions.hh"
+#include "include/ArduPilotProtocol.hh"
+
+using namespace gazebo;
+
+/// \brief WGS84 equatorial radius, meters
+static const double kEarthRadius = 6378137.0;
+
+/// \brief Cosine of the largest tilt the geometric rangefinder reports at
+static const double kRangefinderMinCosTilt = 0.5;
+
+/// \brief Find a sensor of the model by name, trying every scoped name
+/// matching it before the unscoped name
+/// \param[in] _model Model the sensor belongs to.
+/// \param[in] _name Sensor name from the sdf.
+/// \return The sensor, null if there is no such sensor of type T.
+template <typename T>
+static std::shared_ptr<T> FindSensor(physics::ModelPtr _model,
+  const std::string &_name)
+{
+  sensors::SensorManager *manager = sensors::SensorManager::Instance();
+  for (const std::string &scopedName : _model->SensorScopedName(_name))
+  {
+    std::shared_ptr<T> sensor =
+      std::dynamic_pointer_cast<T>(manager->GetSensor(scopedName));
+    if (sensor)
+    {
+      return sensor;
+    }
+  }
+  return std::dynamic_pointer_cast<T>(manager->GetSensor(_name));
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotFdmExtensions::Load(sdf::ElementPtr _sdf,
+  physics::ModelPtr _model, const uint32_t _supported)
+{
+  this->model = _model;
+  this->modelName = _model->GetName();
+
+  const std::string gpsName =
+    _sdf->Get("gpsName", static_cast<std::string>("")).first;
+  const std::string rangefinderName =
+    _sdf->Get("rangefinderName", static_cast<std::string>("")).first;
+
+  if (_sdf->Get("fdmGps", false).first || !gpsName.empty())
+  {
+    this->fields |= FDM_GPS;
+  }
+  if (_sdf->Get("fdmAirspeed", false).first)
+  {
+    this->fields |= FDM_AIRSPEED;
+  }
+  if (_sdf->Get("fdmBattery", false).first)
+  {
+    this->fields |= FDM_BATTERY;
+  }
+  if (_sdf->Get("fdmRangefinder", false).first || !rangefinderName.empty())
+  {
+    this->fields |= FDM_RANGEFINDER;
+  }
+  if (_sdf->Get("fdmEscRpm", false).first)
+  {
+    this->fields |= FDM_ESC_RPM;
+  }
+
+  if (this->fields & ~_supported)
+  {
+    gzwarn << "[" << this->modelName << "] "
+           << "gps fields need <protocol>v2</protocol>, airspeed, battery, "
+           << "rangefinder and esc rpm fields v2 or json, ignoring the "
+           << "others.\n";
+    this->fields &= _supported;
+  }
+  if (!this->fields)
+  {
+    return true;
+  }
+
+  if (!gpsName.empty() && (this->fields & FDM_GPS))
+  {
+    this->gpsSensor = FindSensor<sensors::GpsSensor>(_model, gpsName);
+    if (!this->gpsSensor)
+    {
+      gzerr << "[" << this->modelName << "] "
+            << "gps sensor [" << gpsName
+            << "] not found, abort ArduPilot plugin.\n";
+      return false;
+    }
+  }
+  else if (this->fields & FDM_GPS)
+  {
+    const ignition::math::Vector3d home = _model->GetWorld()->
+      SphericalCoords()->SphericalFromLocalPosition(
+        ignition::math::Vector3d::Zero);
+    this->homeLatitude = home.X();
+    this->homeLongitude = home.Y();
+    this->homeAltitude = home.Z();
+    this->latitudePerMeter = 180.0 / (M_PI * kEarthRadius);
+    this->longitudePerMeter = this->latitudePerMeter /
+      std::max(std::cos(this->homeLatitude * M_PI / 180.0), 1e-6);
+  }
+
+  if (!rangefinderName.empty() && (this->fields & FDM_RANGEFINDER))
+  {
+    this->rangefinderSensor =
+      FindSensor<sensors::RaySensor>(_model, rangefinderName);
+    if (!this->rangefinderSensor)
+    {
+      gzerr << "[" << this->modelName << "] "
+            << "rangefinder sensor [" << rangefinderName
+            << "] not found, abort ArduPilot plugin.\n";
+      return false;
+    }
+  }
+  this->rangefinderMaxRange =
+    _sdf->Get("rangefinderMaxRange", this->rangefinderMaxRange).first;
+
+  this->batteryVoltage =
+    _sdf->Get("batteryVoltage", this->batteryVoltage).first;
+  this->batteryEmptyVoltage =
+    _sdf->Get("batteryEmptyVoltage", this->batteryEmptyVoltage).first;
+  this->batteryCapacityAh = std::max(1e-3,
+    _sdf->Get("batteryCapacityAh", this->batteryCapacityAh).first);
+  this->batteryResistance =
+    _sdf->Get("batteryResistance", this->batteryResistance).first;
+  this->batteryEfficiency = std::max(1e-3,
+    _sdf->Get("batteryEfficiency", this->batteryEfficiency).first);
+  return true;
+}
+
+/////////////////////////////////////////////////
+uint32_t ArduPilotFdmExtensions::Fields() const
+{
+  return this->fields;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotFdmExtensions::NeedsMotorPower() const
+{
+  return (this->fields & FDM_BATTERY) != 0;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotFdmExtensions::NeedsEscRpm() const
+{
+  return (this->fields & FDM_ESC_RPM) != 0;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotFdmExtensions::Fill(const fdmPacket &_pkt,
+  const ignition::math::Vector3d &_velWorld, const double _motorPowerW,
+  const double *_escRpm, const unsigned _escCount, fdmExtension &_ext)
+{
+  _ext.fields = 0;
+
+  if (this->fields & FDM_GPS)
+  {
+    if (this->gpsSensor)
+    {
+      _ext.latitude = this->gpsSensor->Latitude().Degree();
+      _ext.longitude = this->gpsSensor->Longitude().Degree();
+      _ext.altitude = this->gpsSensor->Altitude();
+    }
+    else
+    {
+      _ext.latitude = this->homeLatitude +
+        _pkt.positionXYZ[0] * this->latitudePerMeter;
+      _ext.longitude = this->homeLongitude +
+        _pkt.positionXYZ[1] * this->longitudePerMeter;
+      _ext.altitude = this->homeAltitude - _pkt.positionXYZ[2];
+    }
+    _ext.fields |= FDM_GPS;
+  }
+
+  if (this->fields & FDM_AIRSPEED)
+  {
+    const physics::LinkPtr link = this->model->GetLink();
+    const ignition::math::Vector3d wind =
+      this->model->GetWorld()->Wind().WorldLinearVel(link.get());
+    _ext.airspeed = (_velWorld - wind).Length();
+    _ext.fields |= FDM_AIRSPEED;
+  }
+
+  if (this->fields & FDM_BATTERY)
+  {
+    const double soc = ignition::math::clamp(
+      1.0 - this->batteryDrawnAh / this->batteryCapacityAh, 0.0, 1.0);
+    const double openCircuit = this->batteryEmptyVoltage +
+      soc * (this->batteryVoltage - this->batteryEmptyVoltage);
+    const double current = openCircuit > 0.0 ?
+      _motorPowerW / (this->batteryEfficiency * openCircuit) : 0.0;
+
+    if (this->batteryLastTime >= 0.0 &&
+        _pkt.timestamp > this->batteryLastTime)
+    {
+      this->batteryDrawnAh +=
+        current * (_pkt.timestamp - this->batteryLastTime) / 3600.0;
+    }
+    this->batteryLastTime = _pkt.timestamp;
+
+    _ext.batteryVoltage = std::max(openCircuit -
+      current * this->batteryResistance, 0.0);
+    _ext.batteryCurrent = current;
+    _ext.fields |= FDM_BATTERY;
+  }
+
+  if (this->fields & FDM_RANGEFINDER)
+  {
+    if (this->rangefinderSensor)
+    {
+      // out of range readings are inf, which ArduPilot cannot take
+      const double range = this->rangefinderSensor->Range(0);
+      if (std::isfinite(range))
+      {
+        _ext.rangefinder = range;
+        _ext.fields |= FDM_RANGEFINDER;
+      }
+    }
+    else
+    {
+      // body z (down) axis in NED is the last column of the rotation
+      // matrix of imuOrientationQuat, its down component is cos(tilt)
+      const double x = _pkt.imuOrientationQuat[1];
+      const double y = _pkt.imuOrientationQuat[2];
+      const double cosTilt = 1.0 - 2.0 * (x * x + y * y);
+      const double height = -_pkt.positionXYZ[2];
+      if (cosTilt >= kRangefinderMinCosTilt && height >= 0.0)
+      {
+        const double range = height / cosTilt;
+        if (range <= this->rangefinderMaxRange)
+        {
+          _ext.rangefinder = range;
+          _ext.fields |= FDM_RANGEFINDER;
+        }
+      }
+    }
+  }
+
+  if ((this->fields & FDM_ESC_RPM) && _escCount > 0)
+  {
+    _ext.escCount = std::min<unsigned>(_escCount, MAX_ESCS);
+    std::copy(_escRpm, _escRpm + _ext.escCount, _ext.escRpm);
+    _ext.fields |= FDM_ESC_RPM;
+  }
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include <ignition/math/Helpers.hh>
+#include "include/ArduPilotFilterBank.hh"
+
+// build with -DARDUPILOT_FILTER_SCALAR to always use the scalar kernel
+#if defined(__x86_64__) && defined(__GNUC__) && \
+  !defined(ARDUPILOT_FILTER_SCALAR)
+#include <immintrin.h>
+#define ARDUPILOT_FILTER_X86 1
+#endif
+
+using namespace gazebo;
+
+const size_t ArduPilotFilterBank::kLanes;
+
+/// \brief Filter kernel, lanes [0, _count), _count a multiple of kLanes
+typedef void (*FilterKernel)(const double *_a0, const double *_b1,
+  const double *_x, double *_y, const size_t _count);
+
+#ifndef ARDUPILOT_FILTER_X86
+/// \brief One lane at a time, as OnePole::Process
+static void ProcessScalar(const double *_a0, const double *_b1,
+  const double *_x, double *_y, const size_t _count)
+{
+  for (size_t i = 0; i < _count; ++i)
+  {
+    _y[i] = _a0[i] * _x[i] + _b1[i] * _y[i];
+  }
+}
+#else
+/// \brief Two lanes per instruction, x86-64 always has SSE2
+static void ProcessSse2(const double *_a0, const double *_b1,
+  const double *_x, double *_y, const size_t _count)
+{
+  for (size_t i = 0; i < _count; i += 2)
+  {
+    const __m128d in = _mm_mul_pd(_mm_loadu_pd(_a0 + i), _mm_loadu_pd(_x + i));
+    const __m128d fb = _mm_mul_pd(_mm_loadu_pd(_b1 + i), _mm_loadu_pd(_y + i));
+    _mm_storeu_pd(_y + i, _mm_add_pd(in, fb));
+  }
+}
+
+/// \brief Four lanes per instruction, only called when the cpu has AVX2
+__attribute__((target("avx2")))
+static void ProcessAvx2(const double *_a0, const double *_b1,
+  const double *_x, double *_y, const size_t _count)
+{
+  for (size_t i = 0; i < _count; i += 4)
+  {
+    const __m256d in =
+      _mm256_mul_pd(_mm256_loadu_pd(_a0 + i), _mm256_loadu_pd(_x + i));
+    const __m256d fb =
+      _mm256_mul_pd(_mm256_loadu_pd(_b1 + i), _mm256_loadu_pd(_y + i));
+    _mm256_storeu_pd(_y + i, _mm256_add_pd(in, fb));
+  }
+}
+#endif
+
+/// \brief Fastest kernel the cpu runs
+/// \param[out] _name Name of the kernel.
+/// \return Kernel.
+static FilterKernel SelectKernel(const char *&_name)
+{
+#ifdef ARDUPILOT_FILTER_X86
+  if (__builtin_cpu_supports("avx2"))
+  {
+    _name = "avx2";
+    return ProcessAvx2;
+  }
+  _name = "sse2";
+  return ProcessSse2;
+#else
+  _name = "scalar";
+  return ProcessScalar;
+#endif
+}
+
+/// \brief Kernel chosen when the library is loaded
+static const char *kernelName = nullptr;
+static const FilterKernel kernel = SelectKernel(kernelName);
+
+/////////////////////////////////////////////////
+size_t ArduPilotFilterBank::Add(const double _fc, const double _fs)
+{
+  const size_t lane = this->size++;
+  const size_t padded = (this->size + kLanes - 1) / kLanes * kLanes;
+
+  // padding lanes pass nothing and hold zero
+  this->a0.resize(padded, 0.0);
+  this->b1.resize(padded, 0.0);
+  this->inputs.resize(padded, 0.0);
+  this->outputs.resize(padded, 0.0);
+
+  // as ignition::math::OnePole::Fc
+  this->b1[lane] = std::exp(-2.0 * IGN_PI * _fc / _fs);
+  this->a0[lane] = 1.0 - this->b1[lane];
+  return lane;
+}
+
+/////////////////////////////////////////////////
+size_t ArduPilotFilterBank::Size() const
+{
+  return this->size;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotFilterBank::Set(const double _value)
+{
+  std::fill(this->outputs.begin(), this->outputs.begin() + this->size,
+    _value);
+}
+
+/////////////////////////////////////////////////
+double *ArduPilotFilterBank::Inputs()
+{
+  return this->inputs.data();
+}
+
+/////////////////////////////////////////////////
+const double *ArduPilotFilterBank::Process()
+{
+  kernel(this->a0.data(), this->b1.data(), this->inputs.data(),
+    this->outputs.data(), this->outputs.size());
+  return this->outputs.data();
+}
+
+/////////////////////////////////////////////////
+const double *ArduPilotFilterBank::Outputs() const
+{
+  return this->outputs.data();
+}
+
+/////////////////////////////////////////////////
+const char *ArduPilotFilterBank::Isa()
+{
+  return kernelName;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include "include/ArduPilotHistogram.hh"
+
+using namespace gazebo;
+
+const unsigned ArduPilotHistogram::kSubBucketBits;
+const unsigned ArduPilotHistogram::kSubBuckets;
+const unsigned ArduPilotHistogram::kMaxMagnitude;
+const unsigned ArduPilotHistogram::kBucketCount;
+
+/// \brief Index of the highest set bit
+/// \param[in] _v Non-zero value.
+/// \return floor(log2(_v)).
+static inline unsigned Log2(const uint64_t _v)
+{
+#if defined(__GNUC__)
+  return 63u - static_cast<unsigned>(__builtin_clzll(_v));
+#else
+  unsigned log = 0;
+  for (uint64_t v = _v; v >>= 1; ++log)
+  {
+  }
+  return log;
+#endif
+}
+
+/////////////////////////////////////////////////
+unsigned ArduPilotHistogram::Bucket(const uint64_t _ns)
+{
+  if (_ns < kSubBuckets)
+  {
+    return static_cast<unsigned>(_ns);
+  }
+  const unsigned magnitude = std::min(Log2(_ns), kMaxMagnitude);
+  const unsigned shift = magnitude - kSubBucketBits;
+  const unsigned sub = static_cast<unsigned>(
+    std::min<uint64_t>(_ns >> shift, 2 * kSubBuckets - 1)) - kSubBuckets;
+  return (shift + 1) * kSubBuckets + sub;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotHistogram::LowestValue(const unsigned _bucket)
+{
+  if (_bucket < kSubBuckets)
+  {
+    return _bucket;
+  }
+  const unsigned shift = _bucket / kSubBuckets - 1;
+  const uint64_t sub = _bucket % kSubBuckets;
+  return (kSubBuckets + sub) << shift;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotHistogram::Record(const uint64_t _ns)
+{
+  ++this->counts[Bucket(_ns)];
+  ++this->count;
+  this->max = std::max(this->max, _ns);
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotHistogram::Count() const
+{
+  return this->count;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotHistogram::Max() const
+{
+  return this->max;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotHistogram::Percentile(const double _percentile) const
+{
+  if (this->count == 0)
+  {
+    return 0;
+  }
+
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(
+    std::ceil(this->count * std::min(_percentile, 100.0) / 100.0)));
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < kBucketCount; ++i)
+  {
+    seen += this->counts[i];
+    if (seen >= rank)
+    {
+      const uint64_t low = LowestValue(i);
+      const uint64_t width = LowestValue(i + 1) - low;
+      return std::min(low + width / 2, this->max);
+    }
+  }
+  return this->max;
+}
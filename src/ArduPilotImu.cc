@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <ignition/math/Rand.hh>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotImu.hh"
+
+using namespace gazebo;
+
+/// \brief Add white noise to every axis of a vector
+/// \param[in] _value Noise-free value.
+/// \param[in] _stdDev Noise standard deviation, no noise if not positive.
+/// \return Noisy value.
+static ignition::math::Vector3d AddNoise(const ignition::math::Vector3d &_value,
+  const double _stdDev)
+{
+  if (_stdDev <= 0.0)
+  {
+    return _value;
+  }
+  return _value + ignition::math::Vector3d(
+    ignition::math::Rand::DblNormal(0.0, _stdDev),
+    ignition::math::Rand::DblNormal(0.0, _stdDev),
+    ignition::math::Rand::DblNormal(0.0, _stdDev));
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotImu::Load(sdf::ElementPtr _sdf, physics::ModelPtr _model,
+  const ignition::math::Quaterniond &_bodyRotation)
+{
+  const std::string modelName = _model->GetName();
+  const std::string linkName =
+    _sdf->Get("imuLinkName", static_cast<std::string>("canonical")).first;
+  this->link = _model->GetLink(linkName);
+  if (!this->link)
+  {
+    gzerr << "[" << modelName << "] "
+          << "imuLinkName [" << linkName << "] not found.\n";
+    return false;
+  }
+
+  const ignition::math::Pose3d pose = LoadPose(_sdf, _bodyRotation);
+  this->rotation = pose.Rot();
+  this->position = pose.Pos();
+  this->gravity = _model->GetWorld()->Gravity();
+
+  this->gyroBias =
+    _sdf->Get("imuGyroBias", ignition::math::Vector3d::Zero).first;
+  this->accelBias =
+    _sdf->Get("imuAccelBias", ignition::math::Vector3d::Zero).first;
+  this->gyroNoise = _sdf->Get("imuGyroNoise", 0.0).first;
+  this->accelNoise = _sdf->Get("imuAccelNoise", 0.0).first;
+
+  this->Reset();
+
+  gzmsg << "[" << modelName << "] "
+        << "synthetic imu on link [" << this->link->GetName() << "]\n";
+  return true;
+}
+
+/////////////////////////////////////////////////
+ignition::math::Pose3d ArduPilotImu::LoadPose(sdf::ElementPtr _sdf,
+  const ignition::math::Quaterniond &_bodyRotation)
+{
+  // the state sent assumes an x forward, y right, z down IMU, which the
+  // model's own frame rarely is
+  return _sdf->Get("imuPose", ignition::math::Pose3d(
+    ignition::math::Vector3d::Zero, _bodyRotation)).first;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotImu::Reset()
+{
+  this->lastValid = false;
+  this->angularVel = ignition::math::Vector3d::Zero;
+  this->linearAccel = ignition::math::Vector3d::Zero;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotImu::Update(const double _dt)
+{
+  if (_dt <= 0.0)
+  {
+    return;
+  }
+
+  const ignition::math::Quaterniond imuRot =
+    this->link->WorldPose().Rot() * this->rotation;
+  const ignition::math::Vector3d worldLinearVel =
+    this->link->WorldLinearVel(this->position);
+  const ignition::math::Vector3d worldAngularVel =
+    this->link->WorldAngularVel();
+
+  // no previous step to difference against: read as unaccelerated
+  if (!this->lastValid)
+  {
+    this->lastLinearVel = worldLinearVel;
+    this->lastAngularVel = worldAngularVel;
+  }
+
+  ignition::math::Vector3d imuAngularVel;
+  ignition::math::Vector3d imuLinearAccel;
+  Difference(this->lastLinearVel, this->lastAngularVel, worldLinearVel,
+    worldAngularVel, imuRot, this->gravity, _dt, imuAngularVel,
+    imuLinearAccel);
+
+  this->angularVel = AddNoise(imuAngularVel + this->gyroBias,
+    this->gyroNoise);
+  this->linearAccel = AddNoise(imuLinearAccel + this->accelBias,
+    this->accelNoise);
+
+  this->lastLinearVel = worldLinearVel;
+  this->lastAngularVel = worldAngularVel;
+  this->lastValid = true;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotImu::Measure(ignition::math::Vector3d &_angularVel,
+  ignition::math::Vector3d &_linearAccel) const
+{
+  _angularVel = this->angularVel;
+  _linearAccel = this->linearAccel;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotImu::Difference(
+  const ignition::math::Vector3d &_lastLinearVel,
+  const ignition::math::Vector3d &_lastAngularVel,
+  const ignition::math::Vector3d &_linearVel,
+  const ignition::math::Vector3d &_angularVel,
+  const ignition::math::Quaterniond &_imuRot,
+  const ignition::math::Vector3d &_gravity, const double _dt,
+  ignition::math::Vector3d &_imuAngularVel,
+  ignition::math::Vector3d &_imuLinearAccel)
+{
+  // the IMU point velocity already carries the tangential and centripetal
+  // terms of the lever arm, so no angular acceleration is needed
+  const ignition::math::Vector3d accel = (_linearVel - _lastLinearVel) / _dt;
+  _imuAngularVel =
+    _imuRot.RotateVectorReverse((_lastAngularVel + _angularVel) * 0.5);
+  _imuLinearAccel = _imuRot.RotateVectorReverse(accel - _gravity);
+}
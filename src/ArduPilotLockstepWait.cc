@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "include/ArduPilotLockstepWait.hh"
+
+using namespace gazebo;
+
+/// \brief Hint to the cpu that we are busy-waiting
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLockstepWait::Load(sdf::ElementPtr _sdf)
+{
+  if (!_sdf->HasElement("lockstepWait"))
+  {
+    return;
+  }
+  sdf::ElementPtr waitSDF = _sdf->GetElement("lockstepWait");
+
+  this->spin = std::chrono::microseconds(
+    waitSDF->Get("spinUs", static_cast<uint32_t>(0)).first);
+  this->yield = std::chrono::microseconds(
+    waitSDF->Get("yieldUs", static_cast<uint32_t>(0)).first);
+  this->timeoutMs = waitSDF->Get("timeoutMs", this->timeoutMs).first;
+  this->missSleepNs = waitSDF->Get("missSleepNs", this->missSleepNs).first;
+  this->adaptiveSpin =
+    waitSDF->Get("adaptiveSpin", this->adaptiveSpin).first;
+}
+
+/////////////////////////////////////////////////
+uint32_t ArduPilotLockstepWait::MissSleepNs() const
+{
+  return this->missSleepNs;
+}
+
+/////////////////////////////////////////////////
+ArduPilotLockstepWait::Clock::time_point ArduPilotLockstepWait::SpinDeadline(
+  const Clock::time_point &_start) const
+{
+  if (!this->adaptiveSpin || !this->haveArrival)
+  {
+    return _start + this->spin;
+  }
+
+  // spin until a few deviations past the expected arrival, never longer
+  // than the configured budget
+  const double window = this->intervalMean + 4.0 * this->intervalDev;
+  const Clock::time_point expected = this->lastArrival +
+    std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(window));
+  return std::min(expected, _start + this->spin);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLockstepWait::RecordArrival(const Clock::time_point &_now)
+{
+  if (this->haveArrival)
+  {
+    const double interval =
+      std::chrono::duration<double>(_now - this->lastArrival).count();
+    // exponentially weighted mean and mean deviation, as for tcp rtt
+    const double err = interval - this->intervalMean;
+    this->intervalMean += 0.125 * err;
+    this->intervalDev += 0.25 * (std::fabs(err) - this->intervalDev);
+  }
+  this->lastArrival = _now;
+  this->haveArrival = true;
+}
+
+/////////////////////////////////////////////////
+const ServoPacket *ArduPilotLockstepWait::Receive(
+  ArduPilotTransport &_transport, ssize_t &_size)
+{
+  // Once ArduPilot is online the wait is long enough to accomodate
+  // network jitter, 1 sec by default.
+  const ServoPacket *pkt = nullptr;
+  const Clock::time_point start = Clock::now();
+  const bool polling =
+    this->spin.count() > 0 || this->yield.count() > 0;
+
+  if (polling)
+  {
+    const Clock::time_point spinEnd = this->SpinDeadline(start);
+    const Clock::time_point yieldEnd = std::max(spinEnd, start + this->spin) +
+      this->yield;
+    Clock::time_point now = start;
+    while (!(pkt = _transport.ReceiveLatest(0, _size)) && now < yieldEnd)
+    {
+      if (now < spinEnd)
+      {
+        CpuRelax();
+      }
+      else
+      {
+        std::this_thread::yield();
+      }
+      now = Clock::now();
+    }
+  }
+
+  if (!pkt)
+  {
+    uint32_t waitMs = this->timeoutMs;
+    if (polling)
+    {
+      const uint32_t elapsedMs = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now() - start).count());
+      waitMs = elapsedMs < waitMs ? waitMs - elapsedMs : 0;
+    }
+    pkt = _transport.ReceiveLatest(waitMs, _size);
+  }
+
+  if (pkt && this->adaptiveSpin)
+  {
+    this->RecordArrival(Clock::now());
+  }
+  return pkt;
+}
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <gazebo/common/Console.hh>
+#include "include/ArduPilotLog.hh"
+
+/// \brief Call sites tracked for rate limiting, a power of two
+#define LOG_SITE_COUNT 1024
+
+/// \brief Messages that can wait for the writer thread, a power of two
+#define LOG_QUEUE_SIZE 512
+
+namespace gazebo
+{
+  /// \brief Rate limit state of one call site
+  struct ArduPilotLogSite
+  {
+    /// \brief Hash of file and line, 0 for a free slot
+    std::atomic<uint64_t> key{0};
+
+    /// \brief Source file, for the summary on exit. A copy, the library
+    /// owning the literal may be gone by then.
+    char file[128] = {0};
+
+    /// \brief Source line, for the summary on exit
+    int line = 0;
+
+    /// \brief Steady clock time of the last message let through, ns
+    std::atomic<int64_t> lastNs{0};
+
+    /// \brief Messages suppressed since the last one let through
+    std::atomic<uint64_t> suppressed{0};
+  };
+
+  /// \brief Queued message, bounded MPMC queue cell (D. Vyukov)
+  struct ArduPilotLogCell
+  {
+    /// \brief Cell sequence number
+    std::atomic<size_t> seq{0};
+
+    /// \brief Severity
+    ArduPilotLog::Level level;
+
+    /// \brief Source file
+    const char *file;
+
+    /// \brief Source line
+    int line;
+
+    /// \brief Messages suppressed before this one
+    uint64_t suppressed;
+
+    /// \brief Length of text
+    size_t size;
+
+    /// \brief Message
+    char text[ARDUPILOT_LOG_LINE_SIZE];
+  };
+
+  /// \brief Call site table, queue and writer thread
+  class ArduPilotLogWriter
+  {
+    /// \brief Constructor
+    public: ArduPilotLogWriter();
+
+    /// \brief Destructor, writes out the rest and the suppressed counts
+    public: ~ArduPilotLogWriter();
+
+    /// \brief See ArduPilotLog::Allow
+    public: uint64_t Allow(const char *_file, const int _line,
+      const uint32_t _intervalMs);
+
+    /// \brief See ArduPilotLog::Push
+    public: void Push(const ArduPilotLog::Level _level, const char *_file,
+      const int _line, const uint64_t _suppressed, const char *_text,
+      const size_t _size);
+
+    /// \brief Write out every queued message
+    public: void Drain();
+
+    /// \brief Writer thread loop
+    private: void Run();
+
+    /// \brief Write one message to the Gazebo console
+    /// \param[in] _cell Message.
+    private: static void Write(const ArduPilotLogCell &_cell);
+
+    /// \brief Call sites
+    private: ArduPilotLogSite sites[LOG_SITE_COUNT];
+
+    /// \brief Queue cells
+    private: ArduPilotLogCell cells[LOG_QUEUE_SIZE];
+
+    /// \brief Next cell to write
+    private: std::atomic<size_t> enqueuePos{0};
+
+    /// \brief Next cell to read
+    private: std::atomic<size_t> dequeuePos{0};
+
+    /// \brief Messages dropped because the queue was full
+    private: std::atomic<uint64_t> dropped{0};
+
+    /// \brief Serializes readers and protects running
+    private: std::mutex mutex;
+
+    /// \brief Wakes the writer thread for shutdown
+    private: std::condition_variable wake;
+
+    /// \brief Writer thread stop flag
+    private: bool running = false;
+
+    /// \brief Starts the writer thread on the first message
+    private: std::once_flag started;
+
+    /// \brief Writer thread
+    private: std::thread thread;
+  };
+}
+
+using namespace gazebo;
+
+/// \brief Process-wide writer
+static ArduPilotLogWriter logWriter;
+
+/// \brief Steady clock reading
+/// \return Nanoseconds, never 0.
+static inline int64_t Now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count() | 1;
+}
+
+/////////////////////////////////////////////////
+ArduPilotLogWriter::ArduPilotLogWriter()
+{
+  for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+  {
+    this->cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+}
+
+/////////////////////////////////////////////////
+ArduPilotLogWriter::~ArduPilotLogWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = false;
+  }
+  this->wake.notify_one();
+  if (this->thread.joinable())
+  {
+    this->thread.join();
+  }
+  this->Drain();
+
+  for (const auto &site : this->sites)
+  {
+    const uint64_t suppressed = site.suppressed;
+    if (suppressed > 0)
+    {
+      gazebo::common::Console::msg()
+        << "[" << site.file << ":" << site.line << "] " << suppressed
+        << " similar messages suppressed since the last one.\n";
+    }
+  }
+  if (this->dropped > 0)
+  {
+    gazebo::common::Console::msg()
+      << "ArduPilot plugins dropped " << this->dropped
+      << " log messages, the log queue was full.\n";
+  }
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotLogWriter::Allow(const char *_file, const int _line,
+  const uint32_t _intervalMs)
+{
+  if (_intervalMs == 0)
+  {
+    return 1;
+  }
+
+  // call sites are told apart by the address of their __FILE__ literal
+  // and their line
+  uint64_t key = reinterpret_cast<uintptr_t>(_file) * 0x9e3779b97f4a7c15ull
+    ^ static_cast<uint64_t>(_line) * 0xff51afd7ed558ccdull;
+  key = key ? key : 1;
+
+  ArduPilotLogSite *site = nullptr;
+  for (unsigned probe = 0; probe < 8 && !site; ++probe)
+  {
+    ArduPilotLogSite &slot =
+      this->sites[(key + probe) & (LOG_SITE_COUNT - 1)];
+    uint64_t current = slot.key.load(std::memory_order_acquire);
+    if (current == 0 &&
+        slot.key.compare_exchange_strong(current, key))
+    {
+      strncpy(slot.file, _file, sizeof(slot.file) - 1);
+      slot.line = _line;
+      site = &slot;
+    }
+    else if (current == key)
+    {
+      site = &slot;
+    }
+  }
+  if (!site)
+  {
+    // table full, do not rate limit
+    return 1;
+  }
+
+  const int64_t now = Now();
+  int64_t last = site->lastNs.load(std::memory_order_relaxed);
+  if ((last != 0 && now - last < int64_t(_intervalMs) * 1000000) ||
+      !site->lastNs.compare_exchange_strong(last, now))
+  {
+    site->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+  return site->suppressed.exchange(0) + 1;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLogWriter::Push(const ArduPilotLog::Level _level,
+  const char *_file, const int _line, const uint64_t _suppressed,
+  const char *_text, const size_t _size)
+{
+  std::call_once(this->started, [this]()
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = true;
+    this->thread = std::thread(&ArduPilotLogWriter::Run, this);
+  });
+
+  ArduPilotLogCell *cell;
+  size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+  while (true)
+  {
+    cell = &this->cells[pos & (LOG_QUEUE_SIZE - 1)];
+    const size_t seq = cell->seq.load(std::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(seq) -
+      static_cast<intptr_t>(pos);
+    if (diff == 0)
+    {
+      if (this->enqueuePos.compare_exchange_weak(pos, pos + 1,
+          std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // full, never block the caller
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = this->enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->level = _level;
+  cell->file = _file;
+  cell->line = _line;
+  cell->suppressed = _suppressed;
+  cell->size = std::min(_size, sizeof(cell->text));
+  memcpy(cell->text, _text, cell->size);
+  cell->seq.store(pos + 1, std::memory_order_release);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLogWriter::Write(const ArduPilotLogCell &_cell)
+{
+  std::string text(_cell.text, _cell.size);
+  const bool newline = !text.empty() && text.back() == '\n';
+  if (newline)
+  {
+    text.pop_back();
+  }
+  if (_cell.suppressed > 0)
+  {
+    text += " (" + std::to_string(_cell.suppressed) +
+      " similar messages suppressed)";
+  }
+  text += '\n';
+
+  switch (_cell.level)
+  {
+    case ArduPilotLog::ERR:
+      gazebo::common::Console::err(_cell.file, _cell.line) << text;
+      break;
+    case ArduPilotLog::WARN:
+      gazebo::common::Console::warn(_cell.file, _cell.line) << text;
+      break;
+    case ArduPilotLog::DBG:
+      gazebo::common::Console::dbg(_cell.file, _cell.line) << text;
+      break;
+    case ArduPilotLog::MSG:
+    default:
+      gazebo::common::Console::msg() << text;
+      break;
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLogWriter::Drain()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  size_t pos = this->dequeuePos.load(std::memory_order_relaxed);
+  while (true)
+  {
+    ArduPilotLogCell &cell = this->cells[pos & (LOG_QUEUE_SIZE - 1)];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+    {
+      break;
+    }
+    Write(cell);
+    cell.seq.store(pos + LOG_QUEUE_SIZE, std::memory_order_release);
+    ++pos;
+  }
+  this->dequeuePos.store(pos, std::memory_order_relaxed);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLogWriter::Run()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (this->running)
+  {
+    this->wake.wait_for(lock, std::chrono::milliseconds(20));
+    lock.unlock();
+    this->Drain();
+    lock.lock();
+  }
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotLog::Allow(const char *_file, const int _line,
+  const uint32_t _intervalMs)
+{
+  return logWriter.Allow(_file, _line, _intervalMs);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLog::Push(const Level _level, const char *_file,
+  const int _line, const uint64_t _suppressed, const char *_text,
+  const size_t _size)
+{
+  logWriter.Push(_level, _file, _line, _suppressed, _text, _size);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotLog::Flush()
+{
+  logWriter.Drain();
+}
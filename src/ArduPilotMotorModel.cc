@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotMotorModel.hh"
+
+using namespace gazebo;
+
+/////////////////////////////////////////////////
+bool ArduPilotMotorModel::Load(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  const std::string thrustTable =
+    _sdf->Get("thrustTable", static_cast<std::string>("")).first;
+  if (!ParseTable(thrustTable, this->thrustSpeeds, this->thrustValues))
+  {
+    gzerr << "[" << _modelName << "] "
+          << "<thrustTable> must be pairs of speed and thrust in increasing "
+          << "speed order.\n";
+    return false;
+  }
+  const std::string torqueTable =
+    _sdf->Get("torqueTable", static_cast<std::string>("")).first;
+  if (!ParseTable(torqueTable, this->torqueSpeeds, this->torqueValues))
+  {
+    gzerr << "[" << _modelName << "] "
+          << "<torqueTable> must be pairs of speed and torque in increasing "
+          << "speed order.\n";
+    return false;
+  }
+  this->timeConstant = std::max(0.0,
+    _sdf->Get("timeConstant", this->timeConstant).first);
+  return true;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotMotorModel::HasThrust() const
+{
+  return !this->thrustSpeeds.empty();
+}
+
+/////////////////////////////////////////////////
+double ArduPilotMotorModel::Thrust(const double _speed) const
+{
+  return Interpolate(this->thrustSpeeds, this->thrustValues, _speed);
+}
+
+/////////////////////////////////////////////////
+double ArduPilotMotorModel::Torque(const double _speed) const
+{
+  return Interpolate(this->torqueSpeeds, this->torqueValues, _speed);
+}
+
+/////////////////////////////////////////////////
+double ArduPilotMotorModel::LagFactor(const double _dt) const
+{
+  if (this->timeConstant <= 0.0)
+  {
+    return 1.0;
+  }
+  return 1.0 - std::exp(-_dt / this->timeConstant);
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotMotorModel::ParseTable(const std::string &_text,
+  std::vector<double> &_x, std::vector<double> &_y)
+{
+  _x.clear();
+  _y.clear();
+  std::istringstream in(_text);
+  double x;
+  while (in >> x)
+  {
+    double y;
+    if (!(in >> y) || (!_x.empty() && x < _x.back()))
+    {
+      return false;
+    }
+    _x.push_back(x);
+    _y.push_back(y);
+  }
+  return in.eof();
+}
+
+/////////////////////////////////////////////////
+double ArduPilotMotorModel::Interpolate(const std::vector<double> &_x,
+  const std::vector<double> &_y, const double _at)
+{
+  if (_x.empty())
+  {
+    return 0.0;
+  }
+  if (_at <= _x.front())
+  {
+    return _y.front();
+  }
+  if (_at >= _x.back())
+  {
+    return _y.back();
+  }
+  // tables are a handful of points, upper_bound is as fast as anything
+  const size_t hi = static_cast<size_t>(
+    std::upper_bound(_x.begin(), _x.end(), _at) - _x.begin());
+  const size_t lo = hi - 1;
+  const double span = _x[hi] - _x[lo];
+  const double t = span > 0.0 ? (_at - _x[lo]) / span : 0.0;
+  return _y[lo] + t * (_y[hi] - _y[lo]);
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ignition/math/Helpers.hh>
+#include "include/ArduPilotPidBank.hh"
+
+// build with -DARDUPILOT_PID_SCALAR to always use the scalar kernel, and
+// with -DARDUPILOT_PID_NO_AVX2 to never use the AVX2 one
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ARDUPILOT_PID_SCALAR)
+#include <immintrin.h>
+#define ARDUPILOT_PID_X86 1
+#endif
+
+using namespace gazebo;
+
+const size_t ArduPilotPidBank::kLanes;
+
+/// \brief Bank arrays handed to the update kernels
+struct PidArrays
+{
+  const double *pGain;
+  const double *iGain;
+  const double *dGain;
+  const double *iMax;
+  const double *iMin;
+  const double *cmdMax;
+  const double *cmdMin;
+  const double *errors;
+  double *iErr;
+  double *pErrLast;
+  double *cmds;
+};
+
+/// \brief Update kernel, lanes [0, _count), _count a multiple of kLanes
+typedef void (*PidKernel)(const PidArrays &_a, const size_t _count,
+  const double _dt);
+
+#ifndef ARDUPILOT_PID_X86
+/// \brief One lane at a time, the statements of common::PID::Update
+static void UpdateScalar(const PidArrays &_a, const size_t _count,
+  const double _dt)
+{
+  for (size_t i = 0; i < _count; ++i)
+  {
+    const double error = _a.errors[i];
+    if (!std::isfinite(error))
+    {
+      _a.cmds[i] = 0.0;
+      continue;
+    }
+    const double pTerm = _a.pGain[i] * error;
+    _a.iErr[i] = _a.iErr[i] + _dt * error;
+    double iTerm = _a.iGain[i] * _a.iErr[i];
+    if (iTerm > _a.iMax[i])
+    {
+      iTerm = _a.iMax[i];
+      _a.iErr[i] = iTerm / _a.iGain[i];
+    }
+    else if (iTerm < _a.iMin[i])
+    {
+      iTerm = _a.iMin[i];
+      _a.iErr[i] = iTerm / _a.iGain[i];
+    }
+    const double dErr = (error - _a.pErrLast[i]) / _dt;
+    _a.pErrLast[i] = error;
+    const double dTerm = _a.dGain[i] * dErr;
+    double cmd = -pTerm - iTerm - dTerm;
+    if (cmd > _a.cmdMax[i])
+    {
+      cmd = _a.cmdMax[i];
+    }
+    if (cmd < _a.cmdMin[i])
+    {
+      cmd = _a.cmdMin[i];
+    }
+    _a.cmds[i] = cmd;
+  }
+}
+#else
+/// \brief _mask ? _a : _b, per lane
+static inline __m128d Select(const __m128d _mask, const __m128d _a,
+  const __m128d _b)
+{
+  return _mm_or_pd(_mm_and_pd(_mask, _a), _mm_andnot_pd(_mask, _b));
+}
+
+/// \brief Two lanes per instruction, x86-64 always has SSE2
+static void UpdateSse2(const PidArrays &_a, const size_t _count,
+  const double _dt)
+{
+  const __m128d dt = _mm_set1_pd(_dt);
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d sign = _mm_set1_pd(-0.0);
+  for (size_t i = 0; i < _count; i += 2)
+  {
+    const __m128d error = _mm_loadu_pd(_a.errors + i);
+    // x - x is 0 for finite x only
+    const __m128d finite = _mm_cmpeq_pd(_mm_sub_pd(error, error), zero);
+    const __m128d iErrOld = _mm_loadu_pd(_a.iErr + i);
+    const __m128d pErrLastOld = _mm_loadu_pd(_a.pErrLast + i);
+
+    const __m128d pTerm = _mm_mul_pd(_mm_loadu_pd(_a.pGain + i), error);
+    __m128d iErr = _mm_add_pd(iErrOld, _mm_mul_pd(dt, error));
+    const __m128d iGain = _mm_loadu_pd(_a.iGain + i);
+    __m128d iTerm = _mm_mul_pd(iGain, iErr);
+    const __m128d iMax = _mm_loadu_pd(_a.iMax + i);
+    const __m128d iMin = _mm_loadu_pd(_a.iMin + i);
+    const __m128d above = _mm_cmpgt_pd(iTerm, iMax);
+    const __m128d below = _mm_andnot_pd(above, _mm_cmplt_pd(iTerm, iMin));
+    const __m128d limited = _mm_or_pd(above, below);
+    iTerm = Select(above, iMax, Select(below, iMin, iTerm));
+    iErr = Select(limited, _mm_div_pd(iTerm, iGain), iErr);
+
+    const __m128d dErr = _mm_div_pd(_mm_sub_pd(error, pErrLastOld), dt);
+    const __m128d dTerm = _mm_mul_pd(_mm_loadu_pd(_a.dGain + i), dErr);
+    __m128d cmd = _mm_sub_pd(_mm_sub_pd(_mm_xor_pd(pTerm, sign), iTerm),
+      dTerm);
+    // minpd / maxpd return their second operand unless the first wins
+    // the comparison, as the scalar if statements do
+    cmd = _mm_min_pd(_mm_loadu_pd(_a.cmdMax + i), cmd);
+    cmd = _mm_max_pd(_mm_loadu_pd(_a.cmdMin + i), cmd);
+
+    _mm_storeu_pd(_a.iErr + i, Select(finite, iErr, iErrOld));
+    _mm_storeu_pd(_a.pErrLast + i, Select(finite, error, pErrLastOld));
+    _mm_storeu_pd(_a.cmds + i, _mm_and_pd(finite, cmd));
+  }
+}
+
+#ifndef ARDUPILOT_PID_NO_AVX2
+/// \brief Four lanes per instruction, only called when the cpu has AVX2
+__attribute__((target("avx2")))
+static void UpdateAvx2(const PidArrays &_a, const size_t _count,
+  const double _dt)
+{
+  const __m256d dt = _mm256_set1_pd(_dt);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  for (size_t i = 0; i < _count; i += 4)
+  {
+    const __m256d error = _mm256_loadu_pd(_a.errors + i);
+    const __m256d finite =
+      _mm256_cmp_pd(_mm256_sub_pd(error, error), zero, _CMP_EQ_OQ);
+    const __m256d iErrOld = _mm256_loadu_pd(_a.iErr + i);
+    const __m256d pErrLastOld = _mm256_loadu_pd(_a.pErrLast + i);
+
+    const __m256d pTerm = _mm256_mul_pd(_mm256_loadu_pd(_a.pGain + i), error);
+    __m256d iErr = _mm256_add_pd(iErrOld, _mm256_mul_pd(dt, error));
+    const __m256d iGain = _mm256_loadu_pd(_a.iGain + i);
+    __m256d iTerm = _mm256_mul_pd(iGain, iErr);
+    const __m256d iMax = _mm256_loadu_pd(_a.iMax + i);
+    const __m256d iMin = _mm256_loadu_pd(_a.iMin + i);
+    const __m256d above = _mm256_cmp_pd(iTerm, iMax, _CMP_GT_OQ);
+    const __m256d below =
+      _mm256_andnot_pd(above, _mm256_cmp_pd(iTerm, iMin, _CMP_LT_OQ));
+    const __m256d limited = _mm256_or_pd(above, below);
+    iTerm = _mm256_blendv_pd(_mm256_blendv_pd(iTerm, iMin, below), iMax,
+      above);
+    iErr = _mm256_blendv_pd(iErr, _mm256_div_pd(iTerm, iGain), limited);
+
+    const __m256d dErr =
+      _mm256_div_pd(_mm256_sub_pd(error, pErrLastOld), dt);
+    const __m256d dTerm = _mm256_mul_pd(_mm256_loadu_pd(_a.dGain + i), dErr);
+    __m256d cmd = _mm256_sub_pd(
+      _mm256_sub_pd(_mm256_xor_pd(pTerm, sign), iTerm), dTerm);
+    cmd = _mm256_min_pd(_mm256_loadu_pd(_a.cmdMax + i), cmd);
+    cmd = _mm256_max_pd(_mm256_loadu_pd(_a.cmdMin + i), cmd);
+
+    _mm256_storeu_pd(_a.iErr + i, _mm256_blendv_pd(iErrOld, iErr, finite));
+    _mm256_storeu_pd(_a.pErrLast + i,
+      _mm256_blendv_pd(pErrLastOld, error, finite));
+    _mm256_storeu_pd(_a.cmds + i, _mm256_and_pd(finite, cmd));
+  }
+}
+#endif
+#endif
+
+/// \brief Fastest kernel the cpu runs
+/// \param[out] _name Name of the kernel.
+/// \return Kernel.
+static PidKernel SelectKernel(const char *&_name)
+{
+#ifdef ARDUPILOT_PID_X86
+#ifndef ARDUPILOT_PID_NO_AVX2
+  if (__builtin_cpu_supports("avx2"))
+  {
+    _name = "avx2";
+    return UpdateAvx2;
+  }
+#endif
+  _name = "sse2";
+  return UpdateSse2;
+#else
+  _name = "scalar";
+  return UpdateScalar;
+#endif
+}
+
+/// \brief Kernel chosen when the library is loaded
+static const char *kernelName = nullptr;
+static const PidKernel kernel = SelectKernel(kernelName);
+
+/////////////////////////////////////////////////
+size_t ArduPilotPidBank::Add(const common::PID &_pid)
+{
+  const size_t lane = this->size++;
+  const size_t padded = (this->size + kLanes - 1) / kLanes * kLanes;
+  const double inf = std::numeric_limits<double>::infinity();
+
+  // padding lanes have no gain and no limits, so stay at zero
+  this->pGain.resize(padded, 0.0);
+  this->iGain.resize(padded, 0.0);
+  this->dGain.resize(padded, 0.0);
+  this->iMax.resize(padded, 0.0);
+  this->iMin.resize(padded, 0.0);
+  this->cmdMax.resize(padded, inf);
+  this->cmdMin.resize(padded, -inf);
+  this->iErr.resize(padded, 0.0);
+  this->pErrLast.resize(padded, 0.0);
+  this->errors.resize(padded, 0.0);
+  this->cmds.resize(padded, 0.0);
+
+  this->pGain[lane] = _pid.GetPGain();
+  this->iGain[lane] = _pid.GetIGain();
+  this->dGain[lane] = _pid.GetDGain();
+  this->iMax[lane] = _pid.GetIMax();
+  this->iMin[lane] = _pid.GetIMin();
+  // common::PID ignores a command limit of zero
+  this->cmdMax[lane] = ignition::math::equal(_pid.GetCmdMax(), 0.0) ?
+    inf : _pid.GetCmdMax();
+  this->cmdMin[lane] = ignition::math::equal(_pid.GetCmdMin(), 0.0) ?
+    -inf : _pid.GetCmdMin();
+  return lane;
+}
+
+/////////////////////////////////////////////////
+size_t ArduPilotPidBank::Size() const
+{
+  return this->size;
+}
+
+/////////////////////////////////////////////////
+double *ArduPilotPidBank::Errors()
+{
+  return this->errors.data();
+}
+
+/////////////////////////////////////////////////
+const double *ArduPilotPidBank::Update(const double _dt)
+{
+  if (std::fpclassify(_dt) == FP_ZERO)
+  {
+    // common::PID returns 0 and leaves its state alone
+    std::fill(this->cmds.begin(), this->cmds.end(), 0.0);
+    return this->cmds.data();
+  }
+
+  PidArrays arrays;
+  arrays.pGain = this->pGain.data();
+  arrays.iGain = this->iGain.data();
+  arrays.dGain = this->dGain.data();
+  arrays.iMax = this->iMax.data();
+  arrays.iMin = this->iMin.data();
+  arrays.cmdMax = this->cmdMax.data();
+  arrays.cmdMin = this->cmdMin.data();
+  arrays.errors = this->errors.data();
+  arrays.iErr = this->iErr.data();
+  arrays.pErrLast = this->pErrLast.data();
+  arrays.cmds = this->cmds.data();
+  kernel(arrays, this->cmds.size(), _dt);
+  return this->cmds.data();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotPidBank::Reset()
+{
+  std::fill(this->iErr.begin(), this->iErr.end(), 0.0);
+  std::fill(this->pErrLast.begin(), this->pErrLast.end(), 0.0);
+}
+
+/////////////////////////////////////////////////
+const char *ArduPilotPidBank::Isa()
+{
+  return kernelName;
+}
@@ -14,104 +14,156 @@
  * limitations under the License.
  *
 */
+#include <cmath>
+#include <cstdlib>
 #include <functional>
-#include <fcntl.h>
-#ifdef _WIN32
-  #include <Winsock2.h>
-  #include <Ws2def.h>
-  #include <Ws2ipdef.h>
-  #include <Ws2tcpip.h>
-  using raw_type = char;
-#else
-  #include <sys/socket.h>
-  #include <netinet/in.h>
-  #include <netinet/tcp.h>
-  #include <arpa/inet.h>
-  using raw_type = void;
-#endif
-
-#if defined(_MSC_VER)
-  #include <BaseTsd.h>
-  typedef SSIZE_T ssize_t;
-#endif
-
+#include <algorithm>
+#include <chrono>
 #include <mutex>
+#include <new>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <sdf/sdf.hh>
-#include <ignition/math/Filter.hh>
 #include <gazebo/common/Assert.hh>
 #include <gazebo/common/Plugin.hh>
 #include <gazebo/msgs/msgs.hh>
 #include <gazebo/sensors/sensors.hh>
 #include <gazebo/transport/transport.hh>
+#include "include/ArduPilotFanout.hh"
+#include "include/ArduPilotFdmExtensions.hh"
+#include "include/ArduPilotFilterBank.hh"
+#include "include/ArduPilotHistogram.hh"
+#include "include/ArduPilotImu.hh"
+#include "include/ArduPilotLockstepWait.hh"
+#include "include/ArduPilotLog.hh"
+#include "include/ArduPilotMotorModel.hh"
+#include "include/ArduPilotPidBank.hh"
 #include "include/ArduPilotPlugin.hh"
+#include "include/ArduPilotProtocol.hh"
+#include "include/ArduPilotRealtime.hh"
+#include "include/ArduPilotTrace.hh"
+#include "include/ArduPilotTransport.hh"
+#include "include/ArduPilotVehicleState.hh"
 
-#define MAX_MOTORS 255
+static_assert(gazebo::kMaxEscs == MAX_ESCS,
+  "ArduPilotVehicleState must hold every ESC channel of the wire formats");
 
 using namespace gazebo;
 
 GZ_REGISTER_MODEL_PLUGIN(ArduPilotPlugin)
 
-/// \brief A servo packet.
-struct ServoPacket
+/// \brief OnUpdate phases timed with <stepTiming>
+enum StepPhase
 {
-  /// \brief Motor speed data.
-  /// should rename to servo_command here and in ArduPilot SIM_Gazebo.cpp
-  float motorSpeed[MAX_MOTORS] = {0.0f};
+  /// \brief Acquiring the controller mutex
+  PHASE_LOCK,
+
+  /// \brief Waiting for and draining servo packets
+  PHASE_WAIT,
+
+  /// \brief Decoding the servo packet into control commands
+  PHASE_COMMAND,
+
+  /// \brief ApplyMotorForces
+  PHASE_FORCES,
+
+  /// \brief SendState
+  PHASE_SEND,
+
+  PHASE_COUNT
 };
 
-/// \brief Flight Dynamics Model packet that is sent back to the ArduPilot
-struct fdmPacket
+/// \brief Link state with ArduPilot
+enum ConnectionState
 {
-  /// \brief packet timestamp
-  double timestamp;
+  /// \brief No ArduPilot, nothing is received until the probe backoff
+  /// expires
+  CONNECTION_OFFLINE,
+
+  /// \brief Checking, without waiting, whether ArduPilot sent a packet
+  CONNECTION_PROBING,
+
+  /// \brief Exchanging packets with ArduPilot
+  CONNECTION_ONLINE
+};
 
-  /// \brief IMU angular velocity
-  double imuAngularVelocityRPY[3];
+/// \brief What a control drives its joint to, from <type>
+enum ControlType
+{
+  /// \brief Joint velocity
+  CONTROL_VELOCITY,
 
-  /// \brief IMU linear acceleration
-  double imuLinearAccelerationXYZ[3];
+  /// \brief Joint position
+  CONTROL_POSITION,
 
-  /// \brief IMU quaternion orientation
-  double imuOrientationQuat[4];
+  /// \brief Joint effort
+  CONTROL_EFFORT,
 
-  /// \brief Model velocity in NED frame
-  double velocityXYZ[3];
+  /// \brief Jointless rotor speed, thrust and drag torque looked up in a
+  /// motor model act on the base link
+  CONTROL_ROTOR
+};
 
-  /// \brief Model position in NED frame
-  double positionXYZ[3];
-/*  NOT MERGED IN MASTER YET
-  /// \brief Model latitude in WGS84 system
-  double latitude = 0.0;
+/// \brief How ApplyMotorForces drives a joint, from <type> and <useForce>
+enum ControlMode
+{
+  /// \brief Velocity PID output applied as force
+  MODE_VELOCITY_PID,
 
-  /// \brief Model longitude in WGS84 system
-  double longitude = 0.0;
+  /// \brief Position PID output applied as force
+  MODE_POSITION_PID,
 
-  /// \brief Model altitude from GPS
-  double altitude = 0.0;
+  /// \brief Command applied as force, with or without <useForce>
+  MODE_EFFORT,
 
-  /// \brief Model estimated from airspeed sensor (e.g. Pitot) in m/s
-  double airspeed = 0.0;
+  /// \brief Command set as the joint velocity
+  MODE_SET_VELOCITY,
 
-  /// \brief Battery voltage. Default to -1 to use sitl estimator.
-  double battery_voltage = -1.0;
+  /// \brief Command set as the joint position
+  MODE_SET_POSITION,
 
-  /// \brief Battery Current.
-  double battery_current = 0.0;
+  /// \brief Command is the speed of a jointless rotor, see VirtualRotors
+  MODE_VIRTUAL_ROTOR,
 
-  /// \brief Model rangefinder value. Default to -1 to use sitl rangefinder.
-  double rangefinder = -1.0;
-*/
+  MODE_COUNT
 };
 
+/// \brief Names of the StepPhase values
+static const char *const kStepPhaseNames[PHASE_COUNT] =
+  {"lock", "wait", "command", "forces", "send"};
+
+/// \brief Steady clock reading for phase timing
+/// \return Nanoseconds.
+static inline int64_t TimingNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// \brief Format phase timing histograms, one line per phase
+/// \param[in] _phases Histograms indexed by StepPhase.
+/// \return Text summary.
+static std::string FormatStepTiming(const ArduPilotHistogram *_phases)
+{
+  std::ostringstream ss;
+  for (unsigned i = 0; i < PHASE_COUNT; ++i)
+  {
+    ss << kStepPhaseNames[i]
+       << " count " << _phases[i].Count()
+       << " p50 " << 1e-3 * _phases[i].Percentile(50) << "us"
+       << " p99 " << 1e-3 * _phases[i].Percentile(99) << "us"
+       << " max " << 1e-3 * _phases[i].Max() << "us\n";
+  }
+  return ss.str();
+}
+
 /// \brief Control class
 class Control
 {
   /// \brief Constructor
   public: Control()
   {
-    // most of these coefficients are not used yet.
     this->rotorVelocitySlowdownSim = this->kDefaultRotorVelocitySlowdownSim;
     this->frequencyCutoff = this->kDefaultFrequencyCutoff;
     this->samplingRate = this->kDefaultSamplingRate;
@@ -122,20 +174,40 @@ class Control
   /// \brief copy constructor
   public: Control& operator=(const Control& source) = default;
 
+  /// \brief Mode ApplyMotorForces drives the joint with
+  /// \return Mode derived from type and useForce.
+  public: ControlMode Mode() const
+  {
+    if (this->type == CONTROL_ROTOR)
+    {
+      return MODE_VIRTUAL_ROTOR;
+    }
+    if (this->type == CONTROL_EFFORT)
+    {
+      return MODE_EFFORT;
+    }
+    if (this->useForce)
+    {
+      return this->type == CONTROL_POSITION ?
+        MODE_POSITION_PID : MODE_VELOCITY_PID;
+    }
+    return this->type == CONTROL_POSITION ?
+      MODE_SET_POSITION : MODE_SET_VELOCITY;
+  }
+
   /// \brief control id / channel
   public: int channel = 0;
 
-  /// \brief Next command to be applied to the propeller
-  public: double cmd = 0;
-
-  /// \brief Velocity PID for motor control
+  /// \brief Velocity PID gains and limits for motor control, run by
+  /// ArduPilotPluginPrivate::pidBank
   public: common::PID pid;
 
   /// \brief Control type. Can be:
   /// VELOCITY control velocity of joint
   /// POSITION control position of joint
   /// EFFORT control effort of joint
-  public: std::string type;
+  /// ROTOR control speed of a jointless rotor
+  public: ControlType type = CONTROL_VELOCITY;
 
   /// \brief use force controler
   public: bool useForce = true;
@@ -152,11 +224,31 @@ class Control
   /// \brief input command offset
   public: double offset = 0;
 
-  /// \brief unused coefficients
+  /// \brief Ratio of the modelled rotor speed to the joint velocity
   public: double rotorVelocitySlowdownSim;
+
+  /// \brief Joint velocity low-pass filter coefficients, run by
+  /// ArduPilotPluginPrivate::velocityFilter
   public: double frequencyCutoff;
   public: double samplingRate;
-  public: ignition::math::OnePole<double> filter;
+
+  /// \brief ROTOR controls, thrust, drag torque and lag of the rotor
+  public: ArduPilotMotorModel motor;
+
+  /// \brief ROTOR controls, rotor position in the base link frame
+  public: ignition::math::Vector3d rotorPosition;
+
+  /// \brief ROTOR controls, thrust axis in the base link frame
+  public: ignition::math::Vector3d rotorAxis =
+    ignition::math::Vector3d::UnitZ;
+
+  /// \brief ROTOR controls, scoped name of the prop visual spun for
+  /// display, empty for none
+  public: std::string visualName;
+
+  /// \brief ROTOR controls, pose of the prop visual at rest in the base
+  /// link frame
+  public: ignition::math::Pose3d visualPose;
 
   public: static double kDefaultRotorVelocitySlowdownSim;
   public: static double kDefaultFrequencyCutoff;
@@ -167,155 +259,97 @@ double Control::kDefaultRotorVelocitySlowdownSim = 10.0;
 double Control::kDefaultFrequencyCutoff = 5.0;
 double Control::kDefaultSamplingRate = 0.2;
 
-// Private data class
-class gazebo::ArduPilotSocketPrivate
+/// \brief Controls sharing a ControlMode, as parallel arrays so that
+/// ApplyMotorForces runs one branch-free loop per mode. The PIDs of the
+/// velocity PID group come first in pidBank, then those of the position
+/// PID group.
+class ControlGroup
 {
-  /// \brief constructor
-  public: ArduPilotSocketPrivate()
-  {
-    // initialize socket udp socket
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    #ifndef _WIN32
-    // Windows does not support FD_CLOEXEC
-    fcntl(fd, F_SETFD, FD_CLOEXEC);
-    #endif
-  }
+  /// \brief Index of each control in ArduPilotPluginPrivate::controls
+  public: std::vector<unsigned int> index;
 
-  /// \brief destructor
-  public: ~ArduPilotSocketPrivate()
-  {
-    if (fd != -1)
-    {
-      ::close(fd);
-      fd = -1;
-    }
-  }
+  /// \brief Joint of each control
+  public: std::vector<physics::Joint *> joints;
 
-  /// \brief Bind to an adress and port
-  /// \param[in] _address Address to bind to.
-  /// \param[in] _port Port to bind to.
-  /// \return True on success.
-  public: bool Bind(const char *_address, const uint16_t _port)
-  {
-    struct sockaddr_in sockaddr;
-    this->MakeSockAddr(_address, _port, sockaddr);
+  /// \brief Command to target divisor of each control,
+  /// rotorVelocitySlowdownSim for velocity PIDs, 1 otherwise
+  public: std::vector<double> divisors;
+};
 
-    if (bind(this->fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) != 0)
-    {
-      shutdown(this->fd, 0);
-      #ifdef _WIN32
-      closesocket(this->fd);
-      #else
-      close(this->fd);
-      #endif
-      return false;
-    }
-    int one = 1;
-    setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR,
-        reinterpret_cast<const char *>(&one), sizeof(one));
-
-    #ifdef _WIN32
-    u_long on = 1;
-    ioctlsocket(this->fd, FIONBIO,
-              reinterpret_cast<u_long FAR *>(&on));
-    #else
-    fcntl(this->fd, F_SETFL,
-        fcntl(this->fd, F_GETFL, 0) | O_NONBLOCK);
-    #endif
-    return true;
-  }
-
-  /// \brief Connect to an adress and port
-  /// \param[in] _address Address to connect to.
-  /// \param[in] _port Port to connect to.
-  /// \return True on success.
-  public : bool Connect(const char *_address, const uint16_t _port)
-  {
-    struct sockaddr_in sockaddr;
-    this->MakeSockAddr(_address, _port, sockaddr);
-
-    if (connect(this->fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) != 0)
-    {
-      shutdown(this->fd, 0);
-      #ifdef _WIN32
-      closesocket(this->fd);
-      #else
-      close(this->fd);
-      #endif
-      return false;
-    }
-    int one = 1;
-    setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR,
-        reinterpret_cast<const char *>(&one), sizeof(one));
+/// \brief ROTOR controls, as parallel arrays: rotors without a joint or
+/// link, whose thrust and drag torque are summed into one force and one
+/// torque on the base link per step. Their props only spin in the visuals.
+class VirtualRotors
+{
+  /// \brief Link the rotors are mounted on, the canonical link
+  public: physics::LinkPtr link;
 
-    #ifdef _WIN32
-    u_long on = 1;
-    ioctlsocket(this->fd, FIONBIO,
-              reinterpret_cast<u_long FAR *>(&on));
-    #else
-    fcntl(this->fd, F_SETFL,
-        fcntl(this->fd, F_GETFL, 0) | O_NONBLOCK);
-    #endif
-    return true;
-  }
+  /// \brief Index of each rotor in ArduPilotPluginPrivate::controls
+  public: std::vector<unsigned int> index;
 
-  /// \brief Make a socket
-  /// \param[in] _address Socket address.
-  /// \param[in] _port Socket port
-  /// \param[out] _sockaddr New socket address structure.
-  public: void MakeSockAddr(const char *_address, const uint16_t _port,
-    struct sockaddr_in &_sockaddr)
-  {
-    memset(&_sockaddr, 0, sizeof(_sockaddr));
+  /// \brief Thrust, drag torque and lag of each rotor
+  public: std::vector<ArduPilotMotorModel> motors;
 
-    #ifdef HAVE_SOCK_SIN_LEN
-      _sockaddr.sin_len = sizeof(_sockaddr);
-    #endif
+  /// \brief Signed speed of each rotor about its axis, rad/s
+  public: std::vector<double> speeds;
 
-    _sockaddr.sin_port = htons(_port);
-    _sockaddr.sin_family = AF_INET;
-    _sockaddr.sin_addr.s_addr = inet_addr(_address);
-  }
+  /// \brief Position of each rotor relative to the link center of mass,
+  /// link frame
+  public: std::vector<ignition::math::Vector3d> arms;
 
-  public: ssize_t Send(const void *_buf, size_t _size)
-  {
-    return send(this->fd, _buf, _size, 0);
-  }
+  /// \brief Thrust axis of each rotor, link frame
+  public: std::vector<ignition::math::Vector3d> axes;
 
-  /// \brief Receive data
-  /// \param[out] _buf Buffer that receives the data.
-  /// \param[in] _size Size of the buffer.
-  /// \param[in] _timeoutMS Milliseconds to wait for data.
-  public: ssize_t Recv(void *_buf, const size_t _size, uint32_t _timeoutMs)
-  {
-    fd_set fds;
-    struct timeval tv;
+  /// \brief Rotor of each prop visual, index into the arrays above
+  public: std::vector<unsigned int> visuals;
 
-    FD_ZERO(&fds);
-    FD_SET(this->fd, &fds);
+  /// \brief Scoped name of each prop visual
+  public: std::vector<std::string> visualNames;
 
-    tv.tv_sec = _timeoutMs / 1000;
-    tv.tv_usec = (_timeoutMs % 1000) * 1000UL;
+  /// \brief Pose of each prop visual at rest, link frame
+  public: std::vector<ignition::math::Pose3d> visualPoses;
 
-    if (select(this->fd+1, &fds, NULL, NULL, &tv) != 1)
-    {
-        return -1;
-    }
+  /// \brief Displayed speed to rotor speed ratio of each prop visual,
+  /// the inverse of rotorVelocitySlowdownSim
+  public: std::vector<double> visualScales;
 
-    #ifdef _WIN32
-    return recv(this->fd, reinterpret_cast<char *>(_buf), _size, 0);
-    #else
-    return recv(this->fd, _buf, _size, 0);
-    #endif
-  }
+  /// \brief Displayed angle of each prop visual, rad
+  public: std::vector<double> visualAngles;
+
+  /// \brief Prop visual pose publisher, on ~/visual
+  public: transport::PublisherPtr visualPub;
 
-  /// \brief Socket handle
-  private: int fd;
+  /// \brief Sim time between two prop visual publications
+  public: common::Time visualPeriod;
+
+  /// \brief Sim time the prop visuals were last published
+  public: common::Time lastVisualPublish;
 };
 
 // Private data class
 class gazebo::ArduPilotPluginPrivate
 {
+  /// \brief Allocate aligned for state, which operator new only does
+  /// from C++17 on
+  /// \param[in] _size Object size.
+  /// \return Storage aligned to alignof(ArduPilotPluginPrivate).
+  public: static void *operator new(const size_t _size)
+  {
+    void *storage = nullptr;
+    if (posix_memalign(&storage, alignof(ArduPilotPluginPrivate), _size) != 0)
+    {
+      throw std::bad_alloc();
+    }
+    return storage;
+  }
+
+  /// \brief Free storage from operator new
+  /// \param[in] _storage Storage to free.
+  public: static void operator delete(void *_storage)
+  {
+    free(_storage);
+  }
+
   /// \brief Pointer to the update event connection.
   public: event::ConnectionPtr updateConnection;
 
@@ -325,45 +359,191 @@ class gazebo::ArduPilotPluginPrivate
   /// \brief String of the model name;
   public: std::string modelName;
 
+  /// \brief Canonical link of the model
+  public: physics::LinkPtr baseLink;
+
+  /// \brief Rotation from the gazebo world frame to the NED frame, the
+  /// inverse of the gazeboXYZToNED rotation
+  public: ignition::math::Quaterniond worldToNED;
+
+  /// \brief Origin of gazeboXYZToNED, rotated by worldToNED
+  public: ignition::math::Vector3d nedOrigin;
+
+  /// \brief Position of the body frame in the model frame, from
+  /// modelXYZToAirplaneXForwardZDown
+  public: ignition::math::Vector3d bodyOffset;
+
+  /// \brief Rotation of the body frame in the model frame, from
+  /// modelXYZToAirplaneXForwardZDown
+  public: ignition::math::Quaterniond bodyRotation;
+
+  /// \brief Gather the vehicle state of the current step into state, once
+  /// per step however many consumers ask
+  /// \return The state of the current step.
+  public: const ArduPilotVehicleState &Snapshot();
+
+  /// \brief Vehicle state, of the current step if stateValid
+  public: ArduPilotVehicleState state;
+
+  /// \brief Whether state was gathered during the current step
+  public: bool stateValid = false;
+
   /// \brief array of propellers
   public: std::vector<Control> controls;
 
+  /// \brief Sort the controls into controlGroups and size the per-step
+  /// command arrays, once all controls are parsed
+  public: void CompileControls();
+
+  /// \brief Controls indexed by ControlMode
+  public: ControlGroup controlGroups[MODE_COUNT];
+
+  /// \brief PIDs of the velocity then position PID groups
+  public: ArduPilotPidBank pidBank;
+
+  /// \brief Controls driving a joint
+  public: std::vector<unsigned int> jointControls;
+
+  /// \brief Joint of each of jointControls
+  public: std::vector<physics::Joint *> joints;
+
+  /// \brief ROTOR controls
+  public: VirtualRotors virtualRotors;
+
+  /// \brief Step the speed of the virtual rotors and apply their summed
+  /// thrust and drag torque to the base link
+  /// \param[in] _dt Step size, seconds.
+  /// \param[out] _velocities Rotor speed of each control, indexed like
+  /// controls, only the virtual rotors are written.
+  public: void ApplyVirtualRotors(const double _dt, double *_velocities);
+
+  /// \brief Advance the prop visual angles and publish their poses at
+  /// most every visualPeriod
+  /// \param[in] _dt Step size, seconds.
+  public: void PublishRotorVisuals(const double _dt);
+
+  /// \brief Mechanical power drawn by all rotors and joints
+  /// \return Power, W.
+  public: double MotorPower() const;
+
+  /// \brief Joint velocity of each control, raw in the inputs and
+  /// low-passed in the outputs, indexed like controls
+  public: ArduPilotFilterBank velocityFilter;
+
+  /// \brief VELOCITY and ROTOR controls reported as ESCs
+  public: std::vector<unsigned int> escControls;
+
+  /// \brief Servo channel each of escControls is reported at
+  public: std::vector<unsigned int> escChannels;
+
+  /// \brief Joint velocity or rotor speed to rotor rpm factor of each of
+  /// escControls
+  public: std::vector<double> escScales;
+
+  /// \brief Number of ESC rpm values sent, the highest reported channel
+  /// plus one
+  public: unsigned int escCount = 0;
+
+  /// \brief Next command to be applied to each control, indexed like
+  /// controls
+  public: std::vector<double> cmds;
+
+  /// \brief Last command received from ArduPilot per control,
+  /// free-running mode
+  public: std::vector<double> receivedCmds;
+
+  /// \brief Command change per sim second between the last two received
+  /// commands per control, used to extrapolate in free-running mode
+  public: std::vector<double> cmdRates;
+
+  /// \brief Servo channel read by each of the first commandCount
+  /// controls
+  public: std::vector<int> channels;
+
+  /// \brief Direction multiplier of each of the first commandCount
+  /// controls
+  public: std::vector<double> multipliers;
+
+  /// \brief Input offset of each of the first commandCount controls
+  public: std::vector<double> offsets;
+
+  /// \brief Lowest command a servo value can decode to, multiplier *
+  /// (offset +- 1), for each of the first commandCount controls
+  public: std::vector<double> cmdMins;
+
+  /// \brief Highest command a servo value can decode to, for each of the
+  /// first commandCount controls
+  public: std::vector<double> cmdMaxs;
+
+  /// \brief Number of controls commanded by ArduPilot, at most MAX_MOTORS
+  public: size_t commandCount = 0;
+
+  /// \brief Highest channel in channels, a packet with more channels
+  /// needs no per-control check
+  public: int maxChannel = -1;
+
   /// \brief keep track of controller update sim-time.
   public: gazebo::common::Time lastControllerUpdateTime;
 
   /// \brief Controller update mutex.
   public: std::mutex mutex;
 
-  /// \brief Ardupilot Socket for receive motor command on gazebo
-  public: ArduPilotSocketPrivate socket_in;
+  /// \brief Link to ArduPilot, udp sockets or shared memory
+  public: std::unique_ptr<ArduPilotTransport> transport;
 
-  /// \brief Ardupilot Socket to send state to Ardupilot
-  public: ArduPilotSocketPrivate socket_out;
+  /// \brief How to wait for the next servo packet
+  public: ArduPilotLockstepWait lockstepWait;
 
-  /// \brief Ardupilot address
-  public: std::string fdm_addr;
+  /// \brief Cpu pinning, scheduling and socket tuning, see <realtime>.
+  public: ArduPilotRealtime realtime;
 
-  /// \brief The Ardupilot listen address
-  public: std::string listen_addr;
+  /// \brief Whether the physics thread was tuned yet, done on the first
+  /// update since Load() runs on another thread.
+  public: bool realtimeApplied = false;
 
-  /// \brief Ardupilot port for receiver socket
-  public: uint16_t fdm_port_in;
+  /// \brief Wire format of the servo and state packets.
+  public: ArduPilotProtocol protocol;
 
-  /// \brief Ardupilot port for sender socket
-  public: uint16_t fdm_port_out;
+  /// \brief Secondary consumers of the state packets, see <fdmMirror>.
+  public: ArduPilotFanout fanout;
 
   /// \brief Pointer to an IMU sensor
   public: sensors::ImuSensorPtr imuSensor;
 
-  /// \brief Pointer to an GPS sensor
-  public: sensors::GpsSensorPtr gpsSensor;
+  /// \brief Compute the IMU with imu instead of reading imuSensor
+  public: bool syntheticImu = false;
+
+  /// \brief IMU computed from its link at the current step, see
+  /// <imuSynthetic>
+  public: ArduPilotImu imu;
 
-  /// \brief Pointer to an Rangefinder sensor
-  public: sensors::RaySensorPtr rangefinderSensor;
+  /// \brief Optional gps, airspeed, battery and rangefinder state
+  public: ArduPilotFdmExtensions fdmExtensions;
 
-  /// \brief false before ardupilot controller is online
-  /// to allow gazebo to continue without waiting
-  public: bool arduPilotOnline;
+  /// \brief Go offline and start probing for ArduPilot again
+  public: void GoOffline();
+
+  /// \brief Back to offline after a probe found no usable packet, the
+  /// next probe waits twice as long up to probeMaxInterval
+  public: void ProbeFailed();
+
+  /// \brief whether ardupilot controller is online, physics does not
+  /// wait for it unless it is
+  public: ConnectionState connectionState = CONNECTION_OFFLINE;
+
+  /// \brief current wall time between two probes while offline
+  public: std::chrono::steady_clock::duration probeInterval;
+
+  /// \brief shortest wall time between two probes, after going offline
+  public: std::chrono::steady_clock::duration probeMinInterval =
+    std::chrono::milliseconds(1);
+
+  /// \brief longest wall time between two probes
+  public: std::chrono::steady_clock::duration probeMaxInterval =
+    std::chrono::milliseconds(20);
+
+  /// \brief wall time of the next probe while offline
+  public: std::chrono::steady_clock::time_point nextProbe;
 
   /// \brief number of times ArduCotper skips update
   public: int connectionTimeoutCount;
@@ -371,19 +551,313 @@ class gazebo::ArduPilotPluginPrivate
   /// \brief number of times ArduCotper skips update
   /// before marking ArduPilot offline
   public: int connectionTimeoutMaxCount;
+
+  /// \brief exchange packets with ArduPilot every this many physics steps,
+  /// holding the last command in between
+  public: unsigned int exchangeEveryNSteps = 1;
+
+  /// \brief physics steps since the last exchange with ArduPilot
+  public: unsigned int stepsSinceExchange = 0;
+
+  /// \brief false to never wait for ArduPilot, reusing the last command
+  /// when no new one has arrived
+  public: bool lockstep = true;
+
+  /// \brief free-running mode, linearly extrapolate stale commands
+  /// instead of holding them
+  public: bool extrapolate = false;
+
+  /// \brief free-running mode, sim time past which a stale command is no
+  /// longer extrapolated but held
+  public: double maxCommandAge = 0.1;
+
+  /// \brief free-running mode, wall time without a packet before marking
+  /// ArduPilot offline
+  public: std::chrono::steady_clock::duration connectionTimeout =
+    std::chrono::seconds(1);
+
+  /// \brief wall time of the last packet received
+  public: std::chrono::steady_clock::time_point lastPacketWallTime;
+
+  /// \brief sim time of the last packet received
+  public: gazebo::common::Time lastCommandTime;
+
+  /// \brief physics steps run on a stale command in free-running mode
+  public: uint64_t staleStepCount = 0;
+
+  /// \brief whether a new command was decoded since the last physics step
+  public: bool commandFresh = false;
+
+  /// \brief time each OnUpdate phase
+  public: bool stepTiming = false;
+
+  /// \brief per-phase duration histograms, indexed by StepPhase
+  public: ArduPilotHistogram phaseTiming[PHASE_COUNT];
+
+  /// \brief time spent in the wait phase of the current step, ns
+  public: int64_t waitNs = 0;
+
+  /// \brief sim time between two publications of phaseTiming
+  public: gazebo::common::Time stepTimingPeriod = 1.0;
+
+  /// \brief sim time phaseTiming was last published
+  public: gazebo::common::Time lastStepTimingPublish;
+
+  /// \brief transport node for the step timing topic
+  public: transport::NodePtr node;
+
+  /// \brief step timing publisher
+  public: transport::PublisherPtr stepTimingPub;
+
+  /// \brief model name as tagged on trace events
+  public: const char *traceVehicle = "";
+
+  /// \brief sim time of the current step as tagged on trace events
+  public: double traceSimTime = 0;
 };
 
 /////////////////////////////////////////////////
 ArduPilotPlugin::ArduPilotPlugin()
   : dataPtr(new ArduPilotPluginPrivate)
 {
-  this->dataPtr->arduPilotOnline = false;
   this->dataPtr->connectionTimeoutCount = 0;
+  this->dataPtr->GoOffline();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotPluginPrivate::GoOffline()
+{
+  this->connectionState = CONNECTION_OFFLINE;
+  this->connectionTimeoutCount = 0;
+  this->protocol.ResetFrameState();
+  this->probeInterval = this->probeMinInterval;
+  this->nextProbe = std::chrono::steady_clock::now();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotPluginPrivate::ProbeFailed()
+{
+  this->connectionState = CONNECTION_OFFLINE;
+  this->probeInterval =
+    std::min(2 * this->probeInterval, this->probeMaxInterval);
+  this->nextProbe = std::chrono::steady_clock::now() + this->probeInterval;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotPluginPrivate::CompileControls()
+{
+  for (ControlGroup &group : this->controlGroups)
+  {
+    group = ControlGroup();
+  }
+  for (unsigned int i = 0; i < this->controls.size(); ++i)
+  {
+    Control &control = this->controls[i];
+    const ControlMode mode = control.Mode();
+    ControlGroup &group = this->controlGroups[mode];
+    group.index.push_back(i);
+    group.joints.push_back(control.joint.get());
+    group.divisors.push_back(mode == MODE_VELOCITY_PID ?
+      control.rotorVelocitySlowdownSim : 1.0);
+  }
+
+  this->pidBank = ArduPilotPidBank();
+  for (const ControlMode mode : {MODE_VELOCITY_PID, MODE_POSITION_PID})
+  {
+    for (const unsigned int i : this->controlGroups[mode].index)
+    {
+      this->pidBank.Add(this->controls[i].pid);
+    }
+  }
+  gzdbg << "[" << this->modelName << "] " << this->pidBank.Size()
+        << " PID loops updated with " << ArduPilotPidBank::Isa() << "\n";
+
+  this->virtualRotors = VirtualRotors();
+  VirtualRotors &rotors = this->virtualRotors;
+  rotors.link = this->baseLink;
+  for (const unsigned int i : this->controlGroups[MODE_VIRTUAL_ROTOR].index)
+  {
+    if (!rotors.link)
+    {
+      gzerr << "[" << this->modelName << "] "
+            << "no base link, ROTOR controls have no effect.\n";
+      break;
+    }
+    const Control &control = this->controls[i];
+    const physics::InertialPtr inertial = rotors.link->GetInertial();
+    rotors.index.push_back(i);
+    rotors.motors.push_back(control.motor);
+    rotors.speeds.push_back(0.0);
+    rotors.arms.push_back(inertial ?
+      control.rotorPosition - inertial->CoG() : control.rotorPosition);
+    rotors.axes.push_back(control.rotorAxis);
+    if (!control.visualName.empty())
+    {
+      rotors.visuals.push_back(rotors.index.size() - 1);
+      rotors.visualNames.push_back(control.visualName);
+      rotors.visualPoses.push_back(control.visualPose);
+      rotors.visualScales.push_back(1.0 / control.rotorVelocitySlowdownSim);
+      rotors.visualAngles.push_back(0.0);
+    }
+  }
+
+  // rotors report their low-passed speed at their servo channel
+  this->jointControls.clear();
+  this->joints.clear();
+  this->velocityFilter = ArduPilotFilterBank();
+  this->escControls.clear();
+  this->escChannels.clear();
+  this->escScales.clear();
+  this->escCount = 0;
+  for (unsigned int i = 0; i < this->controls.size(); ++i)
+  {
+    const Control &control = this->controls[i];
+    if (control.joint)
+    {
+      this->jointControls.push_back(i);
+      this->joints.push_back(control.joint.get());
+    }
+    this->velocityFilter.Add(control.frequencyCutoff, control.samplingRate);
+    const bool rotor = control.type == CONTROL_ROTOR;
+    if ((control.type == CONTROL_VELOCITY || rotor) && control.channel >= 0 &&
+        control.channel < MAX_ESCS)
+    {
+      // virtual rotors run at the modelled speed, unslowed
+      this->escControls.push_back(i);
+      this->escChannels.push_back(control.channel);
+      this->escScales.push_back((rotor ? 1.0 :
+        control.rotorVelocitySlowdownSim) * 60.0 / (2.0 * IGN_PI));
+      this->escCount = std::max(this->escCount,
+        static_cast<unsigned int>(control.channel) + 1);
+    }
+  }
+  this->velocityFilter.Set(0.0);
+
+  this->cmds.assign(this->controls.size(), 0.0);
+  this->receivedCmds.assign(this->controls.size(), 0.0);
+  this->cmdRates.assign(this->controls.size(), 0.0);
+
+  this->commandCount = std::min<size_t>(this->controls.size(), MAX_MOTORS);
+  if (this->commandCount < this->controls.size())
+  {
+    gzerr << "[" << this->modelName << "] "
+          << "too many motors, controls past [" << MAX_MOTORS
+          << "] are never commanded.\n";
+  }
+  this->channels.clear();
+  this->multipliers.clear();
+  this->offsets.clear();
+  this->cmdMins.clear();
+  this->cmdMaxs.clear();
+  this->maxChannel = -1;
+  for (size_t i = 0; i < this->commandCount; ++i)
+  {
+    this->channels.push_back(this->controls[i].channel);
+    this->multipliers.push_back(this->controls[i].multiplier);
+    this->offsets.push_back(this->controls[i].offset);
+    const double low = this->controls[i].multiplier *
+      (this->controls[i].offset - 1.0);
+    const double high = this->controls[i].multiplier *
+      (this->controls[i].offset + 1.0);
+    this->cmdMins.push_back(std::min(low, high));
+    this->cmdMaxs.push_back(std::max(low, high));
+    this->maxChannel = std::max(this->maxChannel, this->controls[i].channel);
+  }
 }
 
 /////////////////////////////////////////////////
 ArduPilotPlugin::~ArduPilotPlugin()
 {
+  ArduPilotTrace::Flush();
+  ArduPilotLog::Flush();
+  if (this->dataPtr->stepTiming)
+  {
+    gzmsg << "[" << this->dataPtr->modelName << "] step timing:\n"
+          << FormatStepTiming(this->dataPtr->phaseTiming);
+  }
+  const ArduPilotRoundTrip *roundTrip =
+    this->dataPtr->transport ? this->dataPtr->transport->RoundTrip() : nullptr;
+  if (roundTrip)
+  {
+    const ArduPilotRoundTrip::Summary rtt = roundTrip->Get();
+    if (rtt.count > 0)
+    {
+      gzmsg << "[" << this->dataPtr->modelName << "] "
+            << "state to servo round trip over the last " << rtt.count
+            << " of " << rtt.total << " exchanges, us: min [" << rtt.min
+            << "] p50 [" << rtt.p50 << "] p90 [" << rtt.p90
+            << "] p99 [" << rtt.p99 << "] max [" << rtt.max << "]\n";
+    }
+  }
+  if (!this->dataPtr->lockstep)
+  {
+    gzmsg << "[" << this->dataPtr->modelName << "] "
+          << "physics steps run on stale commands ["
+          << this->dataPtr->staleStepCount << "]\n";
+  }
+  if (this->dataPtr->protocol.Framed() || this->dataPtr->protocol.Json())
+  {
+    gzmsg << "[" << this->dataPtr->modelName << "] "
+          << "servo frames: gaps [" << this->dataPtr->protocol.Gaps()
+          << "] duplicates [" << this->dataPtr->protocol.Duplicates()
+          << "] reordered [" << this->dataPtr->protocol.Reordered()
+          << "] malformed [" << this->dataPtr->protocol.Mismatches()
+          << "]\n";
+  }
+  if (!this->dataPtr->fanout.Empty())
+  {
+    gzmsg << "[" << this->dataPtr->modelName << "] "
+          << "state copies dropped by <fdmMirror> ["
+          << this->dataPtr->fanout.DroppedCount() << "]\n";
+  }
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotPlugin::DrainedPacketCount() const
+{
+  if (!this->dataPtr->transport)
+  {
+    return 0;
+  }
+  return this->dataPtr->transport->DrainedPacketCount();
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotPlugin::RoundTripSummary(double &_p50Us, double &_p99Us,
+  double &_maxUs) const
+{
+  const ArduPilotRoundTrip *roundTrip =
+    this->dataPtr->transport ? this->dataPtr->transport->RoundTrip() : nullptr;
+  if (!roundTrip)
+  {
+    return false;
+  }
+  const ArduPilotRoundTrip::Summary rtt = roundTrip->Get();
+  _p50Us = rtt.p50;
+  _p99Us = rtt.p99;
+  _maxUs = rtt.max;
+  return rtt.count > 0;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotPlugin::StaleStepCount() const
+{
+  return this->dataPtr->staleStepCount;
+}
+
+/////////////////////////////////////////////////
+ArduPilotVehicleState ArduPilotPlugin::VehicleState() const
+{
+  std::lock_guard<std::mutex> lock(this->dataPtr->mutex);
+  // a consumer updated before this plugin's OnUpdate would otherwise get
+  // the snapshot of the previous step
+  if (this->dataPtr->stateValid && !ignition::math::equal(
+        this->dataPtr->state.timestamp,
+        this->dataPtr->model->GetWorld()->SimTime().Double(), 1e-9))
+  {
+    this->dataPtr->stateValid = false;
+  }
+  return this->dataPtr->Snapshot();
 }
 
 /////////////////////////////////////////////////
@@ -394,6 +868,7 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
 
   this->dataPtr->model = _model;
   this->dataPtr->modelName = this->dataPtr->model->GetName();
+  this->dataPtr->baseLink = this->dataPtr->model->GetLink();
 
   // modelXYZToAirplaneXForwardZDown brings us from gazebo model frame:
   // x-forward, y-right, z-down
@@ -414,6 +889,16 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
     this->gazeboXYZToNED = _sdf->Get<ignition::math::Pose3d>("gazeboXYZToNED");
   }
 
+  // Both transforms are constant, fold them once for Snapshot():
+  // (modelXYZToAirplaneXForwardZDown + worldPose) - gazeboXYZToNED
+  // has position worldToNED * (worldPos + worldRot * bodyOffset) - nedOrigin
+  // and rotation worldToNED * worldRot * bodyRotation.
+  this->dataPtr->worldToNED = this->gazeboXYZToNED.Rot().Inverse();
+  this->dataPtr->nedOrigin =
+    this->dataPtr->worldToNED.RotateVector(this->gazeboXYZToNED.Pos());
+  this->dataPtr->bodyOffset = this->modelXYZToAirplaneXForwardZDown.Pos();
+  this->dataPtr->bodyRotation = this->modelXYZToAirplaneXForwardZDown.Rot();
+
   // per control channel
   sdf::ElementPtr controlSDF;
   if (_sdf->HasElement("control"))
@@ -451,27 +936,41 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
              << control.channel << "].\n";
     }
 
+    std::string type = "VELOCITY";
     if (controlSDF->HasElement("type"))
     {
-      control.type = controlSDF->Get<std::string>("type");
+      type = controlSDF->Get<std::string>("type");
     }
     else
     {
       gzerr << "[" << this->dataPtr->modelName << "] "
             <<  "Control type not specified,"
             << " using velocity control by default.\n";
-      control.type = "VELOCITY";
     }
 
-    if (control.type != "VELOCITY" &&
-        control.type != "POSITION" &&
-        control.type != "EFFORT")
+    if (type == "POSITION")
+    {
+      control.type = CONTROL_POSITION;
+    }
+    else if (type == "EFFORT")
+    {
+      control.type = CONTROL_EFFORT;
+    }
+    else if (type == "VELOCITY")
+    {
+      control.type = CONTROL_VELOCITY;
+    }
+    else if (type == "ROTOR")
+    {
+      control.type = CONTROL_ROTOR;
+    }
+    else
     {
       gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "Control type [" << control.type
-             << "] not recognized, must be one of VELOCITY, POSITION, EFFORT."
-             << " default to VELOCITY.\n";
-      control.type = "VELOCITY";
+             << "Control type [" << type
+             << "] not recognized, must be one of VELOCITY, POSITION, EFFORT,"
+             << " ROTOR. default to VELOCITY.\n";
+      control.type = CONTROL_VELOCITY;
     }
 
     if (controlSDF->HasElement("useForce"))
@@ -479,25 +978,60 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
       control.useForce = controlSDF->Get<bool>("useForce");
     }
 
-    if (controlSDF->HasElement("jointName"))
+    if (control.type == CONTROL_ROTOR)
     {
-      control.jointName = controlSDF->Get<std::string>("jointName");
+      // No joint, the command is the rotor speed in rad/s and the motor
+      // model turns it into thrust and drag torque on the base link.
+      if (!control.motor.Load(controlSDF, this->dataPtr->modelName))
+      {
+        return;
+      }
+      if (!control.motor.HasThrust())
+      {
+        gzwarn << "[" << this->dataPtr->modelName << "] "
+               << "ROTOR control for channel [" << control.channel
+               << "] has no <thrustTable>, it produces no thrust.\n";
+      }
+      control.rotorPosition = controlSDF->Get("rotorPosition",
+        ignition::math::Vector3d::Zero).first;
+      control.rotorAxis = controlSDF->Get("rotorAxis",
+        ignition::math::Vector3d::UnitZ).first;
+      if (ignition::math::equal(control.rotorAxis.Length(), 0.0))
+      {
+        gzwarn << "[" << this->dataPtr->modelName << "] "
+               << "zero rotorAxis for channel [" << control.channel
+               << "], using 0 0 1.\n";
+        control.rotorAxis = ignition::math::Vector3d::UnitZ;
+      }
+      control.rotorAxis.Normalize();
+      control.visualName = controlSDF->Get("visualName",
+        static_cast<std::string>("")).first;
+      control.visualPose = controlSDF->Get("visualPose",
+        ignition::math::Pose3d(control.rotorPosition,
+        ignition::math::Quaterniond::Identity)).first;
     }
     else
     {
-      gzerr << "[" << this->dataPtr->modelName << "] "
-            << "Please specify a jointName,"
-            << " where the control channel is attached.\n";
-    }
+      if (controlSDF->HasElement("jointName"))
+      {
+        control.jointName = controlSDF->Get<std::string>("jointName");
+      }
+      else
+      {
+        gzerr << "[" << this->dataPtr->modelName << "] "
+              << "Please specify a jointName,"
+              << " where the control channel is attached.\n";
+      }
 
-    // Get the pointer to the joint.
-    control.joint = _model->GetJoint(control.jointName);
-    if (control.joint == nullptr)
-    {
-      gzerr << "[" << this->dataPtr->modelName << "] "
-            << "Couldn't find specified joint ["
-            << control.jointName << "]. This plugin will not run.\n";
-      return;
+      // Get the pointer to the joint.
+      control.joint = _model->GetJoint(control.jointName);
+      if (control.joint == nullptr)
+      {
+        gzerr << "[" << this->dataPtr->modelName << "] "
+              << "Couldn't find specified joint ["
+              << control.jointName << "]. This plugin will not run.\n";
+        return;
+      }
     }
 
     if (controlSDF->HasElement("multiplier"))
@@ -564,14 +1098,25 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
     control.samplingRate =
           controlSDF->Get("samplingRate", control.samplingRate).first;
 
-    // use gazebo::math::Filter
-    control.filter.Fc(control.frequencyCutoff, control.samplingRate);
-
-    // initialize filter to zero value
-    control.filter.Set(0.0);
-
-    // note to use this filter, do
-    // stateFiltered = filter.Process(stateRaw);
+    // The velocity filter is stepped once per physics update, so its
+    // coefficients must use the physics rate, not a free sdf value.
+    const double maxStep =
+      _model->GetWorld()->Physics()->GetMaxStepSize();
+    if (maxStep > 0.0)
+    {
+      const double stepRate = 1.0 / maxStep;
+      if (controlSDF->HasElement("samplingRate") &&
+          !ignition::math::equal(control.samplingRate, stepRate,
+                                 1e-3 * stepRate))
+      {
+        gzwarn << "[" << this->dataPtr->modelName << "] "
+               << "control for joint [" << control.jointName
+               << "] samplingRate [" << control.samplingRate
+               << "] differs from the physics rate [" << stepRate
+               << "], using the physics rate.\n";
+      }
+      control.samplingRate = stepRate;
+    }
 
     // Overload the PID parameters if they are available.
     double param;
@@ -625,208 +1170,197 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
     this->dataPtr->controls.push_back(control);
     controlSDF = controlSDF->GetNextElement("control");
   }
+  this->dataPtr->CompileControls();
 
-  // Get sensors
-  std::string imuName =
-    _sdf->Get("imuName", static_cast<std::string>("imu_sensor")).first;
-  std::vector<std::string> imuScopedName =
-    this->dataPtr->model->SensorScopedName(imuName);
-
-  if (imuScopedName.size() > 1)
+  // Get sensors, or compute the IMU in the plugin without any sensor
+  this->dataPtr->syntheticImu = _sdf->Get("imuSynthetic", false).first;
+  if (this->dataPtr->syntheticImu)
   {
-    gzwarn << "[" << this->dataPtr->modelName << "] "
-           << "multiple names match [" << imuName << "] using first found"
-           << " name.\n";
-    for (unsigned k = 0; k < imuScopedName.size(); ++k)
+    if (!this->dataPtr->imu.Load(_sdf, this->dataPtr->model,
+          this->modelXYZToAirplaneXForwardZDown.Rot()))
     {
-      gzwarn << "  sensor " << k << " [" << imuScopedName[k] << "].\n";
+      return;
     }
   }
-
-  if (imuScopedName.size() > 0)
+  else
   {
-    this->dataPtr->imuSensor = std::dynamic_pointer_cast<sensors::ImuSensor>
-      (sensors::SensorManager::Instance()->GetSensor(imuScopedName[0]));
-  }
+    std::string imuName =
+      _sdf->Get("imuName", static_cast<std::string>("imu_sensor")).first;
+    std::vector<std::string> imuScopedName =
+      this->dataPtr->model->SensorScopedName(imuName);
 
-  if (!this->dataPtr->imuSensor)
-  {
     if (imuScopedName.size() > 1)
     {
       gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "first imu_sensor scoped name [" << imuScopedName[0]
-             << "] not found, trying the rest of the sensor names.\n";
-      for (unsigned k = 1; k < imuScopedName.size(); ++k)
+             << "multiple names match [" << imuName << "] using first found"
+             << " name.\n";
+      for (unsigned k = 0; k < imuScopedName.size(); ++k)
       {
-        this->dataPtr->imuSensor = std::dynamic_pointer_cast<sensors::ImuSensor>
-          (sensors::SensorManager::Instance()->GetSensor(imuScopedName[k]));
-        if (this->dataPtr->imuSensor)
-        {
-          gzwarn << "found [" << imuScopedName[k] << "]\n";
-          break;
-        }
+        gzwarn << "  sensor " << k << " [" << imuScopedName[k] << "].\n";
       }
     }
 
-    if (!this->dataPtr->imuSensor)
+    if (imuScopedName.size() > 0)
     {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "imu_sensor scoped name [" << imuName
-             << "] not found, trying unscoped name.\n" << "\n";
-      // TODO: this fails for multi-nested models.
-      // TODO: and transforms fail for rotated nested model,
-      //       joints point the wrong way.
       this->dataPtr->imuSensor = std::dynamic_pointer_cast<sensors::ImuSensor>
-        (sensors::SensorManager::Instance()->GetSensor(imuName));
+        (sensors::SensorManager::Instance()->GetSensor(imuScopedName[0]));
     }
 
     if (!this->dataPtr->imuSensor)
     {
-      gzerr << "[" << this->dataPtr->modelName << "] "
-            << "imu_sensor [" << imuName
-            << "] not found, abort ArduPilot plugin.\n" << "\n";
-      return;
-    }
-  }
-/* NOT MERGED IN MASTER YET
-    // Get GPS
-  std::string gpsName = _sdf->Get("imuName", static_cast<std::string>("gps_sensor")).first;
-  std::vector<std::string> gpsScopedName = SensorScopedName(this->dataPtr->model, gpsName);
-  if (gpsScopedName.size() > 1)
-  {
-    gzwarn << "[" << this->dataPtr->modelName << "] "
-           << "multiple names match [" << gpsName << "] using first found"
-           << " name.\n";
-    for (unsigned k = 0; k < gpsScopedName.size(); ++k)
-    {
-      gzwarn << "  sensor " << k << " [" << gpsScopedName[k] << "].\n";
-    }
-  }
-
-  if (gpsScopedName.size() > 0)
-  {
-    this->dataPtr->gpsSensor = std::dynamic_pointer_cast<sensors::GpsSensor>
-      (sensors::SensorManager::Instance()->GetSensor(gpsScopedName[0]));
-  }
-
-  if (!this->dataPtr->gpsSensor)
-  {
-    if (gpsScopedName.size() > 1)
-    {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "first gps_sensor scoped name [" << gpsScopedName[0]
-             << "] not found, trying the rest of the sensor names.\n";
-      for (unsigned k = 1; k < gpsScopedName.size(); ++k)
+      if (imuScopedName.size() > 1)
       {
-        this->dataPtr->gpsSensor = std::dynamic_pointer_cast<sensors::GpsSensor>
-          (sensors::SensorManager::Instance()->GetSensor(gpsScopedName[k]));
-        if (this->dataPtr->gpsSensor)
+        gzwarn << "[" << this->dataPtr->modelName << "] "
+               << "first imu_sensor scoped name [" << imuScopedName[0]
+               << "] not found, trying the rest of the sensor names.\n";
+        for (unsigned k = 1; k < imuScopedName.size(); ++k)
         {
-          gzwarn << "found [" << gpsScopedName[k] << "]\n";
-          break;
+          this->dataPtr->imuSensor =
+            std::dynamic_pointer_cast<sensors::ImuSensor>(
+              sensors::SensorManager::Instance()->GetSensor(
+                imuScopedName[k]));
+          if (this->dataPtr->imuSensor)
+          {
+            gzwarn << "found [" << imuScopedName[k] << "]\n";
+            break;
+          }
         }
       }
-    }
 
-    if (!this->dataPtr->gpsSensor)
-    {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "gps_sensor scoped name [" << gpsName
-             << "] not found, trying unscoped name.\n" << "\n";
-      this->dataPtr->gpsSensor = std::dynamic_pointer_cast<sensors::GpsSensor>
-        (sensors::SensorManager::Instance()->GetSensor(gpsName));
-    }
+      if (!this->dataPtr->imuSensor)
+      {
+        gzwarn << "[" << this->dataPtr->modelName << "] "
+               << "imu_sensor scoped name [" << imuName
+               << "] not found, trying unscoped name.\n" << "\n";
+        // TODO: this fails for multi-nested models.
+        // TODO: and transforms fail for rotated nested model,
+        //       joints point the wrong way.
+        this->dataPtr->imuSensor = std::dynamic_pointer_cast<sensors::ImuSensor>
+          (sensors::SensorManager::Instance()->GetSensor(imuName));
+      }
 
-    if (!this->dataPtr->gpsSensor)
-    {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "gps [" << gpsName
-             << "] not found, skipping gps support.\n" << "\n";
-    }
-    else
-    {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "  found "  << " [" << gpsName << "].\n";
+      if (!this->dataPtr->imuSensor)
+      {
+        gzerr << "[" << this->dataPtr->modelName << "] "
+              << "imu_sensor [" << imuName
+              << "] not found, abort ArduPilot plugin.\n" << "\n";
+        return;
+      }
     }
   }
 
-  // Get Rangefinder
-  // TODO add sonar
-  std::string rangefinderName = _sdf->Get("rangefinderName",
-    static_cast<std::string>("rangefinder_sensor")).first;
-  std::vector<std::string> rangefinderScopedName = SensorScopedName(this->dataPtr->model, rangefinderName);
-  if (rangefinderScopedName.size() > 1)
+  // Controller time control.
+  this->dataPtr->lastControllerUpdateTime = 0;
+
+  if (!this->dataPtr->protocol.Load(_sdf, this->dataPtr->modelName) ||
+      !this->dataPtr->fdmExtensions.Load(_sdf, this->dataPtr->model,
+        this->dataPtr->protocol.ExtensionFields()))
   {
-    gzwarn << "[" << this->dataPtr->modelName << "] "
-           << "multiple names match [" << rangefinderName << "] using first found"
-           << " name.\n";
-    for (unsigned k = 0; k < rangefinderScopedName.size(); ++k)
-    {
-      gzwarn << "  sensor " << k << " [" << rangefinderScopedName[k] << "].\n";
-    }
+    return;
   }
 
-  if (rangefinderScopedName.size() > 0)
+  // Initialise ardupilot sockets
+  if (!InitArduPilotSockets(_sdf))
   {
-    this->dataPtr->rangefinderSensor = std::dynamic_pointer_cast<sensors::RaySensor>
-      (sensors::SensorManager::Instance()->GetSensor(rangefinderScopedName[0]));
+    return;
   }
 
-  if (!this->dataPtr->rangefinderSensor)
+  this->dataPtr->lockstepWait.Load(_sdf);
+  this->dataPtr->realtime.Load(_sdf, this->dataPtr->modelName);
+
+  // Wall time between two non-blocking probes for ArduPilot while it is
+  // offline, doubling from the min to the max
+  this->dataPtr->probeMinInterval = std::chrono::microseconds(
+    _sdf->Get("offlineProbeMinUs", 1000).first);
+  this->dataPtr->probeMaxInterval = std::max(
+    this->dataPtr->probeMinInterval,
+    std::chrono::steady_clock::duration(std::chrono::microseconds(
+      _sdf->Get("offlineProbeMaxUs", 20000).first)));
+  this->dataPtr->GoOffline();
+
+  // Missed update count before we declare ArduPilot offline
+  this->dataPtr->connectionTimeoutMaxCount =
+    _sdf->Get("connectionTimeoutMaxCount", 10).first;
+
+  this->dataPtr->traceVehicle =
+    ArduPilotTrace::Intern(this->dataPtr->modelName);
+
+  // Per-phase step timing, published on ~/<model>/step_timing
+  this->dataPtr->stepTiming = _sdf->Get("stepTiming", false).first;
+  if (this->dataPtr->stepTiming)
+  {
+    this->dataPtr->stepTimingPeriod =
+      _sdf->Get("stepTimingPeriod", 1.0).first;
+    this->dataPtr->node = transport::NodePtr(new transport::Node());
+    this->dataPtr->node->Init(this->dataPtr->model->GetWorld()->Name());
+    this->dataPtr->stepTimingPub =
+      this->dataPtr->node->Advertise<gazebo::msgs::GzString>(
+        std::string("~/") + this->dataPtr->model->GetName() + "/step_timing");
+  }
+
+  // Prop visuals of the virtual rotors, spun for display only
+  if (!this->dataPtr->virtualRotors.visuals.empty())
   {
-    if (rangefinderScopedName.size() > 1)
+    this->dataPtr->virtualRotors.visualPeriod =
+      1.0 / _sdf->Get("rotorVisualRate", 30.0).first;
+    if (!this->dataPtr->node)
     {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "first rangefinder_sensor scoped name [" << rangefinderScopedName[0]
-             << "] not found, trying the rest of the sensor names.\n";
-      for (unsigned k = 1; k < rangefinderScopedName.size(); ++k)
-      {
-        this->dataPtr->rangefinderSensor = std::dynamic_pointer_cast<sensors::RaySensor>
-          (sensors::SensorManager::Instance()->GetSensor(rangefinderScopedName[k]));
-        if (this->dataPtr->rangefinderSensor)
-        {
-          gzwarn << "found [" << rangefinderScopedName[k] << "]\n";
-          break;
-        }
-      }
+      this->dataPtr->node = transport::NodePtr(new transport::Node());
+      this->dataPtr->node->Init(this->dataPtr->model->GetWorld()->Name());
     }
+    this->dataPtr->virtualRotors.visualPub =
+      this->dataPtr->node->Advertise<gazebo::msgs::Visual>("~/visual");
+  }
 
-    if (!this->dataPtr->rangefinderSensor)
+  // Free-running mode, never wait for ArduPilot
+  this->dataPtr->lockstep = _sdf->Get("lockstep", true).first;
+  if (!this->dataPtr->lockstep)
+  {
+    const std::string extrapolation = _sdf->Get("commandExtrapolation",
+      static_cast<std::string>("hold")).first;
+    if (extrapolation == "linear")
     {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "rangefinder_sensor scoped name [" << rangefinderName
-             << "] not found, trying unscoped name.\n" << "\n";
-      /// TODO: this fails for multi-nested models.
-      /// TODO: and transforms fail for rotated nested model,
-      ///       joints point the wrong way.
-      this->dataPtr->rangefinderSensor = std::dynamic_pointer_cast<sensors::RaySensor>
-        (sensors::SensorManager::Instance()->GetSensor(rangefinderName));
+      this->dataPtr->extrapolate = true;
     }
-    if (!this->dataPtr->rangefinderSensor)
+    else if (extrapolation != "hold")
     {
       gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "ranfinder [" << rangefinderName
-             << "] not found, skipping rangefinder support.\n" << "\n";
+             << "unknown commandExtrapolation [" << extrapolation
+             << "], must be one of hold, linear. holding commands.\n";
     }
-    else
+    this->dataPtr->maxCommandAge = 1e-3 *
+      _sdf->Get("maxCommandAgeMs", 1e3 * this->dataPtr->maxCommandAge).first;
+    this->dataPtr->connectionTimeout = std::chrono::milliseconds(
+      _sdf->Get("connectionTimeoutMs", 1000).first);
+    gzmsg << "[" << this->dataPtr->modelName << "] "
+          << "free-running, not in lockstep with ArduPilot.\n";
+  }
+
+  // Decimate the lockstep exchange, either as a step count or as a rate
+  // relative to the physics update rate
+  int exchangeEveryNSteps = _sdf->Get("exchangeEveryNSteps", 1).first;
+  if (_sdf->HasElement("exchangeRate"))
+  {
+    const double exchangeRate = _sdf->Get<double>("exchangeRate");
+    const double stepSize =
+      this->dataPtr->model->GetWorld()->Physics()->GetMaxStepSize();
+    if (exchangeRate > 0.0 && stepSize > 0.0)
     {
-      gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "  found "  << " [" << rangefinderName << "].\n";
+      exchangeEveryNSteps = static_cast<int>(
+        std::round(1.0 / (stepSize * exchangeRate)));
     }
   }
-*/
-  // Controller time control.
-  this->dataPtr->lastControllerUpdateTime = 0;
-
-  // Initialise ardupilot sockets
-  if (!InitArduPilotSockets(_sdf))
+  if (exchangeEveryNSteps < 1)
   {
-    return;
+    exchangeEveryNSteps = 1;
+  }
+  this->dataPtr->exchangeEveryNSteps = exchangeEveryNSteps;
+  if (exchangeEveryNSteps > 1)
+  {
+    gzmsg << "[" << this->dataPtr->modelName << "] "
+          << "exchanging with ArduPilot every " << exchangeEveryNSteps
+          << " physics steps.\n";
   }
-
-  // Missed update count before we declare arduPilotOnline status false
-  this->dataPtr->connectionTimeoutMaxCount =
-    _sdf->Get("connectionTimeoutMaxCount", 10).first;
 
   // Listen to the update event. This event is broadcast every simulation
   // iteration.
@@ -840,21 +1374,99 @@ void ArduPilotPlugin::Load(physics::ModelPtr _model, sdf::ElementPtr _sdf)
 /////////////////////////////////////////////////
 void ArduPilotPlugin::OnUpdate()
 {
-  std::lock_guard<std::mutex> lock(this->dataPtr->mutex);
+  if (!this->dataPtr->realtimeApplied)
+  {
+    this->dataPtr->realtime.ApplyToThread("physics thread");
+    this->dataPtr->realtimeApplied = true;
+  }
 
   const gazebo::common::Time curTime =
     this->dataPtr->model->GetWorld()->SimTime();
+  this->dataPtr->traceSimTime = curTime.Double();
+  ArduPilotTraceScope trace("ArduPilotPlugin::OnUpdate",
+    this->dataPtr->traceVehicle, this->dataPtr->traceSimTime);
+
+  const bool timing = this->dataPtr->stepTiming;
+  int64_t start = timing ? TimingNow() : 0;
+  std::lock_guard<std::mutex> lock(this->dataPtr->mutex);
+  if (timing)
+  {
+    const int64_t now = TimingNow();
+    this->dataPtr->phaseTiming[PHASE_LOCK].Record(now - start);
+    start = now;
+  }
 
   // Update the control surfaces and publish the new state.
   if (curTime > this->dataPtr->lastControllerUpdateTime)
   {
-    this->ReceiveMotorCommand();
-    if (this->dataPtr->arduPilotOnline)
+    const double dt =
+      (curTime - this->dataPtr->lastControllerUpdateTime).Double();
+    this->dataPtr->stateValid = false;
+    // the synthetic imu differences velocities across each physics step,
+    // whether or not the state is sent on this one
+    if (this->dataPtr->syntheticImu)
     {
-      this->ApplyMotorForces((curTime -
-        this->dataPtr->lastControllerUpdateTime).Double());
-      this->SendState();
+      this->dataPtr->imu.Update(dt);
+    }
+    // Exchange with ArduPilot only on every Nth step once it is online,
+    // the last command is held and forces applied on every step.
+    const bool exchange =
+      this->dataPtr->connectionState != CONNECTION_ONLINE ||
+      ++this->dataPtr->stepsSinceExchange >=
+        this->dataPtr->exchangeEveryNSteps;
+    if (exchange)
+    {
+      this->dataPtr->stepsSinceExchange = 0;
+      this->ReceiveMotorCommand();
+      if (timing)
+      {
+        const int64_t now = TimingNow();
+        this->dataPtr->phaseTiming[PHASE_WAIT].Record(this->dataPtr->waitNs);
+        this->dataPtr->phaseTiming[PHASE_COMMAND].Record(
+          std::max<int64_t>(0, now - start - this->dataPtr->waitNs));
+        start = now;
+      }
     }
+    if (this->dataPtr->connectionState == CONNECTION_ONLINE)
+    {
+      // free-running mode counts and extrapolates every physics step that
+      // got no new command, exchange step or not
+      if (!this->dataPtr->lockstep && !this->dataPtr->commandFresh)
+      {
+        this->HoldStaleCommands();
+      }
+      this->dataPtr->commandFresh = false;
+      this->ApplyMotorForces(dt);
+      if (timing)
+      {
+        const int64_t now = TimingNow();
+        this->dataPtr->phaseTiming[PHASE_FORCES].Record(now - start);
+        start = now;
+      }
+      if (exchange)
+      {
+        this->SendState();
+        if (timing)
+        {
+          this->dataPtr->phaseTiming[PHASE_SEND].Record(TimingNow() - start);
+        }
+      }
+    }
+  }
+  else if (curTime < this->dataPtr->lastControllerUpdateTime &&
+           this->dataPtr->syntheticImu)
+  {
+    // world reset, the last velocities are from before it
+    this->dataPtr->imu.Reset();
+  }
+
+  if (timing && curTime - this->dataPtr->lastStepTimingPublish >=
+      this->dataPtr->stepTimingPeriod)
+  {
+    this->dataPtr->lastStepTimingPublish = curTime;
+    gazebo::msgs::GzString msg;
+    msg.set_data(FormatStepTiming(this->dataPtr->phaseTiming));
+    this->dataPtr->stepTimingPub->Publish(msg);
   }
 
   this->dataPtr->lastControllerUpdateTime = curTime;
@@ -864,276 +1476,435 @@ void ArduPilotPlugin::OnUpdate()
 void ArduPilotPlugin::ResetPIDs()
 {
   // Reset velocity PID for controls
-  for (size_t i = 0; i < this->dataPtr->controls.size(); ++i)
-  {
-    this->dataPtr->controls[i].cmd = 0;
-    // this->dataPtr->controls[i].pid.Reset();
-  }
+  std::fill(this->dataPtr->cmds.begin(), this->dataPtr->cmds.end(), 0.0);
+  // this->dataPtr->pidBank.Reset();
 }
 
 /////////////////////////////////////////////////
 bool ArduPilotPlugin::InitArduPilotSockets(sdf::ElementPtr _sdf) const
 {
-  this->dataPtr->fdm_addr =
-    _sdf->Get("fdm_addr", static_cast<std::string>("127.0.0.1")).first;
-  this->dataPtr->listen_addr =
-    _sdf->Get("listen_addr", static_cast<std::string>("127.0.0.1")).first;
-  this->dataPtr->fdm_port_in =
-    _sdf->Get("fdm_port_in", static_cast<uint32_t>(9007)).first;
-  this->dataPtr->fdm_port_out =
-    _sdf->Get("fdm_port_out", static_cast<uint32_t>(9006)).first;
-
-  if (!this->dataPtr->socket_in.Bind(this->dataPtr->listen_addr.c_str(),
-      this->dataPtr->fdm_port_in))
+  this->dataPtr->transport = ArduPilotTransport::Create(_sdf);
+  if (!this->dataPtr->transport)
   {
     gzerr << "[" << this->dataPtr->modelName << "] "
-          << "failed to bind with " << this->dataPtr->listen_addr
-          << ":" << this->dataPtr->fdm_port_in << " aborting plugin.\n";
+          << "unknown transport ["
+          << _sdf->Get<std::string>("transport")
+          << "], must be one of udp, shm. aborting plugin.\n";
     return false;
   }
 
-  if (!this->dataPtr->socket_out.Connect(this->dataPtr->fdm_addr.c_str(),
-      this->dataPtr->fdm_port_out))
+  return this->dataPtr->transport->Open(_sdf, this->dataPtr->modelName) &&
+    this->dataPtr->fanout.Load(_sdf, this->dataPtr->modelName);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotPluginPrivate::ApplyVirtualRotors(const double _dt,
+  double *_velocities)
+{
+  VirtualRotors &rotors = this->virtualRotors;
+  if (rotors.index.empty())
   {
-    gzerr << "[" << this->dataPtr->modelName << "] "
-          << "failed to bind with " << this->dataPtr->fdm_addr
-          << ":" << this->dataPtr->fdm_port_out << " aborting plugin.\n";
-    return false;
+    return;
+  }
+
+  // sum every rotor into one force and one torque at the center of mass,
+  // thrust along the axis and drag torque against the spin
+  ignition::math::Vector3d force;
+  ignition::math::Vector3d torque;
+  for (size_t i = 0; i < rotors.index.size(); ++i)
+  {
+    const unsigned int c = rotors.index[i];
+    const ArduPilotMotorModel &motor = rotors.motors[i];
+    double &speed = rotors.speeds[i];
+    speed += (this->cmds[c] - speed) * motor.LagFactor(_dt);
+    _velocities[c] = speed;
+
+    const double rate = std::fabs(speed);
+    const ignition::math::Vector3d thrust = rotors.axes[i] * motor.Thrust(rate);
+    force += thrust;
+    torque += rotors.arms[i].Cross(thrust) -
+      rotors.axes[i] * std::copysign(motor.Torque(rate), speed);
+  }
+  rotors.link->AddRelativeForce(force);
+  rotors.link->AddRelativeTorque(torque);
+
+  if (rotors.visualPub)
+  {
+    this->PublishRotorVisuals(_dt);
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotPluginPrivate::PublishRotorVisuals(const double _dt)
+{
+  VirtualRotors &rotors = this->virtualRotors;
+  for (size_t i = 0; i < rotors.visuals.size(); ++i)
+  {
+    rotors.visualAngles[i] = std::remainder(rotors.visualAngles[i] +
+      rotors.speeds[rotors.visuals[i]] * rotors.visualScales[i] * _dt,
+      2.0 * IGN_PI);
+  }
+
+  const common::Time now = this->model->GetWorld()->SimTime();
+  if (now - rotors.lastVisualPublish < rotors.visualPeriod)
+  {
+    return;
   }
+  rotors.lastVisualPublish = now;
 
-  return true;
+  const std::string parentName = rotors.link->GetScopedName();
+  for (size_t i = 0; i < rotors.visuals.size(); ++i)
+  {
+    const ignition::math::Pose3d &rest = rotors.visualPoses[i];
+    const ignition::math::Quaterniond spin(
+      rotors.axes[rotors.visuals[i]], rotors.visualAngles[i]);
+    msgs::Visual msg;
+    msg.set_name(rotors.visualNames[i]);
+    msg.set_parent_name(parentName);
+    msgs::Set(msg.mutable_pose(),
+      ignition::math::Pose3d(rest.Pos(), spin * rest.Rot()));
+    rotors.visualPub->Publish(msg);
+  }
+}
+
+/////////////////////////////////////////////////
+double ArduPilotPluginPrivate::MotorPower() const
+{
+  double power = 0.0;
+  for (physics::Joint *joint : this->joints)
+  {
+    power += std::fabs(joint->GetForce(0) * joint->GetVelocity(0));
+  }
+  const VirtualRotors &rotors = this->virtualRotors;
+  for (size_t i = 0; i < rotors.index.size(); ++i)
+  {
+    const double rate = std::fabs(rotors.speeds[i]);
+    power += rotors.motors[i].Torque(rate) * rate;
+  }
+  return power;
 }
 
 /////////////////////////////////////////////////
 void ArduPilotPlugin::ApplyMotorForces(const double _dt)
 {
-  // update velocity PID for controls and apply force to joint
-  for (size_t i = 0; i < this->dataPtr->controls.size(); ++i)
+  ArduPilotTraceScope trace("ArduPilotPlugin::ApplyMotorForces",
+    this->dataPtr->traceVehicle, this->dataPtr->traceSimTime);
+
+  const double *cmds = this->dataPtr->cmds.data();
+
+  // joint velocity of every control, low-passed for the ESC rpm in one
+  // pass and read raw by the velocity PIDs
+  double *velocities = this->dataPtr->velocityFilter.Inputs();
+  for (size_t i = 0; i < this->dataPtr->joints.size(); ++i)
+  {
+    velocities[this->dataPtr->jointControls[i]] =
+      this->dataPtr->joints[i]->GetVelocity(0);
+  }
+  this->dataPtr->ApplyVirtualRotors(_dt, velocities);
+  this->dataPtr->velocityFilter.Process();
+
+  // update velocity and position PIDs for controls in one pass and apply
+  // force to joint, one loop per mode
+  const ControlGroup &velocityPid =
+    this->dataPtr->controlGroups[MODE_VELOCITY_PID];
+  const ControlGroup &positionPid =
+    this->dataPtr->controlGroups[MODE_POSITION_PID];
+  const size_t velocityCount = velocityPid.index.size();
+  if (this->dataPtr->pidBank.Size() > 0)
   {
-    if (this->dataPtr->controls[i].useForce)
+    double *errors = this->dataPtr->pidBank.Errors();
+    for (size_t i = 0; i < velocityCount; ++i)
     {
-      if (this->dataPtr->controls[i].type == "VELOCITY")
-      {
-        const double velTarget = this->dataPtr->controls[i].cmd /
-          this->dataPtr->controls[i].rotorVelocitySlowdownSim;
-        const double vel = this->dataPtr->controls[i].joint->GetVelocity(0);
-        const double error = vel - velTarget;
-        const double force = this->dataPtr->controls[i].pid.Update(error, _dt);
-        this->dataPtr->controls[i].joint->SetForce(0, force);
-      }
-      else if (this->dataPtr->controls[i].type == "POSITION")
-      {
-        const double posTarget = this->dataPtr->controls[i].cmd;
-        const double pos = this->dataPtr->controls[i].joint->Position();
-        const double error = pos - posTarget;
-        const double force = this->dataPtr->controls[i].pid.Update(error, _dt);
-        this->dataPtr->controls[i].joint->SetForce(0, force);
-      }
-      else if (this->dataPtr->controls[i].type == "EFFORT")
-      {
-        const double force = this->dataPtr->controls[i].cmd;
-        this->dataPtr->controls[i].joint->SetForce(0, force);
-      }
-      else
-      {
-        // do nothing
-      }
+      const double velTarget = cmds[velocityPid.index[i]] /
+        velocityPid.divisors[i];
+      errors[i] = velocities[velocityPid.index[i]] - velTarget;
     }
-    else
+    for (size_t i = 0; i < positionPid.index.size(); ++i)
     {
-      if (this->dataPtr->controls[i].type == "VELOCITY")
-      {
-        this->dataPtr->controls[i].joint->SetVelocity(0, this->dataPtr->controls[i].cmd);
-      }
-      else if (this->dataPtr->controls[i].type == "POSITION")
-      {
-        this->dataPtr->controls[i].joint->SetPosition(0, this->dataPtr->controls[i].cmd);
-      }
-      else if (this->dataPtr->controls[i].type == "EFFORT")
-      {
-        const double force = this->dataPtr->controls[i].cmd;
-        this->dataPtr->controls[i].joint->SetForce(0, force);
-      }
-      else
-      {
-        // do nothing
-      }
+      const double posTarget = cmds[positionPid.index[i]];
+      errors[velocityCount + i] = positionPid.joints[i]->Position() -
+        posTarget;
+    }
+
+    // step rounded to nanoseconds, as common::PID::Update gets it
+    const double *forces =
+      this->dataPtr->pidBank.Update(common::Time(_dt).Double());
+    for (size_t i = 0; i < velocityCount; ++i)
+    {
+      velocityPid.joints[i]->SetForce(0, forces[i]);
+    }
+    for (size_t i = 0; i < positionPid.index.size(); ++i)
+    {
+      positionPid.joints[i]->SetForce(0, forces[velocityCount + i]);
     }
   }
+
+  const ControlGroup &effort = this->dataPtr->controlGroups[MODE_EFFORT];
+  for (size_t i = 0; i < effort.index.size(); ++i)
+  {
+    effort.joints[i]->SetForce(0, cmds[effort.index[i]]);
+  }
+
+  const ControlGroup &setVelocity =
+    this->dataPtr->controlGroups[MODE_SET_VELOCITY];
+  for (size_t i = 0; i < setVelocity.index.size(); ++i)
+  {
+    setVelocity.joints[i]->SetVelocity(0, cmds[setVelocity.index[i]]);
+  }
+
+  const ControlGroup &setPosition =
+    this->dataPtr->controlGroups[MODE_SET_POSITION];
+  for (size_t i = 0; i < setPosition.index.size(); ++i)
+  {
+    setPosition.joints[i]->SetPosition(0, cmds[setPosition.index[i]]);
+  }
 }
 
 /////////////////////////////////////////////////
 void ArduPilotPlugin::ReceiveMotorCommand()
 {
-  // Added detection for whether ArduPilot is online or not.
-  // If ArduPilot is detected (receive of fdm packet from someone),
-  // then socket receive wait time is increased from 1ms to 1 sec
-  // to accomodate network jitter.
-  // If ArduPilot is not detected, receive call blocks for 1ms
-  // on each call.
-  // Once ArduPilot presence is detected, it takes this many
-  // missed receives before declaring the FCS offline.
-
-  ServoPacket pkt;
-  uint32_t waitMs;
-  if (this->dataPtr->arduPilotOnline)
-  {
-    // increase timeout for receive once we detect a packet from
-    // ArduPilot FCS.
-    waitMs = 1000;
+  ArduPilotTraceScope trace("ArduPilotPlugin::ReceiveMotorCommand",
+    this->dataPtr->traceVehicle, this->dataPtr->traceSimTime);
+
+  const int64_t waitStart = this->dataPtr->stepTiming ? TimingNow() : 0;
+  ssize_t recvSize = -1;
+  const ServoPacket *newest = nullptr;
+  if (this->dataPtr->connectionState != CONNECTION_ONLINE)
+  {
+    // While ArduPilot is offline never wait for it: probe without blocking,
+    // backing off exponentially, and go online on the first packet.
+    const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    if (now < this->dataPtr->nextProbe)
+    {
+      this->dataPtr->waitNs = 0;
+      return;
+    }
+    this->dataPtr->connectionState = CONNECTION_PROBING;
+    newest = this->dataPtr->transport->ReceiveLatest(0, recvSize);
+    if (!newest)
+    {
+      this->dataPtr->ProbeFailed();
+    }
   }
   else
   {
-    // Otherwise skip quickly and do not set control force.
-    waitMs = 1;
+    // Wait for ArduPilot according to the <lockstepWait> policy. It takes
+    // connectionTimeoutMaxCount missed receives before declaring the FCS
+    // offline. In free-running mode only take what has already arrived.
+    newest = this->dataPtr->lockstep ?
+      this->dataPtr->lockstepWait.Receive(
+        *this->dataPtr->transport, recvSize) :
+      this->dataPtr->transport->ReceiveLatest(0, recvSize);
+  }
+  if (this->dataPtr->stepTiming)
+  {
+    this->dataPtr->waitNs = TimingNow() - waitStart;
   }
-  ssize_t recvSize =
-    this->dataPtr->socket_in.Recv(&pkt, sizeof(ServoPacket), waitMs);
 
-  // Drain the socket in the case we're backed up
-  int counter = 0;
-  ServoPacket last_pkt;
-  while (true)
+  if (!newest && this->dataPtr->connectionState != CONNECTION_ONLINE)
   {
-    // last_pkt = pkt;
-    const ssize_t recvSize_last =
-      this->dataPtr->socket_in.Recv(&last_pkt, sizeof(ServoPacket), 0ul);
-    if (recvSize_last == -1)
-    {
-      break;
-    }
-    counter++;
-    pkt = last_pkt;
-    recvSize = recvSize_last;
+    // still offline, probe again later
   }
-  if (counter > 0)
+  else if (!newest && !this->dataPtr->lockstep)
   {
-    gzdbg << "[" << this->dataPtr->modelName << "] "
-          << "Drained n packets: " << counter << std::endl;
+    // connection timeout counts wall time, steps no longer wait
+    if (std::chrono::steady_clock::now() -
+        this->dataPtr->lastPacketWallTime > this->dataPtr->connectionTimeout)
+    {
+      this->dataPtr->GoOffline();
+      gzwarn << "[" << this->dataPtr->modelName << "] "
+             << "Broken ArduPilot connection, resetting motor control.\n";
+      this->ResetPIDs();
+    }
   }
-
-  if (recvSize == -1)
+  else if (!newest)
   {
     // didn't receive a packet
     // gzdbg << "no packet\n";
-    gazebo::common::Time::NSleep(100);
-    if (this->dataPtr->arduPilotOnline)
+    if (this->dataPtr->lockstepWait.MissSleepNs() > 0)
+    {
+      gazebo::common::Time::NSleep(this->dataPtr->lockstepWait.MissSleepNs());
+    }
+    apwarn(1000) << "[" << this->dataPtr->modelName << "] "
+                 << "Broken ArduPilot connection, count ["
+                 << this->dataPtr->connectionTimeoutCount
+                 << "/" << this->dataPtr->connectionTimeoutMaxCount
+                 << "]\n";
+    if (++this->dataPtr->connectionTimeoutCount >
+      this->dataPtr->connectionTimeoutMaxCount)
     {
+      this->dataPtr->GoOffline();
       gzwarn << "[" << this->dataPtr->modelName << "] "
-             << "Broken ArduPilot connection, count ["
-             << this->dataPtr->connectionTimeoutCount
-             << "/" << this->dataPtr->connectionTimeoutMaxCount
-             << "]\n";
-      if (++this->dataPtr->connectionTimeoutCount >
-        this->dataPtr->connectionTimeoutMaxCount)
-      {
-        this->dataPtr->connectionTimeoutCount = 0;
-        this->dataPtr->arduPilotOnline = false;
-        gzwarn << "[" << this->dataPtr->modelName << "] "
-               << "Broken ArduPilot connection, resetting motor control.\n";
-        this->ResetPIDs();
-      }
+             << "Broken ArduPilot connection, resetting motor control.\n";
+      this->ResetPIDs();
     }
   }
   else
   {
-    const ssize_t expectedPktSize =
-    sizeof(pkt.motorSpeed[0]) * this->dataPtr->controls.size();
-    if (recvSize < expectedPktSize)
+    const float *motorSpeed = nullptr;
+    const ssize_t recvChannels =
+      this->dataPtr->protocol.DecodeServo(*newest, recvSize, motorSpeed);
+    if (recvChannels < 0)
     {
-      gzerr << "[" << this->dataPtr->modelName << "] "
-            << "got less than model needs. Got: " << recvSize
-            << "commands, expected size: " << expectedPktSize << "\n";
+      // malformed, duplicate or stale v2 frame, keep the last commands;
+      // a probe that only found such a frame backs off like an empty one
+      if (this->dataPtr->connectionState != CONNECTION_ONLINE)
+      {
+        this->dataPtr->ProbeFailed();
+      }
+      return;
+    }
+    const ssize_t expectedChannels = this->dataPtr->controls.size();
+    if (recvChannels < expectedChannels)
+    {
+      aperr(1000) << "[" << this->dataPtr->modelName << "] "
+                  << "got less than model needs. Got: " << recvChannels
+                  << " commands, expected: " << expectedChannels << "\n";
     }
-    const ssize_t recvChannels = recvSize / sizeof(pkt.motorSpeed[0]);
     // for(unsigned int i = 0; i < recvChannels; ++i)
     // {
-    //   gzdbg << "servo_command [" << i << "]: " << pkt.motorSpeed[i] << "\n";
+    //   gzdbg << "servo_command [" << i << "]: " << motorSpeed[i] << "\n";
     // }
 
-    if (!this->dataPtr->arduPilotOnline)
+    if (this->dataPtr->connectionState != CONNECTION_ONLINE)
     {
       gzdbg << "[" << this->dataPtr->modelName << "] "
             << "ArduPilot controller online detected.\n";
       // made connection, set some flags
       this->dataPtr->connectionTimeoutCount = 0;
-      this->dataPtr->arduPilotOnline = true;
+      this->dataPtr->connectionState = CONNECTION_ONLINE;
+      // no slope to extrapolate from yet
+      this->dataPtr->lastCommandTime =
+        this->dataPtr->model->GetWorld()->SimTime();
     }
 
+    const gazebo::common::Time now =
+      this->dataPtr->model->GetWorld()->SimTime();
+    const double sinceLastCommand =
+      (now - this->dataPtr->lastCommandTime).Double();
+    this->dataPtr->lastCommandTime = now;
+    this->dataPtr->lastPacketWallTime = std::chrono::steady_clock::now();
+    this->dataPtr->commandFresh = true;
+
     // compute command based on requested motorSpeed
-    for (unsigned i = 0; i < this->dataPtr->controls.size(); ++i)
+    const size_t count = this->dataPtr->commandCount;
+    const int *channels = this->dataPtr->channels.data();
+    const double *multipliers = this->dataPtr->multipliers.data();
+    const double *offsets = this->dataPtr->offsets.data();
+    double *cmds = this->dataPtr->cmds.data();
+    if (this->dataPtr->maxChannel < recvChannels)
     {
-      if (i < MAX_MOTORS)
+      // every channel present, the common case
+      for (size_t i = 0; i < count; ++i)
       {
-        if (this->dataPtr->controls[i].channel < recvChannels)
+        // bound incoming cmd between 0 and 1
+        const double cmd = ignition::math::clamp(motorSpeed[channels[i]],
+          -1.0f, 1.0f);
+        cmds[i] = multipliers[i] * (offsets[i] + cmd);
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (channels[i] < recvChannels)
         {
-          // bound incoming cmd between 0 and 1
-          const double cmd = ignition::math::clamp(
-            pkt.motorSpeed[this->dataPtr->controls[i].channel],
+          const double cmd = ignition::math::clamp(motorSpeed[channels[i]],
             -1.0f, 1.0f);
-          this->dataPtr->controls[i].cmd =
-            this->dataPtr->controls[i].multiplier *
-            (this->dataPtr->controls[i].offset + cmd);
-          // gzdbg << "apply input chan[" << this->dataPtr->controls[i].channel
-          //       << "] to control chan[" << i
-          //       << "] with joint name ["
-          //       << this->dataPtr->controls[i].jointName
-          //       << "] raw cmd ["
-          //       << pkt.motorSpeed[this->dataPtr->controls[i].channel]
-          //       << "] adjusted cmd [" << this->dataPtr->controls[i].cmd
-          //       << "].\n";
+          cmds[i] = multipliers[i] * (offsets[i] + cmd);
         }
         else
         {
-          gzerr << "[" << this->dataPtr->modelName << "] "
-                << "control[" << i << "] channel ["
-                << this->dataPtr->controls[i].channel
-                << "] is greater than incoming commands size["
-                << recvChannels
-                << "], control not applied.\n";
+          aperr(1000) << "[" << this->dataPtr->modelName << "] "
+                      << "control[" << i << "] channel [" << channels[i]
+                      << "] is greater than incoming commands size["
+                      << recvChannels
+                      << "], control not applied.\n";
         }
       }
-      else
+    }
+
+    if (this->dataPtr->extrapolate)
+    {
+      double *receivedCmds = this->dataPtr->receivedCmds.data();
+      double *cmdRates = this->dataPtr->cmdRates.data();
+      for (size_t i = 0; i < count; ++i)
       {
-        gzerr << "[" << this->dataPtr->modelName << "] "
-              << "too many motors, skipping [" << i
-              << " > " << MAX_MOTORS << "].\n";
+        cmdRates[i] = sinceLastCommand > 0 ?
+          (cmds[i] - receivedCmds[i]) / sinceLastCommand : 0;
+        receivedCmds[i] = cmds[i];
       }
     }
   }
 }
 
 /////////////////////////////////////////////////
-void ArduPilotPlugin::SendState() const
+void ArduPilotPlugin::HoldStaleCommands()
 {
-  // send_fdm
-  fdmPacket pkt;
+  ++this->dataPtr->staleStepCount;
+
+  if (!this->dataPtr->extrapolate)
+  {
+    return;
+  }
 
-  pkt.timestamp = this->dataPtr->model->GetWorld()->SimTime().Double();
+  // extrapolate along the last command slope, up to the staleness bound
+  const double age = std::min(this->dataPtr->maxCommandAge,
+    (this->dataPtr->model->GetWorld()->SimTime() -
+     this->dataPtr->lastCommandTime).Double());
+  // within the range decoding a servo command can give
+  for (size_t i = 0; i < this->dataPtr->commandCount; ++i)
+  {
+    this->dataPtr->cmds[i] = ignition::math::clamp(
+      this->dataPtr->receivedCmds[i] + this->dataPtr->cmdRates[i] * age,
+      this->dataPtr->cmdMins[i], this->dataPtr->cmdMaxs[i]);
+  }
+}
+
+/////////////////////////////////////////////////
+const ArduPilotVehicleState &ArduPilotPluginPrivate::Snapshot()
+{
+  if (this->stateValid)
+  {
+    return this->state;
+  }
+  ArduPilotTraceScope trace("ArduPilotPluginPrivate::Snapshot",
+    this->traceVehicle, this->traceSimTime);
+
+  ArduPilotVehicleState &s = this->state;
+  s.timestamp = this->model->GetWorld()->SimTime().Double();
 
   // asssumed that the imu orientation is:
   //   x forward
   //   y right
   //   z down
-
-  // get linear acceleration in body frame
-  const ignition::math::Vector3d linearAccel =
-    this->dataPtr->imuSensor->LinearAcceleration();
-
-  // copy to pkt
-  pkt.imuLinearAccelerationXYZ[0] = linearAccel.X();
-  pkt.imuLinearAccelerationXYZ[1] = linearAccel.Y();
-  pkt.imuLinearAccelerationXYZ[2] = linearAccel.Z();
-  // gzerr << "lin accel [" << linearAccel << "]\n";
-
-  // get angular velocity in body frame
-  const ignition::math::Vector3d angularVel =
-    this->dataPtr->imuSensor->AngularVelocity();
-
-  // copy to pkt
-  pkt.imuAngularVelocityRPY[0] = angularVel.X();
-  pkt.imuAngularVelocityRPY[1] = angularVel.Y();
-  pkt.imuAngularVelocityRPY[2] = angularVel.Z();
+  if (this->syntheticImu)
+  {
+    ignition::math::Vector3d angularVel;
+    ignition::math::Vector3d linearAccel;
+    this->imu.Measure(angularVel, linearAccel);
+    s.imuAngularVelocity[0] = angularVel.X();
+    s.imuAngularVelocity[1] = angularVel.Y();
+    s.imuAngularVelocity[2] = angularVel.Z();
+    s.imuLinearAcceleration[0] = linearAccel.X();
+    s.imuLinearAcceleration[1] = linearAccel.Y();
+    s.imuLinearAcceleration[2] = linearAccel.Z();
+  }
+  else if (this->imuSensor)
+  {
+    const ignition::math::Vector3d angularVel =
+      this->imuSensor->AngularVelocity();
+    s.imuAngularVelocity[0] = angularVel.X();
+    s.imuAngularVelocity[1] = angularVel.Y();
+    s.imuAngularVelocity[2] = angularVel.Z();
+
+    const ignition::math::Vector3d linearAccel =
+      this->imuSensor->LinearAcceleration();
+    s.imuLinearAcceleration[0] = linearAccel.X();
+    s.imuLinearAcceleration[1] = linearAccel.Y();
+    s.imuLinearAcceleration[2] = linearAccel.Z();
+  }
 
   // get inertial pose and velocity
   // position of the uav in world frame
@@ -1152,75 +1923,94 @@ void ArduPilotPlugin::SendState() const
   // assuming the world NED frame has xyz mapped to NED,
   // imuLink is NED - z down
 
-  // model world pose brings us to model,
-  // which for example zephyr has -y-forward, x-left, z-up
-  // adding modelXYZToAirplaneXForwardZDown rotates
-  //   from: model XYZ
-  //   to: airplane x-forward, y-left, z-down
-  const ignition::math::Pose3d gazeboXYZToModelXForwardZDown =
-    this->modelXYZToAirplaneXForwardZDown +
-    this->dataPtr->model->WorldPose();
-
-  // get transform from world NED to Model frame
-  const ignition::math::Pose3d NEDToModelXForwardZUp =
-    gazeboXYZToModelXForwardZDown - this->gazeboXYZToNED;
-
-  // gzerr << "ned to model [" << NEDToModelXForwardZUp << "]\n";
-
-  // N
-  pkt.positionXYZ[0] = NEDToModelXForwardZUp.Pos().X();
-
-  // E
-  pkt.positionXYZ[1] = NEDToModelXForwardZUp.Pos().Y();
-
-  // D
-  pkt.positionXYZ[2] = NEDToModelXForwardZUp.Pos().Z();
-
-  // imuOrientationQuat is the rotation from world NED frame
-  // to the uav frame.
-  pkt.imuOrientationQuat[0] = NEDToModelXForwardZUp.Rot().W();
-  pkt.imuOrientationQuat[1] = NEDToModelXForwardZUp.Rot().X();
-  pkt.imuOrientationQuat[2] = NEDToModelXForwardZUp.Rot().Y();
-  pkt.imuOrientationQuat[3] = NEDToModelXForwardZUp.Rot().Z();
-
-  // gzdbg << "imu [" << gazeboXYZToModelXForwardZDown.rot.GetAsEuler()
-  //       << "]\n";
-  // gzdbg << "ned [" << this->gazeboXYZToNED.rot.GetAsEuler() << "]\n";
-  // gzdbg << "rot [" << NEDToModelXForwardZUp.rot.GetAsEuler() << "]\n";
-
-  // Get NED velocity in body frame *
-  // or...
-  // Get model velocity in NED frame
-  const ignition::math::Vector3d velGazeboWorldFrame =
-    this->dataPtr->model->GetLink()->WorldLinearVel();
-  const ignition::math::Vector3d velNEDFrame =
-    this->gazeboXYZToNED.Rot().RotateVectorReverse(velGazeboWorldFrame);
-  pkt.velocityXYZ[0] = velNEDFrame.X();
-  pkt.velocityXYZ[1] = velNEDFrame.Y();
-  pkt.velocityXYZ[2] = velNEDFrame.Z();
-/* NOT MERGED IN MASTER YET
-  if (!this->dataPtr->gpsSensor)
-    {
+  // model world pose brings us to model, then the folded
+  // modelXYZToAirplaneXForwardZDown to the airplane x-forward, y-left,
+  // z-down body and the folded gazeboXYZToNED to the NED frame
+  const ignition::math::Pose3d worldPose = this->model->WorldPose();
+  const ignition::math::Vector3d posNED = this->worldToNED.RotateVector(
+    worldPose.Pos() + worldPose.Rot().RotateVector(this->bodyOffset)) -
+    this->nedOrigin;
+  s.positionNED[0] = posNED.X();
+  s.positionNED[1] = posNED.Y();
+  s.positionNED[2] = posNED.Z();
+
+  // rotation from world NED frame to the uav frame
+  ignition::math::Quaterniond rotNED =
+    this->worldToNED * worldPose.Rot() * this->bodyRotation;
+  rotNED.Normalize();
+  s.orientation[0] = rotNED.W();
+  s.orientation[1] = rotNED.X();
+  s.orientation[2] = rotNED.Y();
+  s.orientation[3] = rotNED.Z();
+
+  // model velocity in NED frame
+  const ignition::math::Vector3d velWorld = this->baseLink->WorldLinearVel();
+  s.velocityWorld[0] = velWorld.X();
+  s.velocityWorld[1] = velWorld.Y();
+  s.velocityWorld[2] = velWorld.Z();
+  const ignition::math::Vector3d velNED =
+    this->worldToNED.RotateVector(velWorld);
+  s.velocityNED[0] = velNED.X();
+  s.velocityNED[1] = velNED.Y();
+  s.velocityNED[2] = velNED.Z();
+
+  // filled whether or not the fdm extensions send them, VehicleState()
+  // consumers read them too
+  s.motorPower = this->MotorPower();
+
+  std::fill(s.escRpm, s.escRpm + MAX_ESCS, 0.0);
+  const double *filtered = this->velocityFilter.Outputs();
+  for (size_t i = 0; i < this->escControls.size(); ++i)
+  {
+    s.escRpm[this->escChannels[i]] =
+      std::fabs(filtered[this->escControls[i]] * this->escScales[i]);
+  }
+  s.escCount = this->escCount;
 
-    }
-    else {
-        pkt.longitude = this->dataPtr->gpsSensor->Longitude().Degree();
-        pkt.latitude = this->dataPtr->gpsSensor->Latitude().Degree();
-        pkt.altitude = this->dataPtr->gpsSensor->Altitude();
-    }
+  this->stateValid = true;
+  return s;
+}
 
-    // TODO : make generic enough to accept sonar/gpuray etc. too
-    if (!this->dataPtr->rangefinderSensor)
-    {
+/////////////////////////////////////////////////
+void ArduPilotPlugin::SendState() const
+{
+  ArduPilotTraceScope trace("ArduPilotPlugin::SendState",
+    this->dataPtr->traceVehicle, this->dataPtr->traceSimTime);
 
-    } else {
-        // Rangefinder value can not be send as Inf to ardupilot
-        const double range = this->dataPtr->rangefinderSensor->Range(0);
-        pkt.rangefinder = std::isinf(range) ? 0.0 : range;
-    }
+  const ArduPilotVehicleState &state = this->dataPtr->Snapshot();
 
-  // airspeed :     wind = Vector3(environment.wind.x, environment.wind.y, environment.wind.z)
-   // pkt.airspeed = (pkt.velocity - wind).length()
-*/
-  this->dataPtr->socket_out.Send(&pkt, sizeof(pkt));
+  // send_fdm
+  fdmPacket pkt;
+  pkt.timestamp = state.timestamp;
+  std::copy(state.imuAngularVelocity, state.imuAngularVelocity + 3,
+    pkt.imuAngularVelocityRPY);
+  std::copy(state.imuLinearAcceleration, state.imuLinearAcceleration + 3,
+    pkt.imuLinearAccelerationXYZ);
+  std::copy(state.orientation, state.orientation + 4,
+    pkt.imuOrientationQuat);
+  std::copy(state.velocityNED, state.velocityNED + 3, pkt.velocityXYZ);
+  std::copy(state.positionNED, state.positionNED + 3, pkt.positionXYZ);
+
+  fdmExtension ext;
+  if (this->dataPtr->fdmExtensions.Fields())
+  {
+    const ignition::math::Vector3d velWorld(state.velocityWorld[0],
+      state.velocityWorld[1], state.velocityWorld[2]);
+    this->dataPtr->fdmExtensions.Fill(pkt, velWorld, state.motorPower,
+      state.escRpm, state.escCount, ext);
+  }
+
+  size_t size;
+  const void *frame = this->dataPtr->protocol.EncodeFdm(pkt, ext, size);
+  if (!frame)
+  {
+    aperr(1000) << "[" << this->dataPtr->modelName << "] "
+                << "state message does not fit, not sent.\n";
+    return;
+  }
+  this->dataPtr->transport->Send(frame, size);
+  if (!this->dataPtr->fanout.Empty())
+  {
+    this->dataPtr->fanout.Send(frame, size);
+  }
 }
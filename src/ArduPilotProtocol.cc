@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cstring>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotJson.hh"
+#include "include/ArduPilotProtocol.hh"
+
+using namespace gazebo;
+
+/// \brief Key fragments of the JSON state message, in write order. SIM_JSON
+/// wants the message on a line of its own.
+static const char kJsonTimestamp[] = "\n{\"timestamp\":";
+static const char kJsonGyro[] = ",\"imu\":{\"gyro\":[";
+static const char kJsonAccel[] = "],\"accel_body\":[";
+static const char kJsonPosition[] = "]},\"position\":[";
+static const char kJsonQuaternion[] = "],\"quaternion\":[";
+static const char kJsonVelocity[] = "],\"velocity\":[";
+static const char kJsonVelocityEnd[] = "]";
+static const char kJsonAirspeed[] = ",\"airspeed\":";
+static const char kJsonBatteryVoltage[] = ",\"battery\":{\"voltage\":";
+static const char kJsonBatteryCurrent[] = ",\"current\":";
+static const char kJsonBatteryEnd[] = "}";
+static const char kJsonRangefinder[] = ",\"rng_1\":";
+static const char kJsonRpm[] = ",\"rpm\":[";
+static const char kJsonRpmEnd[] = "]";
+static const char kJsonEnd[] = "}\n";
+
+/// \brief Append _count values to a frame, converting to T
+/// \param[in] _values Values to append.
+/// \param[in] _count Number of values.
+/// \param[in,out] _out Write position.
+template <typename T>
+static inline void Put(const double *_values, const unsigned _count,
+  unsigned char *&_out)
+{
+  for (unsigned i = 0; i < _count; ++i)
+  {
+    const T value = static_cast<T>(_values[i]);
+    memcpy(_out, &value, sizeof(value));
+    _out += sizeof(value);
+  }
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotProtocol::Load(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  this->modelName = _modelName;
+
+  const std::string protocol =
+    _sdf->Get("protocol", static_cast<std::string>("legacy")).first;
+  if (protocol == "v2")
+  {
+    this->framed = true;
+  }
+  else if (protocol == "json")
+  {
+    this->json = true;
+  }
+  else if (protocol != "legacy")
+  {
+    gzerr << "[" << this->modelName << "] "
+          << "unknown protocol [" << protocol
+          << "], must be one of legacy, v2, json. aborting plugin.\n";
+    return false;
+  }
+
+  this->float32 = _sdf->Get("fdmFloat32", false).first;
+  if (this->float32 && !this->framed)
+  {
+    gzwarn << "[" << this->modelName << "] "
+           << "<fdmFloat32> needs <protocol>v2</protocol>, ignored.\n";
+    this->float32 = false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotProtocol::Framed() const
+{
+  return this->framed;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotProtocol::Json() const
+{
+  return this->json;
+}
+
+/////////////////////////////////////////////////
+uint32_t ArduPilotProtocol::ExtensionFields() const
+{
+  if (this->framed)
+  {
+    return kFdmExtensionFields;
+  }
+  if (this->json)
+  {
+    // SIM_JSON derives its gps from the position
+    return FDM_AIRSPEED | FDM_BATTERY | FDM_RANGEFINDER | FDM_ESC_RPM;
+  }
+  return 0;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotProtocol::ResetFrameState()
+{
+  this->haveServoFrame = false;
+  this->lastServoFrame = 0;
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotProtocol::DecodeServo(const ServoPacket &_pkt,
+  const ssize_t _size, const float *&_channels)
+{
+  if (this->json)
+  {
+    return this->DecodeJsonServo(_pkt, _size, _channels);
+  }
+
+  if (!this->framed)
+  {
+    _channels = _pkt.motorSpeed;
+    return _size / static_cast<ssize_t>(sizeof(_pkt.motorSpeed[0]));
+  }
+
+  ArduPilotFrameHeader header;
+  if (_size < static_cast<ssize_t>(sizeof(header)))
+  {
+    ++this->mismatches;
+    return -1;
+  }
+  memcpy(&header, &_pkt, sizeof(header));
+  const ssize_t payload = _size - static_cast<ssize_t>(sizeof(header));
+  if (header.magic != kFrameMagic || header.version != kFrameVersion ||
+      payload < static_cast<ssize_t>(header.channelCount * sizeof(float)))
+  {
+    ++this->mismatches;
+    return -1;
+  }
+
+  if (this->haveServoFrame)
+  {
+    // signed difference copes with the counter wrapping around
+    const int32_t diff =
+      static_cast<int32_t>(header.frameCount - this->lastServoFrame);
+    if (diff == 0)
+    {
+      ++this->duplicates;
+      return -1;
+    }
+    else if (diff < -kServoReorderWindow)
+    {
+      // too far behind to be a late frame: the counter started over when
+      // ArduPilot restarted, follow it
+      ++this->reordered;
+    }
+    else if (diff < 0)
+    {
+      ++this->reordered;
+      return -1;
+    }
+    else
+    {
+      this->gaps += static_cast<uint32_t>(diff) - 1;
+    }
+  }
+  this->lastServoFrame = header.frameCount;
+  this->haveServoFrame = true;
+
+  _channels = reinterpret_cast<const float *>(
+    reinterpret_cast<const unsigned char *>(&_pkt) + sizeof(header));
+  return header.channelCount;
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotProtocol::DecodeJsonServo(const ServoPacket &_pkt,
+  const ssize_t _size, const float *&_channels)
+{
+  ArduPilotJsonServoHeader header;
+  if (_size < static_cast<ssize_t>(sizeof(header)))
+  {
+    ++this->mismatches;
+    return -1;
+  }
+  memcpy(&header, &_pkt, sizeof(header));
+
+  unsigned count = 0;
+  if (header.magic == kJsonServoMagic16)
+  {
+    count = 16;
+  }
+  else if (header.magic == kJsonServoMagic32)
+  {
+    count = 32;
+  }
+  if (count == 0 || _size < static_cast<ssize_t>(sizeof(header) +
+        count * sizeof(uint16_t)))
+  {
+    ++this->mismatches;
+    return -1;
+  }
+
+  if (this->haveServoFrame)
+  {
+    if (header.frameCount == this->lastServoFrame)
+    {
+      ++this->duplicates;
+      return -1;
+    }
+    else if (header.frameCount < this->lastServoFrame)
+    {
+      // the counter starts over when ArduPilot restarts, follow it
+      ++this->reordered;
+    }
+    else
+    {
+      this->gaps += header.frameCount - this->lastServoFrame - 1;
+    }
+  }
+  this->lastServoFrame = header.frameCount;
+  this->haveServoFrame = true;
+
+  // same scaling as SIM_Gazebo applies before sending the legacy packet
+  const unsigned char *pwm =
+    reinterpret_cast<const unsigned char *>(&_pkt) + sizeof(header);
+  for (unsigned i = 0; i < count; ++i)
+  {
+    uint16_t value;
+    memcpy(&value, pwm + i * sizeof(value), sizeof(value));
+    this->jsonChannels[i] = (static_cast<float>(value) - 1000.0f) / 1000.0f;
+  }
+  _channels = this->jsonChannels;
+  return count;
+}
+
+/////////////////////////////////////////////////
+template <typename T>
+void ArduPilotProtocol::EncodeFields(const fdmPacket &_pkt,
+  const fdmExtension &_ext, const uint32_t _fields,
+  unsigned char *&_out) const
+{
+  if (_fields & FDM_TIMESTAMP)
+  {
+    Put<double>(&_pkt.timestamp, 1, _out);
+  }
+  if (_fields & FDM_IMU_GYRO)
+  {
+    Put<T>(_pkt.imuAngularVelocityRPY, 3, _out);
+  }
+  if (_fields & FDM_IMU_ACCEL)
+  {
+    Put<T>(_pkt.imuLinearAccelerationXYZ, 3, _out);
+  }
+  if (_fields & FDM_ORIENTATION)
+  {
+    Put<T>(_pkt.imuOrientationQuat, 4, _out);
+  }
+  if (_fields & FDM_VELOCITY)
+  {
+    Put<T>(_pkt.velocityXYZ, 3, _out);
+  }
+  if (_fields & FDM_POSITION)
+  {
+    Put<T>(_pkt.positionXYZ, 3, _out);
+  }
+  if (_fields & FDM_GPS)
+  {
+    // float32 would round latitude and longitude to about a meter
+    Put<double>(&_ext.latitude, 1, _out);
+    Put<double>(&_ext.longitude, 1, _out);
+    Put<T>(&_ext.altitude, 1, _out);
+  }
+  if (_fields & FDM_AIRSPEED)
+  {
+    Put<T>(&_ext.airspeed, 1, _out);
+  }
+  if (_fields & FDM_BATTERY)
+  {
+    Put<T>(&_ext.batteryVoltage, 1, _out);
+    Put<T>(&_ext.batteryCurrent, 1, _out);
+  }
+  if (_fields & FDM_RANGEFINDER)
+  {
+    Put<T>(&_ext.rangefinder, 1, _out);
+  }
+  if (_fields & FDM_ESC_RPM)
+  {
+    const uint32_t count = std::min<uint32_t>(_ext.escCount, MAX_ESCS);
+    memcpy(_out, &count, sizeof(count));
+    _out += sizeof(count);
+    Put<T>(_ext.escRpm, count, _out);
+  }
+}
+
+/////////////////////////////////////////////////
+const void *ArduPilotProtocol::EncodeFdm(const fdmPacket &_pkt,
+  const fdmExtension &_ext, size_t &_size)
+{
+  if (this->json)
+  {
+    return this->EncodeJsonFdm(_pkt, _ext, _size);
+  }
+  if (!this->framed)
+  {
+    _size = sizeof(_pkt);
+    return &_pkt;
+  }
+
+  ArduPilotFrameHeader header;
+  header.magic = kFrameMagic;
+  header.version = kFrameVersion;
+  header.flags = this->float32 ? kFrameFloat32 : 0;
+  header.channelCount = 0;
+  header.frameCount = this->fdmFrameCount++;
+  header.fields = this->fields | (_ext.fields & kFdmExtensionFields);
+  memcpy(this->buffer, &header, sizeof(header));
+
+  unsigned char *out = this->buffer + sizeof(header);
+  if (this->float32)
+  {
+    this->EncodeFields<float>(_pkt, _ext, header.fields, out);
+  }
+  else
+  {
+    this->EncodeFields<double>(_pkt, _ext, header.fields, out);
+  }
+  _size = static_cast<size_t>(out - this->buffer);
+  return this->buffer;
+}
+
+/////////////////////////////////////////////////
+const void *ArduPilotProtocol::EncodeJsonFdm(const fdmPacket &_pkt,
+  const fdmExtension &_ext, size_t &_size)
+{
+  ArduPilotJsonWriter writer(reinterpret_cast<char *>(this->buffer),
+    sizeof(this->buffer));
+  writer.Literal(kJsonTimestamp);
+  writer.Number(_pkt.timestamp);
+  writer.Literal(kJsonGyro);
+  writer.Numbers(_pkt.imuAngularVelocityRPY, 3);
+  writer.Literal(kJsonAccel);
+  writer.Numbers(_pkt.imuLinearAccelerationXYZ, 3);
+  writer.Literal(kJsonPosition);
+  writer.Numbers(_pkt.positionXYZ, 3);
+  writer.Literal(kJsonQuaternion);
+  writer.Numbers(_pkt.imuOrientationQuat, 4);
+  writer.Literal(kJsonVelocity);
+  writer.Numbers(_pkt.velocityXYZ, 3);
+  writer.Literal(kJsonVelocityEnd);
+  if (_ext.fields & FDM_AIRSPEED)
+  {
+    writer.Literal(kJsonAirspeed);
+    writer.Number(_ext.airspeed);
+  }
+  if (_ext.fields & FDM_BATTERY)
+  {
+    writer.Literal(kJsonBatteryVoltage);
+    writer.Number(_ext.batteryVoltage);
+    writer.Literal(kJsonBatteryCurrent);
+    writer.Number(_ext.batteryCurrent);
+    writer.Literal(kJsonBatteryEnd);
+  }
+  if (_ext.fields & FDM_RANGEFINDER)
+  {
+    writer.Literal(kJsonRangefinder);
+    writer.Number(_ext.rangefinder);
+  }
+  if (_ext.fields & FDM_ESC_RPM)
+  {
+    writer.Literal(kJsonRpm);
+    writer.Numbers(_ext.escRpm, std::min<uint32_t>(_ext.escCount, MAX_ESCS));
+    writer.Literal(kJsonRpmEnd);
+  }
+  writer.Literal(kJsonEnd);
+
+  // the longest message is well under the buffer size, never send a
+  // truncated one all the same
+  if (writer.Overflow())
+  {
+    _size = 0;
+    return nullptr;
+  }
+  _size = writer.Size();
+  return this->buffer;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotProtocol::Gaps() const
+{
+  return this->gaps;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotProtocol::Duplicates() const
+{
+  return this->duplicates;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotProtocol::Reordered() const
+{
+  return this->reordered;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotProtocol::Mismatches() const
+{
+  return this->mismatches;
+}
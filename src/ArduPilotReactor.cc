@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifdef __linux__
+  #include <sys/epoll.h>
+  #include <sys/socket.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotReactor.hh"
+
+using namespace gazebo;
+
+/// \brief Most epoll events handled per wakeup
+#define REACTOR_MAX_EVENTS 64
+
+/////////////////////////////////////////////////
+std::shared_ptr<ArduPilotReactor> ArduPilotReactor::Instance()
+{
+  static std::mutex instanceMutex;
+  static std::weak_ptr<ArduPilotReactor> instance;
+
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  std::shared_ptr<ArduPilotReactor> reactor = instance.lock();
+  if (!reactor)
+  {
+    reactor.reset(new ArduPilotReactor);
+    if (reactor->epollFd == -1)
+    {
+      return nullptr;
+    }
+    instance = reactor;
+  }
+  return reactor;
+}
+
+/////////////////////////////////////////////////
+ArduPilotReactor::ArduPilotReactor()
+{
+  #ifdef __linux__
+  this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+  this->sendFdInet = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  this->sendFdUnix = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  this->updateEndConnection = event::Events::ConnectWorldUpdateEnd(
+      std::bind(&ArduPilotReactor::Flush, this));
+  #endif
+}
+
+/////////////////////////////////////////////////
+ArduPilotReactor::~ArduPilotReactor()
+{
+  #ifdef __linux__
+  for (int fd : {this->epollFd, this->sendFdInet, this->sendFdUnix})
+  {
+    if (fd != -1)
+    {
+      close(fd);
+    }
+  }
+  #endif
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotReactor::Register(ArduPilotReactorTransport *_vehicle)
+{
+  #ifdef __linux__
+  std::lock_guard<std::mutex> lock(this->mutex);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = _vehicle;
+  if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, _vehicle->socket.ReceiveFd(),
+      &ev) != 0)
+  {
+    return false;
+  }
+  this->vehicles.push_back(_vehicle);
+  this->queued.reserve(this->vehicles.size());
+  return true;
+  #else
+  (void)_vehicle;
+  return false;
+  #endif
+}
+
+/////////////////////////////////////////////////
+void ArduPilotReactor::TuneSend(const ArduPilotRealtime &_realtime)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (_realtime.SendBuffer() <= this->sndBuf)
+  {
+    return;
+  }
+  this->sndBuf = _realtime.SendBuffer();
+  _realtime.ApplyToSendSocket(this->sendFdInet, "shared fdm socket");
+  _realtime.ApplyToSendSocket(this->sendFdUnix, "shared unix fdm socket");
+}
+
+/////////////////////////////////////////////////
+void ArduPilotReactor::Unregister(ArduPilotReactorTransport *_vehicle)
+{
+  #ifdef __linux__
+  std::lock_guard<std::mutex> lock(this->mutex);
+  epoll_ctl(this->epollFd, EPOLL_CTL_DEL, _vehicle->socket.ReceiveFd(),
+    nullptr);
+  this->vehicles.erase(std::remove(this->vehicles.begin(),
+    this->vehicles.end(), _vehicle), this->vehicles.end());
+  this->queued.erase(std::remove(this->queued.begin(),
+    this->queued.end(), _vehicle), this->queued.end());
+  #else
+  (void)_vehicle;
+  #endif
+}
+
+/////////////////////////////////////////////////
+void ArduPilotReactor::Poll(ArduPilotReactorTransport *_vehicle,
+  const uint32_t _timeoutMs)
+{
+  #ifdef __linux__
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  // state queued by other vehicles must reach ArduPilot before anyone
+  // waits on a reply
+  this->FlushLocked();
+
+  const std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(_timeoutMs);
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  int timeoutMs = 0;
+  do
+  {
+    const int n = epoll_wait(this->epollFd, events, REACTOR_MAX_EVENTS,
+      timeoutMs);
+    for (int i = 0; i < n; ++i)
+    {
+      ArduPilotReactorTransport *vehicle =
+        static_cast<ArduPilotReactorTransport *>(events[i].data.ptr);
+      ssize_t size;
+      const ServoPacket *pkt = vehicle->socket.Drain(size);
+      if (pkt)
+      {
+        if (vehicle->pending)
+        {
+          ++vehicle->skipped;
+        }
+        vehicle->pending = pkt;
+        vehicle->pendingSize = size;
+      }
+    }
+
+    // poll once without waiting, then wait for what is left of the timeout
+    const int64_t remaining =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+    timeoutMs = static_cast<int>(std::max<int64_t>(remaining, 0));
+  }
+  while (!_vehicle->pending && timeoutMs > 0);
+  #else
+  (void)_vehicle;
+  (void)_timeoutMs;
+  #endif
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotReactor::Queue(ArduPilotReactorTransport *_vehicle,
+  const void *_buf, size_t _size)
+{
+  if (_size > FDM_PACKET_MAX_SIZE)
+  {
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (_vehicle->outSize == 0)
+  {
+    this->queued.push_back(_vehicle);
+  }
+  memcpy(_vehicle->out, _buf, _size);
+  _vehicle->outSize = _size;
+
+  if (this->queued.size() >= this->vehicles.size())
+  {
+    this->FlushLocked();
+  }
+  return static_cast<ssize_t>(_size);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotReactor::Flush()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->FlushLocked();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotReactor::FlushLocked()
+{
+  #ifdef __linux__
+  if (this->queued.empty())
+  {
+    return;
+  }
+
+  // stamp before sending so a fast reply never predates its request
+  for (ArduPilotReactorTransport *vehicle : this->queued)
+  {
+    vehicle->socket.Sent();
+  }
+
+  struct iovec iov[REACTOR_MAX_EVENTS];
+  struct mmsghdr msgs[REACTOR_MAX_EVENTS];
+  for (const int family : {AF_INET, AF_UNIX})
+  {
+    const int fd = family == AF_INET ? this->sendFdInet : this->sendFdUnix;
+    unsigned count = 0;
+    auto send = [&]()
+    {
+      unsigned sent = 0;
+      while (sent < count)
+      {
+        const int n = sendmmsg(fd, &msgs[sent], count - sent, MSG_DONTWAIT);
+        if (n <= 0)
+        {
+          // socket buffer full, drop the rest like a plain send() would
+          break;
+        }
+        sent += n;
+      }
+      count = 0;
+    };
+
+    for (ArduPilotReactorTransport *vehicle : this->queued)
+    {
+      if (vehicle->peer.ss_family != family)
+      {
+        continue;
+      }
+      iov[count].iov_base = vehicle->out;
+      iov[count].iov_len = vehicle->outSize;
+      memset(&msgs[count], 0, sizeof(msgs[count]));
+      msgs[count].msg_hdr.msg_name = &vehicle->peer;
+      msgs[count].msg_hdr.msg_namelen = vehicle->peerLen;
+      msgs[count].msg_hdr.msg_iov = &iov[count];
+      msgs[count].msg_hdr.msg_iovlen = 1;
+      if (++count == REACTOR_MAX_EVENTS)
+      {
+        send();
+      }
+    }
+    send();
+  }
+
+  for (ArduPilotReactorTransport *vehicle : this->queued)
+  {
+    vehicle->outSize = 0;
+  }
+  this->queued.clear();
+  #endif
+}
+
+/////////////////////////////////////////////////
+ArduPilotReactorTransport::~ArduPilotReactorTransport()
+{
+  if (this->reactor)
+  {
+    this->reactor->Unregister(this);
+  }
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotReactorTransport::Open(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  if (ArduPilotSocketTransport::RepliesToSender(_sdf))
+  {
+    // the reactor sends every vehicle's state from one shared socket
+    gzerr << "[" << _modelName << "] "
+          << "<replyToSender> and the json protocol are not supported with "
+          << "<sharedReactor>, aborting plugin.\n";
+    return false;
+  }
+
+  // state goes out through the reactor's sockets, only receive here
+  if (!this->socket.OpenReceive(_sdf, _modelName))
+  {
+    return false;
+  }
+
+  const std::string fdm_addr =
+    _sdf->Get("fdm_addr", static_cast<std::string>("127.0.0.1")).first;
+  const uint16_t fdm_port_out =
+    _sdf->Get("fdm_port_out", static_cast<uint32_t>(9006)).first;
+  if (!MakeSocketAddress(fdm_addr, fdm_port_out, this->peer, this->peerLen))
+  {
+    gzerr << "[" << _modelName << "] "
+          << "invalid fdm_addr [" << fdm_addr << "], aborting plugin.\n";
+    return false;
+  }
+
+  this->reactor = ArduPilotReactor::Instance();
+  if (!this->reactor || !this->reactor->Register(this))
+  {
+    gzerr << "[" << _modelName << "] "
+          << "failed to register with the shared reactor, aborting plugin.\n";
+    this->reactor.reset();
+    return false;
+  }
+  this->reactor->TuneSend(this->socket.Realtime());
+  return true;
+}
+
+/////////////////////////////////////////////////
+const ServoPacket *ArduPilotReactorTransport::ReceiveLatest(
+  uint32_t _timeoutMs, ssize_t &_size)
+{
+  if (!this->pending)
+  {
+    this->reactor->Poll(this, _timeoutMs);
+  }
+
+  const ServoPacket *pkt = this->pending;
+  _size = this->pendingSize;
+  this->pending = nullptr;
+  this->pendingSize = -1;
+  return pkt;
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotReactorTransport::Send(const void *_buf, size_t _size)
+{
+  return this->reactor->Queue(this, _buf, _size);
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotReactorTransport::DrainedPacketCount() const
+{
+  return this->socket.DrainedPacketCount() + this->skipped;
+}
+
+/////////////////////////////////////////////////
+const ArduPilotRoundTrip *ArduPilotReactorTransport::RoundTrip() const
+{
+  return this->socket.RoundTrip();
+}
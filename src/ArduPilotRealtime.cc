@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifdef _WIN32
+  #include <Winsock2.h>
+#else
+  #include <sys/socket.h>
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <gazebo/common/common.hh>
+#include "include/ArduPilotRealtime.hh"
+
+using namespace gazebo;
+
+/////////////////////////////////////////////////
+void ArduPilotRealtime::Load(sdf::ElementPtr _sdf, const std::string &_name)
+{
+  this->name = _name;
+  if (!_sdf->HasElement("realtime"))
+  {
+    return;
+  }
+  sdf::ElementPtr realtimeSDF = _sdf->GetElement("realtime");
+
+  std::istringstream cpuList(
+    realtimeSDF->Get("cpus", static_cast<std::string>("")).first);
+  int cpu;
+  while (cpuList >> cpu)
+  {
+    this->cpus.push_back(cpu);
+  }
+  if (!cpuList.eof())
+  {
+    gzwarn << "[" << this->name << "] "
+           << "<realtime><cpus> must be a list of core numbers, "
+           << "ignoring the rest of it.\n";
+  }
+
+  this->fifoPriority =
+    realtimeSDF->Get("fifoPriority", this->fifoPriority).first;
+  this->rcvBuf = realtimeSDF->Get("rcvBuf", this->rcvBuf).first;
+  this->sndBuf = realtimeSDF->Get("sndBuf", this->sndBuf).first;
+  this->busyPollUs = realtimeSDF->Get("busyPollUs", this->busyPollUs).first;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotRealtime::ThreadSettings() const
+{
+  return !this->cpus.empty() || this->fifoPriority > 0;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRealtime::ApplyToThread(const std::string &_thread) const
+{
+  if (!this->ThreadSettings())
+  {
+    return;
+  }
+
+  #ifdef __linux__
+  if (!this->cpus.empty())
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : this->cpus)
+    {
+      if (cpu >= 0 && cpu < CPU_SETSIZE)
+      {
+        CPU_SET(cpu, &set);
+      }
+    }
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(set),
+      &set);
+    if (err != 0)
+    {
+      gzwarn << "[" << this->name << "] "
+             << "cpu affinity of the " << _thread << " refused: "
+             << strerror(err) << ".\n";
+    }
+    else
+    {
+      gzmsg << "[" << this->name << "] "
+            << _thread << " pinned to cpus [";
+      for (size_t i = 0; i < this->cpus.size(); ++i)
+      {
+        gzmsg << (i ? " " : "") << this->cpus[i];
+      }
+      gzmsg << "].\n";
+    }
+  }
+
+  if (this->fifoPriority > 0)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = this->fifoPriority;
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+      &param);
+    if (err != 0)
+    {
+      gzwarn << "[" << this->name << "] "
+             << "SCHED_FIFO priority [" << this->fifoPriority
+             << "] of the " << _thread << " refused: " << strerror(err)
+             << (err == EPERM ? ", needs CAP_SYS_NICE or an rtprio limit"
+                              : "")
+             << ".\n";
+    }
+    else
+    {
+      gzmsg << "[" << this->name << "] "
+            << _thread << " running SCHED_FIFO priority ["
+            << this->fifoPriority << "].\n";
+    }
+  }
+  #else
+  gzwarn << "[" << this->name << "] "
+         << "cpu affinity and SCHED_FIFO are not supported on this "
+         << "platform, " << _thread << " left alone.\n";
+  #endif
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRealtime::ApplyToSocket(const int _fd,
+  const std::string &_socket) const
+{
+  if (_fd == -1)
+  {
+    return;
+  }
+
+  if (this->rcvBuf > 0)
+  {
+    this->SetBuffer(_fd, SO_RCVBUF, this->rcvBuf, _socket);
+  }
+  if (this->sndBuf > 0)
+  {
+    this->SetBuffer(_fd, SO_SNDBUF, this->sndBuf, _socket);
+  }
+
+  if (this->busyPollUs > 0)
+  {
+    #ifdef SO_BUSY_POLL
+    if (setsockopt(_fd, SOL_SOCKET, SO_BUSY_POLL, &this->busyPollUs,
+          sizeof(this->busyPollUs)) != 0)
+    {
+      gzwarn << "[" << this->name << "] "
+             << "SO_BUSY_POLL [" << this->busyPollUs << "] on the "
+             << _socket << " refused: " << strerror(errno)
+             << (errno == EPERM ? ", above net.core.busy_poll needs "
+                                  "CAP_NET_ADMIN" : "")
+             << ".\n";
+    }
+    #else
+    gzwarn << "[" << this->name << "] "
+           << "SO_BUSY_POLL is not supported on this platform.\n";
+    #endif
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRealtime::ApplyToSendSocket(const int _fd,
+  const std::string &_socket) const
+{
+  if (_fd != -1 && this->sndBuf > 0)
+  {
+    this->SetBuffer(_fd, SO_SNDBUF, this->sndBuf, _socket);
+  }
+}
+
+/////////////////////////////////////////////////
+int ArduPilotRealtime::SendBuffer() const
+{
+  return this->sndBuf;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRealtime::SetBuffer(const int _fd, const int _option,
+  const int _bytes, const std::string &_socket) const
+{
+  const char *option = _option == SO_RCVBUF ? "SO_RCVBUF" : "SO_SNDBUF";
+  if (setsockopt(_fd, SOL_SOCKET, _option,
+        reinterpret_cast<const char *>(&_bytes), sizeof(_bytes)) != 0)
+  {
+    gzwarn << "[" << this->name << "] "
+           << option << " [" << _bytes << "] on the " << _socket
+           << " refused: " << strerror(errno) << ".\n";
+    return;
+  }
+
+  // the kernel silently caps the request at net.core.{r,w}mem_max, and
+  // Linux doubles what it grants for bookkeeping and reports that back
+  #ifdef __linux__
+  const int64_t reported = 2;
+  #else
+  const int64_t reported = 1;
+  #endif
+  int actual = 0;
+  socklen_t len = sizeof(actual);
+  if (getsockopt(_fd, SOL_SOCKET, _option,
+        reinterpret_cast<char *>(&actual), &len) != 0 ||
+      actual >= reported * _bytes)
+  {
+    return;
+  }
+
+  #if defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+  // allowed past the cap with CAP_NET_ADMIN
+  const int force = _option == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE;
+  if (setsockopt(_fd, SOL_SOCKET, force, &_bytes, sizeof(_bytes)) == 0 &&
+      getsockopt(_fd, SOL_SOCKET, _option, &actual, &len) == 0 &&
+      actual >= reported * _bytes)
+  {
+    return;
+  }
+  #endif
+
+  gzwarn << "[" << this->name << "] "
+         << option << " [" << _bytes << "] on the " << _socket
+         << " capped at [" << actual / reported << "], raise net.core."
+         << (_option == SO_RCVBUF ? "rmem_max" : "wmem_max") << ".\n";
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+#include <gazebo/common/Assert.hh>
+#include <gazebo/common/Plugin.hh>
+#include "include/ArduPilotBladeBank.hh"
+#include "include/ArduPilotLog.hh"
+#include "include/ArduPilotMotorModel.hh"
+#include "include/ArduPilotRotorAeroPlugin.hh"
+#include "include/ArduPilotTrace.hh"
+
+using namespace gazebo;
+
+GZ_REGISTER_MODEL_PLUGIN(ArduPilotRotorAeroPlugin)
+
+/// \brief A rotor modelled by thrust and torque tables
+class TableRotor
+{
+  /// \brief Index of the rotor link in links
+  public: unsigned int link = 0;
+
+  /// \brief Joint whose velocity is the rotor speed
+  public: physics::JointPtr joint;
+
+  /// \brief Thrust axis, link frame
+  public: ignition::math::Vector3d axis;
+
+  /// \brief Thrust and torque tables, lag
+  public: ArduPilotMotorModel motor;
+
+  /// \brief Lagged rotor speed, rad/s
+  public: double speed = 0.0;
+};
+
+// Private data class
+class gazebo::ArduPilotRotorAeroPluginPrivate
+{
+  /// \brief Add a blade
+  /// \param[in] _chain <blade>, <rotor> and plugin elements, searched in
+  /// that order for each parameter.
+  /// \param[in] _link Index of the rotor link.
+  public: void AddBlade(const std::vector<sdf::ElementPtr> &_chain,
+    const unsigned int _link);
+
+  /// \brief Index of a link in links, added if new
+  /// \param[in] _link The link.
+  /// \return Index.
+  public: unsigned int LinkIndex(physics::LinkPtr _link);
+
+  /// \brief Pointer to the update event connection.
+  public: event::ConnectionPtr updateConnection;
+
+  /// \brief Pointer to the model
+  public: physics::ModelPtr model;
+
+  /// \brief Model name used to prefix messages
+  public: std::string modelName;
+
+  /// \brief Links carrying rotors
+  public: std::vector<physics::LinkPtr> links;
+
+  /// \brief Motion and summed force of each of links for the step
+  public: std::vector<ArduPilotBladeLink> linkStates;
+
+  /// \brief Blade element rotors
+  public: ArduPilotBladeBank blades;
+
+  /// \brief Table rotors
+  public: std::vector<TableRotor> tableRotors;
+
+  /// \brief Sim time of the previous update
+  public: common::Time lastUpdateTime;
+
+  /// \brief Model name as tagged on trace events
+  public: const char *traceVehicle = "";
+};
+
+/// \brief Read a parameter from the first element of a chain that has it
+/// \param[in] _chain Elements, most specific first.
+/// \param[in] _name Parameter name.
+/// \param[in] _default Value if no element has it.
+/// \return Value.
+template <typename T>
+static T ChainGet(const std::vector<sdf::ElementPtr> &_chain,
+  const std::string &_name, const T &_default)
+{
+  for (const sdf::ElementPtr &elem : _chain)
+  {
+    if (elem->HasElement(_name))
+    {
+      return elem->Get<T>(_name);
+    }
+  }
+  return _default;
+}
+
+/////////////////////////////////////////////////
+ArduPilotRotorAeroPlugin::ArduPilotRotorAeroPlugin()
+  : dataPtr(new ArduPilotRotorAeroPluginPrivate)
+{
+}
+
+/////////////////////////////////////////////////
+ArduPilotRotorAeroPlugin::~ArduPilotRotorAeroPlugin()
+{
+  ArduPilotTrace::Flush();
+  ArduPilotLog::Flush();
+}
+
+/////////////////////////////////////////////////
+unsigned int ArduPilotRotorAeroPluginPrivate::LinkIndex(
+  physics::LinkPtr _link)
+{
+  for (unsigned int i = 0; i < this->links.size(); ++i)
+  {
+    if (this->links[i] == _link)
+    {
+      return i;
+    }
+  }
+  this->links.push_back(_link);
+  this->linkStates.push_back(ArduPilotBladeLink());
+  return static_cast<unsigned int>(this->links.size() - 1);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRotorAeroPluginPrivate::AddBlade(
+  const std::vector<sdf::ElementPtr> &_chain, const unsigned int _link)
+{
+  ArduPilotBlade blade;
+  blade.a0 = ChainGet(_chain, "a0", blade.a0);
+  blade.alphaStall = ChainGet(_chain, "alpha_stall", blade.alphaStall);
+  blade.cla = ChainGet(_chain, "cla", blade.cla);
+  blade.claStall = ChainGet(_chain, "cla_stall", blade.claStall);
+  blade.cda = ChainGet(_chain, "cda", blade.cda);
+  blade.cdaStall = ChainGet(_chain, "cda_stall", blade.cdaStall);
+  blade.area = ChainGet(_chain, "area", blade.area);
+  blade.airDensity = ChainGet(_chain, "air_density", blade.airDensity);
+  blade.cp = ChainGet(_chain, "cp", blade.cp);
+  blade.forward = ChainGet(_chain, "forward", blade.forward);
+  blade.upward = ChainGet(_chain, "upward", blade.upward);
+  blade.radialSymmetry =
+    ChainGet(_chain, "radial_symmetry", blade.radialSymmetry);
+  this->blades.Add(blade, this->links[_link]->GetInertial()->CoG(), _link);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRotorAeroPlugin::Load(physics::ModelPtr _model,
+  sdf::ElementPtr _sdf)
+{
+  GZ_ASSERT(_model, "ArduPilotRotorAeroPlugin _model pointer is null");
+  GZ_ASSERT(_sdf, "ArduPilotRotorAeroPlugin _sdf pointer is null");
+
+  this->dataPtr->model = _model;
+  this->dataPtr->modelName = _model->GetName();
+  this->dataPtr->traceVehicle = ArduPilotTrace::Intern(_model->GetName());
+
+  sdf::ElementPtr rotorSDF =
+    _sdf->HasElement("rotor") ? _sdf->GetElement("rotor") : nullptr;
+  while (rotorSDF)
+  {
+    const std::string linkName =
+      rotorSDF->Get("link_name", static_cast<std::string>("")).first;
+    physics::LinkPtr link = _model->GetLink(linkName);
+    if (!link)
+    {
+      gzerr << "[" << this->dataPtr->modelName << "] "
+            << "rotor link [" << linkName << "] not found, "
+            << "this plugin will not run.\n";
+      return;
+    }
+    const unsigned int linkIndex = this->dataPtr->LinkIndex(link);
+
+    if (rotorSDF->HasElement("thrustTable"))
+    {
+      TableRotor rotor;
+      rotor.link = linkIndex;
+      if (!rotor.motor.Load(rotorSDF, this->dataPtr->modelName))
+      {
+        return;
+      }
+      const std::string jointName =
+        rotorSDF->Get("joint_name", static_cast<std::string>("")).first;
+      rotor.joint = _model->GetJoint(jointName);
+      if (!rotor.joint)
+      {
+        gzerr << "[" << this->dataPtr->modelName << "] "
+              << "rotor joint [" << jointName << "] not found, "
+              << "this plugin will not run.\n";
+        return;
+      }
+      rotor.axis = rotorSDF->Get("upward",
+        ignition::math::Vector3d::UnitZ).first.Normalize();
+      this->dataPtr->tableRotors.push_back(rotor);
+    }
+
+    sdf::ElementPtr bladeSDF = rotorSDF->HasElement("blade") ?
+      rotorSDF->GetElement("blade") : nullptr;
+    while (bladeSDF)
+    {
+      if (bladeSDF->HasElement("control_joint_name") ||
+          bladeSDF->HasElement("cma"))
+      {
+        gzwarn << "[" << this->dataPtr->modelName << "] "
+               << "blade <control_joint_name> and <cma> are not "
+               << "supported, ignored.\n";
+      }
+      this->dataPtr->AddBlade({bladeSDF, rotorSDF, _sdf}, linkIndex);
+      bladeSDF = bladeSDF->GetNextElement("blade");
+    }
+    rotorSDF = rotorSDF->GetNextElement("rotor");
+  }
+
+  if (this->dataPtr->links.empty())
+  {
+    gzwarn << "[" << this->dataPtr->modelName << "] "
+           << "no <rotor> given, this plugin will not run.\n";
+    return;
+  }
+
+  this->dataPtr->lastUpdateTime = _model->GetWorld()->SimTime();
+  this->dataPtr->updateConnection = event::Events::ConnectWorldUpdateBegin(
+      std::bind(&ArduPilotRotorAeroPlugin::OnUpdate, this));
+
+  gzlog << "[" << this->dataPtr->modelName << "] "
+        << this->dataPtr->blades.Size() << " blades and "
+        << this->dataPtr->tableRotors.size() << " table rotors on "
+        << this->dataPtr->links.size() << " links.\n";
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRotorAeroPlugin::OnUpdate()
+{
+  const common::Time curTime =
+    this->dataPtr->model->GetWorld()->SimTime();
+  ArduPilotTraceScope trace("ArduPilotRotorAeroPlugin::OnUpdate",
+    this->dataPtr->traceVehicle, curTime.Double());
+  const double dt = (curTime - this->dataPtr->lastUpdateTime).Double();
+  this->dataPtr->lastUpdateTime = curTime;
+
+  // one pose and velocity query per link
+  for (size_t i = 0; i < this->dataPtr->links.size(); ++i)
+  {
+    const physics::LinkPtr &link = this->dataPtr->links[i];
+    this->dataPtr->linkStates[i].Set(link->WorldPose().Rot(),
+      link->WorldCoGLinearVel(), link->WorldAngularVel());
+  }
+
+  this->dataPtr->blades.Update(this->dataPtr->linkStates.data());
+
+  for (TableRotor &rotor : this->dataPtr->tableRotors)
+  {
+    ArduPilotBladeLink &l = this->dataPtr->linkStates[rotor.link];
+    const double jointVel = rotor.joint->GetVelocity(0);
+    rotor.speed += (std::fabs(jointVel) - rotor.speed) *
+      rotor.motor.LagFactor(dt);
+    const double thrust = rotor.motor.Thrust(rotor.speed);
+    // drag torque opposes the rotation
+    const double torque = jointVel >= 0.0 ?
+      -rotor.motor.Torque(rotor.speed) : rotor.motor.Torque(rotor.speed);
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+      const double *r = l.rot + 3 * k;
+      const double axis = r[0] * rotor.axis.X() + r[1] * rotor.axis.Y() +
+        r[2] * rotor.axis.Z();
+      l.force[k] += thrust * axis;
+      l.torque[k] += torque * axis;
+    }
+  }
+
+  for (size_t i = 0; i < this->dataPtr->links.size(); ++i)
+  {
+    const ArduPilotBladeLink &l = this->dataPtr->linkStates[i];
+    this->dataPtr->links[i]->AddForce(
+      ignition::math::Vector3d(l.force[0], l.force[1], l.force[2]));
+    this->dataPtr->links[i]->AddTorque(
+      ignition::math::Vector3d(l.torque[0], l.torque[1], l.torque[2]));
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "include/ArduPilotRoundTrip.hh"
+
+using namespace gazebo;
+
+/////////////////////////////////////////////////
+int64_t ArduPilotRoundTrip::Now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRoundTrip::Sent(const int64_t _ns)
+{
+  this->sentNs = _ns;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotRoundTrip::Received(const int64_t _ns)
+{
+  // only the first servo packet to arrive after a state packet answers it
+  int64_t sent = this->sentNs;
+  if (sent == 0 || _ns < sent ||
+      !this->sentNs.compare_exchange_strong(sent, 0))
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->window[this->head] = _ns - sent;
+  this->head = (this->head + 1) % ROUND_TRIP_WINDOW;
+  ++this->total;
+}
+
+/////////////////////////////////////////////////
+ArduPilotRoundTrip::Summary ArduPilotRoundTrip::Get() const
+{
+  Summary summary;
+  std::vector<int64_t> samples;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    summary.total = this->total;
+    const size_t count = static_cast<size_t>(
+      std::min<uint64_t>(this->total, ROUND_TRIP_WINDOW));
+    samples.assign(this->window, this->window + count);
+  }
+  if (samples.empty())
+  {
+    return summary;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&samples](const double _p)
+  {
+    const size_t i = static_cast<size_t>(_p * (samples.size() - 1) + 0.5);
+    return 1e-3 * samples[i];
+  };
+  summary.count = samples.size();
+  summary.min = 1e-3 * samples.front();
+  summary.p50 = percentile(0.5);
+  summary.p90 = percentile(0.9);
+  summary.p99 = percentile(0.99);
+  summary.max = 1e-3 * samples.back();
+  return summary;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifdef __linux__
+  #include <sys/syscall.h>
+#endif
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "include/ArduPilotTrace.hh"
+
+/// \brief Events each thread can hold before the writer catches up
+#define TRACE_RING_SIZE 16384
+
+namespace gazebo
+{
+  /// \brief One begin or end event
+  struct ArduPilotTraceEvent
+  {
+    /// \brief Event name
+    const char *name;
+
+    /// \brief Vehicle name, begin events only
+    const char *vehicle;
+
+    /// \brief Steady clock time, nanoseconds
+    int64_t tsNs;
+
+    /// \brief Sim time, begin events only
+    double simTime;
+
+    /// \brief 'B' or 'E'
+    char phase;
+  };
+
+  /// \brief Single-producer single-consumer event ring of one thread
+  struct ArduPilotTraceRing
+  {
+    /// \brief Events
+    ArduPilotTraceEvent events[TRACE_RING_SIZE];
+
+    /// \brief Next slot written by the owning thread
+    std::atomic<uint32_t> head{0};
+
+    /// \brief Next slot read by the writer
+    std::atomic<uint32_t> tail{0};
+
+    /// \brief Events dropped because the ring was full
+    std::atomic<uint64_t> dropped{0};
+
+    /// \brief Thread id shown in the timeline
+    int64_t tid = 0;
+  };
+
+  /// \brief Owns the output file, the rings and the writer thread
+  class ArduPilotTraceWriter
+  {
+    /// \brief Constructor, opens ARDUPILOT_GAZEBO_TRACE if set
+    public: ArduPilotTraceWriter();
+
+    /// \brief Destructor, writes out the rest and closes the file
+    public: ~ArduPilotTraceWriter();
+
+    /// \brief Ring of the calling thread, created on first use
+    /// \return Ring.
+    public: ArduPilotTraceRing &Ring();
+
+    /// \brief Write out every pending event
+    public: void Drain();
+
+    /// \brief Intern a name
+    /// \param[in] _name Name.
+    /// \return Stable copy, escaped for JSON.
+    public: const char *Intern(const std::string &_name);
+
+    /// \brief Writer thread loop
+    private: void Run();
+
+    /// \brief Output file
+    private: FILE *file = nullptr;
+
+    /// \brief Whether an event was already written, for separators
+    private: bool first = true;
+
+    /// \brief Process id shown in the timeline
+    private: int64_t pid = 0;
+
+    /// \brief Protects rings, names and the file
+    private: std::mutex mutex;
+
+    /// \brief Rings of every thread that traced, kept after it exits
+    private: std::vector<std::shared_ptr<ArduPilotTraceRing>> rings;
+
+    /// \brief Interned names
+    private: std::deque<std::string> names;
+
+    /// \brief Wakes the writer thread for shutdown
+    private: std::condition_variable wake;
+
+    /// \brief Writer thread stop flag
+    private: bool running = false;
+
+    /// \brief Writer thread
+    private: std::thread thread;
+  };
+}
+
+using namespace gazebo;
+
+bool ArduPilotTrace::enabled = false;
+
+/// \brief Process-wide writer
+static ArduPilotTraceWriter traceWriter;
+
+/////////////////////////////////////////////////
+ArduPilotTraceWriter::ArduPilotTraceWriter()
+{
+  const char *path = std::getenv("ARDUPILOT_GAZEBO_TRACE");
+  if (!path || !*path)
+  {
+    return;
+  }
+
+  this->file = std::fopen(path, "w");
+  if (!this->file)
+  {
+    std::fprintf(stderr, "ArduPilotTrace: cannot open [%s]\n", path);
+    return;
+  }
+  // JSON array format, the closing bracket is optional so a trace cut short
+  // by a crash still loads
+  std::fputs("[\n", this->file);
+  #ifndef _WIN32
+  this->pid = getpid();
+  #endif
+
+  this->running = true;
+  this->thread = std::thread(&ArduPilotTraceWriter::Run, this);
+  ArduPilotTrace::enabled = true;
+}
+
+/////////////////////////////////////////////////
+ArduPilotTraceWriter::~ArduPilotTraceWriter()
+{
+  if (!this->file)
+  {
+    return;
+  }
+  ArduPilotTrace::enabled = false;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = false;
+  }
+  this->wake.notify_one();
+  if (this->thread.joinable())
+  {
+    this->thread.join();
+  }
+  this->Drain();
+
+  uint64_t dropped = 0;
+  for (const auto &ring : this->rings)
+  {
+    dropped += ring->dropped;
+  }
+  if (dropped > 0)
+  {
+    std::fprintf(stderr, "ArduPilotTrace: dropped %llu events\n",
+      static_cast<unsigned long long>(dropped));
+  }
+  std::fputs("\n]\n", this->file);
+  std::fclose(this->file);
+}
+
+/////////////////////////////////////////////////
+ArduPilotTraceRing &ArduPilotTraceWriter::Ring()
+{
+  thread_local std::shared_ptr<ArduPilotTraceRing> ring;
+  if (!ring)
+  {
+    ring = std::make_shared<ArduPilotTraceRing>();
+    #ifdef __linux__
+    ring->tid = syscall(SYS_gettid);
+    #endif
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (ring->tid == 0)
+    {
+      ring->tid = static_cast<int64_t>(this->rings.size()) + 1;
+    }
+    this->rings.push_back(ring);
+  }
+  return *ring;
+}
+
+/////////////////////////////////////////////////
+const char *ArduPilotTraceWriter::Intern(const std::string &_name)
+{
+  std::string escaped;
+  for (const char c : _name)
+  {
+    if (c == '"' || c == '\\')
+    {
+      escaped += '\\';
+    }
+    if (static_cast<unsigned char>(c) >= 0x20)
+    {
+      escaped += c;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (const auto &name : this->names)
+  {
+    if (name == escaped)
+    {
+      return name.c_str();
+    }
+  }
+  this->names.push_back(escaped);
+  return this->names.back().c_str();
+}
+
+/////////////////////////////////////////////////
+void ArduPilotTraceWriter::Drain()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->file)
+  {
+    return;
+  }
+  for (const auto &ring : this->rings)
+  {
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    const uint32_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; ++tail)
+    {
+      const ArduPilotTraceEvent &e = ring->events[tail % TRACE_RING_SIZE];
+      std::fputs(this->first ? "" : ",\n", this->file);
+      this->first = false;
+      if (e.phase == 'B')
+      {
+        std::fprintf(this->file,
+          "{\"name\":\"%s\",\"cat\":\"ardupilot\",\"ph\":\"B\","
+          "\"ts\":%.3f,\"pid\":%lld,\"tid\":%lld,"
+          "\"args\":{\"vehicle\":\"%s\",\"sim_time\":%.6f}}",
+          e.name, e.tsNs * 1e-3, static_cast<long long>(this->pid),
+          static_cast<long long>(ring->tid), e.vehicle, e.simTime);
+      }
+      else
+      {
+        std::fprintf(this->file,
+          "{\"name\":\"%s\",\"cat\":\"ardupilot\",\"ph\":\"E\","
+          "\"ts\":%.3f,\"pid\":%lld,\"tid\":%lld}",
+          e.name, e.tsNs * 1e-3, static_cast<long long>(this->pid),
+          static_cast<long long>(ring->tid));
+      }
+    }
+    ring->tail.store(tail, std::memory_order_release);
+  }
+  std::fflush(this->file);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotTraceWriter::Run()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (this->running)
+  {
+    this->wake.wait_for(lock, std::chrono::milliseconds(100));
+    lock.unlock();
+    this->Drain();
+    lock.lock();
+  }
+}
+
+/// \brief Append an event to the calling thread's ring
+/// \param[in] _event Event.
+/// \param[in] _reserve Slots that must stay free after this event, so a
+/// begin event always leaves room for its end event.
+/// \return False if the ring was full and the event dropped.
+static inline bool Push(const ArduPilotTraceEvent &_event,
+  const uint32_t _reserve)
+{
+  ArduPilotTraceRing &ring = traceWriter.Ring();
+  const uint32_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) + _reserve >=
+      TRACE_RING_SIZE)
+  {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  ring.events[head % TRACE_RING_SIZE] = _event;
+  ring.head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+/// \brief Steady clock reading
+/// \return Nanoseconds.
+static inline int64_t Now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/////////////////////////////////////////////////
+const char *ArduPilotTrace::Intern(const std::string &_name)
+{
+  return traceWriter.Intern(_name);
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotTrace::Begin(const char *_name, const char *_vehicle,
+  const double _simTime)
+{
+  // keep room for the end events of the scopes that may be open
+  return Push({_name, _vehicle, Now(), _simTime, 'B'}, 16);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotTrace::End(const char *_name)
+{
+  Push({_name, nullptr, Now(), 0.0, 'E'}, 0);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotTrace::Flush()
+{
+  if (enabled)
+  {
+    traceWriter.Drain();
+  }
+}
@@ -0,0 +1,808 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <fcntl.h>
+#ifdef _WIN32
+  #include <Winsock2.h>
+  #include <Ws2def.h>
+  #include <Ws2ipdef.h>
+  #include <Ws2tcpip.h>
+  using raw_type = char;
+#else
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <arpa/inet.h>
+  #include <unistd.h>
+  using raw_type = void;
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <gazebo/common/common.hh>
+#include "shim/ardupilot_shm.h"
+#include "include/ArduPilotReactor.hh"
+#include "include/ArduPilotRoundTrip.hh"
+#include "include/ArduPilotTransport.hh"
+
+using namespace gazebo;
+
+/////////////////////////////////////////////////
+ArduPilotSocketPrivate::ArduPilotSocketPrivate()
+  : fd(-1)
+{
+  memset(&this->peer, 0, sizeof(this->peer));
+}
+
+/////////////////////////////////////////////////
+ArduPilotSocketPrivate::~ArduPilotSocketPrivate()
+{
+  if (fd != -1)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  #ifndef _WIN32
+  if (!this->boundPath.empty())
+  {
+    unlink(this->boundPath.c_str());
+  }
+  #endif
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketPrivate::Open(const int _family)
+{
+  if (this->fd != -1)
+  {
+    return true;
+  }
+
+  // initialize datagram socket
+  this->fd = socket(_family, SOCK_DGRAM, 0);
+  if (this->fd == -1)
+  {
+    return false;
+  }
+  #ifndef _WIN32
+  // Windows does not support FD_CLOEXEC
+  fcntl(this->fd, F_SETFD, FD_CLOEXEC);
+  #endif
+  return true;
+}
+
+/////////////////////////////////////////////////
+int ArduPilotSocketPrivate::Fd() const
+{
+  return this->fd;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotSocketPrivate::Close()
+{
+  shutdown(this->fd, 0);
+  #ifdef _WIN32
+  closesocket(this->fd);
+  #else
+  close(this->fd);
+  #endif
+  this->fd = -1;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketPrivate::Bind(const std::string &_address,
+  const uint16_t _port)
+{
+  struct sockaddr_storage sockaddr;
+  socklen_t len;
+  if (!MakeSocketAddress(_address, _port, sockaddr, len) ||
+      !this->Open(sockaddr.ss_family))
+  {
+    return false;
+  }
+
+  #ifndef _WIN32
+  if (sockaddr.ss_family == AF_UNIX)
+  {
+    // remove a stale socket left by a previous run, never anything else
+    // a mistyped address might name
+    const std::string path = _address.substr(sizeof(kUnixSocketPrefix) - 1);
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+      unlink(path.c_str());
+    }
+    this->boundPath = path;
+  }
+  #endif
+
+  if (bind(this->fd, (struct sockaddr *)&sockaddr, len) != 0)
+  {
+    this->Close();
+    this->boundPath.clear();
+    return false;
+  }
+  int one = 1;
+  setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR,
+      reinterpret_cast<const char *>(&one), sizeof(one));
+  #ifdef SO_TIMESTAMPNS
+  // have the kernel stamp each datagram's arrival, see RecvBatch
+  setsockopt(this->fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+  #endif
+
+  #ifdef _WIN32
+  u_long on = 1;
+  ioctlsocket(this->fd, FIONBIO,
+            reinterpret_cast<u_long FAR *>(&on));
+  #else
+  fcntl(this->fd, F_SETFL,
+      fcntl(this->fd, F_GETFL, 0) | O_NONBLOCK);
+  #endif
+  return true;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketPrivate::Connect(const std::string &_address,
+  const uint16_t _port)
+{
+  struct sockaddr_storage sockaddr;
+  socklen_t len;
+  if (!MakeSocketAddress(_address, _port, sockaddr, len) ||
+      !this->Open(sockaddr.ss_family))
+  {
+    return false;
+  }
+
+  #ifndef _WIN32
+  if (sockaddr.ss_family == AF_UNIX)
+  {
+    // connect() would fail until ArduPilot has bound its path, so keep
+    // the address and send with sendto() instead
+    this->peer = sockaddr;
+    this->peerLen = len;
+  }
+  else
+  #endif
+  if (connect(this->fd, (struct sockaddr *)&sockaddr, len) != 0)
+  {
+    this->Close();
+    return false;
+  }
+  int one = 1;
+  setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR,
+      reinterpret_cast<const char *>(&one), sizeof(one));
+
+  #ifdef _WIN32
+  u_long on = 1;
+  ioctlsocket(this->fd, FIONBIO,
+            reinterpret_cast<u_long FAR *>(&on));
+  #else
+  fcntl(this->fd, F_SETFL,
+      fcntl(this->fd, F_GETFL, 0) | O_NONBLOCK);
+  #endif
+  return true;
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotSocketPrivate::Send(const void *_buf, size_t _size)
+{
+  if (this->peerLen > 0)
+  {
+    return sendto(this->fd, reinterpret_cast<const raw_type *>(_buf), _size,
+      0, (struct sockaddr *)&this->peer, this->peerLen);
+  }
+  return send(this->fd, reinterpret_cast<const raw_type *>(_buf), _size, 0);
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotSocketPrivate::SendTo(const void *_buf, size_t _size,
+  const struct sockaddr_storage &_addr, const socklen_t _addrLen)
+{
+  return sendto(this->fd, reinterpret_cast<const raw_type *>(_buf), _size,
+    0, reinterpret_cast<const struct sockaddr *>(&_addr), _addrLen);
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotSocketPrivate::Recv(void *_buf, const size_t _size,
+  uint32_t _timeoutMs)
+{
+  if (!this->WaitReadable(_timeoutMs))
+  {
+      return -1;
+  }
+
+  #ifdef _WIN32
+  return recv(this->fd, reinterpret_cast<char *>(_buf), _size, 0);
+  #else
+  return recv(this->fd, _buf, _size, 0);
+  #endif
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketPrivate::WaitReadable(uint32_t _timeoutMs)
+{
+  fd_set fds;
+  struct timeval tv;
+
+  FD_ZERO(&fds);
+  FD_SET(this->fd, &fds);
+
+  tv.tv_sec = _timeoutMs / 1000;
+  tv.tv_usec = (_timeoutMs % 1000) * 1000UL;
+
+  return select(this->fd+1, &fds, NULL, NULL, &tv) == 1;
+}
+
+/////////////////////////////////////////////////
+unsigned ArduPilotSocketPrivate::RecvBatch(ServoPacket *_slots,
+  ssize_t *_sizes, const unsigned _count, int64_t *_stampsNs,
+  struct sockaddr_storage *_source, socklen_t *_sourceLen)
+{
+  #if defined(__linux__)
+  struct iovec iov[SERVO_RING_SIZE];
+  struct mmsghdr msgs[SERVO_RING_SIZE];
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+  } control[SERVO_RING_SIZE];
+  struct sockaddr_storage sources[SERVO_RING_SIZE];
+  const unsigned count = std::min(_count, static_cast<unsigned>(
+    SERVO_RING_SIZE));
+  memset(msgs, 0, sizeof(msgs[0]) * count);
+  for (unsigned i = 0; i < count; ++i)
+  {
+    iov[i].iov_base = &_slots[i];
+    iov[i].iov_len = sizeof(ServoPacket);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    if (_stampsNs)
+    {
+      msgs[i].msg_hdr.msg_control = control[i].buf;
+      msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+    }
+    if (_source)
+    {
+      msgs[i].msg_hdr.msg_name = &sources[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+    }
+  }
+
+  const int received = recvmmsg(this->fd, msgs, count, MSG_DONTWAIT, NULL);
+  if (received <= 0)
+  {
+    return 0;
+  }
+  for (int i = 0; i < received; ++i)
+  {
+    _sizes[i] = msgs[i].msg_len;
+  }
+  if (_source)
+  {
+    *_source = sources[received - 1];
+    *_sourceLen = msgs[received - 1].msg_hdr.msg_namelen;
+  }
+  if (_stampsNs)
+  {
+    int64_t now = 0;
+    for (int i = 0; i < received; ++i)
+    {
+      _stampsNs[i] = 0;
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+           cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+      {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+          struct timespec ts;
+          memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+          _stampsNs[i] = ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+        }
+      }
+      if (_stampsNs[i] == 0)
+      {
+        // no kernel timestamp, fall back to the time we read it
+        now = now ? now : ArduPilotRoundTrip::Now();
+        _stampsNs[i] = now;
+      }
+    }
+  }
+  return static_cast<unsigned>(received);
+  #else
+  unsigned received = 0;
+  while (received < _count)
+  {
+    struct sockaddr_storage source;
+    socklen_t sourceLen = sizeof(source);
+    #ifdef _WIN32
+    const ssize_t size = recvfrom(this->fd,
+      reinterpret_cast<char *>(&_slots[received]), sizeof(ServoPacket), 0,
+      reinterpret_cast<struct sockaddr *>(&source), &sourceLen);
+    #else
+    const ssize_t size = recvfrom(this->fd, &_slots[received],
+      sizeof(ServoPacket), 0, reinterpret_cast<struct sockaddr *>(&source),
+      &sourceLen);
+    #endif
+    if (size < 0)
+    {
+      break;
+    }
+    if (_stampsNs)
+    {
+      _stampsNs[received] = ArduPilotRoundTrip::Now();
+    }
+    if (_source)
+    {
+      *_source = source;
+      *_sourceLen = sourceLen;
+    }
+    _sizes[received++] = size;
+  }
+  return received;
+  #endif
+}
+
+/////////////////////////////////////////////////
+std::unique_ptr<ArduPilotTransport> ArduPilotTransport::Create(
+  sdf::ElementPtr _sdf)
+{
+  const std::string type =
+    _sdf->Get("transport", static_cast<std::string>("udp")).first;
+
+  const bool sharedReactor = _sdf->Get("sharedReactor", false).first;
+
+  std::unique_ptr<ArduPilotTransport> transport;
+  if (type == "udp" && sharedReactor)
+  {
+    #ifdef __linux__
+    transport.reset(new ArduPilotReactorTransport);
+    #else
+    gzwarn << "<sharedReactor> is not supported on this platform, ignored.\n";
+    transport.reset(new ArduPilotSocketTransport);
+    #endif
+  }
+  else if (type == "udp")
+  {
+    transport.reset(new ArduPilotSocketTransport);
+  }
+  else if (type == "shm")
+  {
+    transport.reset(new ArduPilotShmTransport);
+  }
+
+  if (transport && sharedReactor && type != "udp")
+  {
+    gzwarn << "<sharedReactor> only applies to the udp transport, ignored.\n";
+  }
+
+  if (transport && sharedReactor && type == "udp" &&
+      _sdf->Get("ioThread", false).first)
+  {
+    gzwarn << "<ioThread> is ignored with <sharedReactor>, the reactor "
+           << "already serves every vehicle from one wakeup.\n";
+  }
+  else if (transport && _sdf->Get("ioThread", false).first)
+  {
+    #ifdef _WIN32
+    gzwarn << "<ioThread> is not supported on this platform, ignored.\n";
+    #else
+    transport.reset(new ArduPilotThreadedTransport(std::move(transport)));
+    #endif
+  }
+  return transport;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotTransport::DrainedPacketCount() const
+{
+  return this->drainedPacketCount;
+}
+
+/////////////////////////////////////////////////
+const ArduPilotRoundTrip *ArduPilotTransport::RoundTrip() const
+{
+  return nullptr;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketTransport::RepliesToSender(sdf::ElementPtr _sdf)
+{
+  const bool json =
+    _sdf->Get("protocol", static_cast<std::string>("legacy")).first ==
+    "json";
+  return _sdf->Get("replyToSender", json).first;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketTransport::Open(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  if (!this->OpenReceive(_sdf, _modelName))
+  {
+    return false;
+  }
+
+  const std::string fdm_addr =
+    _sdf->Get("fdm_addr", static_cast<std::string>("127.0.0.1")).first;
+  const uint16_t fdm_port_out =
+    _sdf->Get("fdm_port_out", static_cast<uint32_t>(9006)).first;
+  if (!this->replyToSender &&
+      !this->socket_out.Connect(fdm_addr, fdm_port_out))
+  {
+    gzerr << "[" << _modelName << "] "
+          << "failed to bind with " << fdm_addr;
+    if (!IsUnixSocketAddress(fdm_addr))
+    {
+      gzerr << ":" << fdm_port_out;
+    }
+    gzerr << " aborting plugin.\n";
+    return false;
+  }
+
+  this->realtime.ApplyToSocket(this->socket_out.Fd(), "fdm socket");
+  return true;
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotSocketTransport::OpenReceive(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  const std::string listen_addr =
+    _sdf->Get("listen_addr", static_cast<std::string>("127.0.0.1")).first;
+  const uint16_t fdm_port_in =
+    _sdf->Get("fdm_port_in", static_cast<uint32_t>(9007)).first;
+
+  if (!this->socket_in.Bind(listen_addr, fdm_port_in))
+  {
+    gzerr << "[" << _modelName << "] "
+          << "failed to bind with " << listen_addr;
+    if (!IsUnixSocketAddress(listen_addr))
+    {
+      gzerr << ":" << fdm_port_in;
+    }
+    gzerr << " aborting plugin.\n";
+    return false;
+  }
+
+  this->replyToSender = RepliesToSender(_sdf);
+  this->realtime.Load(_sdf, _modelName);
+  this->realtime.ApplyToSocket(this->socket_in.Fd(), "servo socket");
+  return true;
+}
+
+/////////////////////////////////////////////////
+const ArduPilotRealtime &ArduPilotSocketTransport::Realtime() const
+{
+  return this->realtime;
+}
+
+/////////////////////////////////////////////////
+const ServoPacket *ArduPilotSocketTransport::ReceiveLatest(
+  uint32_t _timeoutMs, ssize_t &_size)
+{
+  if (!this->socket_in.WaitReadable(_timeoutMs))
+  {
+    _size = -1;
+    return nullptr;
+  }
+  return this->Drain(_size);
+}
+
+/////////////////////////////////////////////////
+const ServoPacket *ArduPilotSocketTransport::Drain(ssize_t &_size)
+{
+  // Drain everything queued on the socket in batches and keep only the
+  // newest packet, in the case we're backed up
+  const ServoPacket *newest = nullptr;
+  _size = -1;
+
+  unsigned received = 0;
+  while (true)
+  {
+    const unsigned head = this->servoRingHead;
+    const unsigned span = SERVO_RING_SIZE - head;
+    struct sockaddr_storage source;
+    socklen_t sourceLen = 0;
+    const unsigned n = this->socket_in.RecvBatch(
+      &this->servoRing[head], &this->servoRingSizes[head], span,
+      &this->servoRingStamps[head],
+      this->replyToSender ? &source : nullptr, &sourceLen);
+    if (n == 0)
+    {
+      break;
+    }
+    if (sourceLen > 0)
+    {
+      std::lock_guard<std::mutex> lock(this->replyMutex);
+      this->replyPeer = source;
+      this->replyPeerLen = sourceLen;
+    }
+    newest = &this->servoRing[head + n - 1];
+    _size = this->servoRingSizes[head + n - 1];
+    for (unsigned i = 0; i < n; ++i)
+    {
+      this->roundTrip.Received(this->servoRingStamps[head + i]);
+    }
+    this->servoRingHead = (head + n) % SERVO_RING_SIZE;
+    received += n;
+    if (n < span)
+    {
+      break;
+    }
+  }
+  if (received > 1)
+  {
+    this->drainedPacketCount += received - 1;
+  }
+  return newest;
+}
+
+/////////////////////////////////////////////////
+int ArduPilotSocketTransport::ReceiveFd() const
+{
+  return this->socket_in.Fd();
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotSocketTransport::Send(const void *_buf, size_t _size)
+{
+  if (this->replyToSender)
+  {
+    struct sockaddr_storage peer;
+    socklen_t peerLen;
+    {
+      std::lock_guard<std::mutex> lock(this->replyMutex);
+      peer = this->replyPeer;
+      peerLen = this->replyPeerLen;
+    }
+    if (peerLen == 0)
+    {
+      // nobody to answer yet
+      return -1;
+    }
+    this->Sent();
+    return this->socket_in.SendTo(_buf, _size, peer, peerLen);
+  }
+
+  this->Sent();
+  return this->socket_out.Send(_buf, _size);
+}
+
+/////////////////////////////////////////////////
+void ArduPilotSocketTransport::Sent()
+{
+  this->roundTrip.Sent(ArduPilotRoundTrip::Now());
+}
+
+/////////////////////////////////////////////////
+const ArduPilotRoundTrip *ArduPilotSocketTransport::RoundTrip() const
+{
+  return &this->roundTrip;
+}
+
+/////////////////////////////////////////////////
+ArduPilotShmTransport::~ArduPilotShmTransport()
+{
+  ap_shm_close(this->shm);
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotShmTransport::Open(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  const std::string name = _sdf->Get("shm_name",
+    "/ardupilot_gazebo_" + _modelName).first;
+
+  this->shm = ap_shm_open(name.c_str(), AP_SHM_SIMULATOR);
+  if (!this->shm)
+  {
+    gzerr << "[" << _modelName << "] "
+          << "failed to create shared memory [" << name << "]: "
+          << strerror(errno) << ", aborting plugin.\n";
+    return false;
+  }
+
+  gzmsg << "[" << _modelName << "] "
+        << "waiting for ArduPilot on shared memory [" << name << "].\n";
+  return true;
+}
+
+/////////////////////////////////////////////////
+const ServoPacket *ArduPilotShmTransport::ReceiveLatest(uint32_t _timeoutMs,
+  ssize_t &_size)
+{
+  unsigned drained = 0;
+  _size = ap_shm_recv_latest(this->shm, &this->pkt, sizeof(this->pkt),
+    _timeoutMs, &drained);
+  this->drainedPacketCount += drained;
+  return _size < 0 ? nullptr : &this->pkt;
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotShmTransport::Send(const void *_buf, size_t _size)
+{
+  return ap_shm_send(this->shm, _buf, _size) == 0 ?
+    static_cast<ssize_t>(_size) : -1;
+}
+
+/////////////////////////////////////////////////
+ArduPilotThreadedTransport::ArduPilotThreadedTransport(
+  std::unique_ptr<ArduPilotTransport> _inner)
+  : inner(std::move(_inner))
+{
+}
+
+/////////////////////////////////////////////////
+ArduPilotThreadedTransport::~ArduPilotThreadedTransport()
+{
+  this->running = false;
+  this->fdmEvent.Signal();
+  if (this->receiver.joinable())
+  {
+    this->receiver.join();
+  }
+  if (this->sender.joinable())
+  {
+    this->sender.join();
+  }
+}
+
+/////////////////////////////////////////////////
+bool ArduPilotThreadedTransport::Open(sdf::ElementPtr _sdf,
+  const std::string &_modelName)
+{
+  if (!this->inner->Open(_sdf, _modelName))
+  {
+    return false;
+  }
+
+  if (!this->servoEvent.Valid() || !this->fdmEvent.Valid())
+  {
+    gzerr << "[" << _modelName << "] "
+          << "failed to create I/O thread events, aborting plugin.\n";
+    return false;
+  }
+
+  this->realtime.Load(_sdf, _modelName);
+  this->running = true;
+  this->receiver = std::thread(&ArduPilotThreadedTransport::ReceiveLoop,
+    this);
+  this->sender = std::thread(&ArduPilotThreadedTransport::SendLoop, this);
+  return true;
+}
+
+/////////////////////////////////////////////////
+void ArduPilotThreadedTransport::ReceiveLoop()
+{
+  this->realtime.ApplyToThread("I/O receiver thread");
+  uint64_t seq = 0;
+  while (this->running)
+  {
+    // block here rather than on the physics thread, waking up regularly
+    // to notice shutdown
+    ssize_t size;
+    const ServoPacket *pkt = this->inner->ReceiveLatest(100, size);
+    if (!pkt)
+    {
+      continue;
+    }
+
+    ServoSlot &slot = this->servoBox.Back();
+    memcpy(&slot.pkt, pkt, std::min(static_cast<size_t>(size),
+      sizeof(slot.pkt)));
+    slot.size = size;
+    slot.seq = ++seq;
+    this->servoBox.Publish();
+
+    // pairs with the fence in ReceiveLatest: either the physics thread
+    // fetches this packet or we see it waiting, a store followed by a load
+    // of another variable needs a full fence on both sides for that
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->physicsWaiting.load(std::memory_order_seq_cst))
+    {
+      this->servoEvent.Signal();
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+void ArduPilotThreadedTransport::SendLoop()
+{
+  this->realtime.ApplyToThread("I/O sender thread");
+  while (this->running)
+  {
+    this->fdmEvent.Wait(100);
+    if (this->fdmBox.Fetch())
+    {
+      const FdmSlot &slot = this->fdmBox.Front();
+      this->inner->Send(slot.data, slot.size);
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+const ServoPacket *ArduPilotThreadedTransport::ReceiveLatest(
+  uint32_t _timeoutMs, ssize_t &_size)
+{
+  bool fresh = this->servoBox.Fetch();
+  if (!fresh && _timeoutMs > 0)
+  {
+    // lockstep has to wait: ask the receiver thread for a wakeup, then
+    // check again in case the packet landed in between
+    this->physicsWaiting.store(true, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const common::Time deadline = common::Time::GetWallTime() +
+      common::Time(0, static_cast<int32_t>(_timeoutMs % 1000) * 1000000) +
+      common::Time(static_cast<int32_t>(_timeoutMs / 1000), 0);
+    while (!(fresh = this->servoBox.Fetch()))
+    {
+      const double remaining =
+        (deadline - common::Time::GetWallTime()).Double();
+      if (remaining <= 0 ||
+          !this->servoEvent.Wait(static_cast<int>(remaining * 1e3) + 1))
+      {
+        break;
+      }
+    }
+    this->physicsWaiting.store(false, std::memory_order_relaxed);
+  }
+
+  if (!fresh)
+  {
+    _size = -1;
+    return nullptr;
+  }
+
+  const ServoSlot &slot = this->servoBox.Front();
+  if (slot.seq > this->lastSeq + 1)
+  {
+    this->drainedPacketCount += slot.seq - this->lastSeq - 1;
+  }
+  this->lastSeq = slot.seq;
+  _size = slot.size;
+  return &slot.pkt;
+}
+
+/////////////////////////////////////////////////
+uint64_t ArduPilotThreadedTransport::DrainedPacketCount() const
+{
+  return this->inner->DrainedPacketCount() + this->drainedPacketCount;
+}
+
+/////////////////////////////////////////////////
+const ArduPilotRoundTrip *ArduPilotThreadedTransport::RoundTrip() const
+{
+  return this->inner->RoundTrip();
+}
+
+/////////////////////////////////////////////////
+ssize_t ArduPilotThreadedTransport::Send(const void *_buf, size_t _size)
+{
+  if (_size > FDM_PACKET_MAX_SIZE)
+  {
+    return -1;
+  }
+  FdmSlot &slot = this->fdmBox.Back();
+  memcpy(slot.data, _buf, _size);
+  slot.size = _size;
+  this->fdmBox.Publish();
+  this->fdmEvent.Signal();
+  return static_cast<ssize_t>(_size);
+}
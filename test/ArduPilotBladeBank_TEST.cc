@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <ignition/math/Helpers.hh>
+#include <ignition/math/Quaternion.hh>
+#include <ignition/math/Vector3.hh>
+#include "include/ArduPilotBladeBank.hh"
+
+using namespace gazebo;
+
+/// \brief Rotor links, each with two opposite blades like the iris
+static const int kLinks = 6;
+
+/// \brief Random link states to compare
+static const int kSteps = 20000;
+
+/// \brief Largest force or torque difference allowed, relative to the
+/// magnitude of the reference. The bank folds the rotation into a matrix
+/// and rho * area into one factor, and acos near an angle of attack of 0
+/// amplifies that last-bit rounding to about 1e-9.
+static const double kTolerance = 1e-7;
+
+/// \brief Force and torque LiftDragPlugin gives one blade
+class Reference
+{
+  /// \brief Force at the link center of gravity, world frame
+  public: ignition::math::Vector3d force;
+
+  /// \brief Torque about the link center of gravity, world frame
+  public: ignition::math::Vector3d torque;
+
+  /// \brief Angle of attack
+  public: double alpha = 0.0;
+
+  /// \brief Whether the blade was fast enough to be evaluated
+  public: bool evaluated = false;
+};
+
+/// \brief LiftDragPlugin::OnUpdate of gazebo 9 to 11, transcribed with the
+/// link queries replaced by the given state: WorldLinearVel(cp) is the
+/// center of gravity velocity plus the rotation about it, and
+/// AddForceAtRelativePosition(force, cp) adds the force and its moment
+/// about the center of gravity. cma is zero as in the iris model.
+/// \param[in] _blade Blade parameters.
+/// \param[in] _cog Link center of gravity, link frame.
+/// \param[in] _rot Link orientation.
+/// \param[in] _cogVel Center of gravity velocity, world frame.
+/// \param[in] _angVel Angular velocity, world frame.
+/// \return Force and torque about the center of gravity.
+static Reference LiftDrag(const ArduPilotBlade &_blade,
+  const ignition::math::Vector3d &_cog,
+  const ignition::math::Quaterniond &_rot,
+  const ignition::math::Vector3d &_cogVel,
+  const ignition::math::Vector3d &_angVel)
+{
+  Reference result;
+  ignition::math::Vector3d forward = _blade.forward;
+  forward.Normalize();
+  ignition::math::Vector3d upward = _blade.upward;
+  upward.Normalize();
+  const ignition::math::Vector3d momentArm =
+    _rot.RotateVector(_blade.cp - _cog);
+
+  // get linear velocity at cp in inertial frame
+  const ignition::math::Vector3d vel = _cogVel + _angVel.Cross(momentArm);
+  ignition::math::Vector3d velI = vel;
+  velI.Normalize();
+
+  if (vel.Length() <= 0.01)
+  {
+    return result;
+  }
+
+  // rotate forward and upward vectors into inertial frame
+  const ignition::math::Vector3d forwardI = _rot.RotateVector(forward);
+
+  ignition::math::Vector3d upwardI;
+  if (_blade.radialSymmetry)
+  {
+    // use inflow velocity to determine upward direction
+    // which is the component of inflow perpendicular to forward direction.
+    ignition::math::Vector3d tmp = forwardI.Cross(velI);
+    upwardI = forwardI.Cross(tmp);
+    upwardI.Normalize();
+  }
+  else
+  {
+    upwardI = _rot.RotateVector(upward);
+  }
+
+  // spanwiseI: a vector normal to lift-drag-plane described in inertial
+  // frame
+  ignition::math::Vector3d spanwiseI = forwardI.Cross(upwardI);
+  spanwiseI.Normalize();
+
+  const double minRatio = -1.0;
+  const double maxRatio = 1.0;
+  // check sweep (angle between velI and lift-drag-plane)
+  const double sinSweepAngle = ignition::math::clamp(
+      spanwiseI.Dot(velI), minRatio, maxRatio);
+
+  // get cos from trig identity
+  const double cosSweepAngle = 1.0 - sinSweepAngle * sinSweepAngle;
+
+  // removing spanwise velocity from vel
+  const ignition::math::Vector3d velInLDPlane =
+    vel - velI * vel.Dot(spanwiseI);
+
+  // get direction of drag
+  ignition::math::Vector3d dragDirection = -velInLDPlane;
+  dragDirection.Normalize();
+
+  // get direction of lift
+  ignition::math::Vector3d liftI = spanwiseI.Cross(velInLDPlane);
+  liftI.Normalize();
+
+  // compute angle between upwardI and liftI
+  const double cosAlpha =
+    ignition::math::clamp(liftI.Dot(upwardI), minRatio, maxRatio);
+
+  double alpha;
+  if (liftI.Dot(forwardI) >= 0.0)
+    alpha = _blade.a0 + acos(cosAlpha);
+  else
+    alpha = _blade.a0 - acos(cosAlpha);
+
+  // normalize to within +/-90 deg
+  while (fabs(alpha) > 0.5 * IGN_PI)
+    alpha = alpha > 0 ? alpha - IGN_PI : alpha + IGN_PI;
+
+  // compute dynamic pressure
+  const double speedInLDPlane = velInLDPlane.Length();
+  const double q = 0.5 * _blade.airDensity * speedInLDPlane * speedInLDPlane;
+
+  // compute cl at cp, check for stall, correct for sweep
+  double cl;
+  if (alpha > _blade.alphaStall)
+  {
+    cl = (_blade.cla * _blade.alphaStall +
+          _blade.claStall * (alpha - _blade.alphaStall))
+         * cosSweepAngle;
+    // make sure cl is still great than 0
+    cl = std::max(0.0, cl);
+  }
+  else if (alpha < -_blade.alphaStall)
+  {
+    cl = (-_blade.cla * _blade.alphaStall +
+          _blade.claStall * (alpha + _blade.alphaStall))
+         * cosSweepAngle;
+    // make sure cl is still less than 0
+    cl = std::min(0.0, cl);
+  }
+  else
+    cl = _blade.cla * alpha * cosSweepAngle;
+
+  // compute lift force at cp
+  const ignition::math::Vector3d lift = liftI * (cl * q * _blade.area);
+
+  // compute cd at cp, check for stall, correct for sweep
+  double cd;
+  if (alpha > _blade.alphaStall)
+  {
+    cd = (_blade.cda * _blade.alphaStall +
+          _blade.cdaStall * (alpha - _blade.alphaStall))
+         * cosSweepAngle;
+  }
+  else if (alpha < -_blade.alphaStall)
+  {
+    cd = (-_blade.cda * _blade.alphaStall +
+          _blade.cdaStall * (alpha + _blade.alphaStall))
+         * cosSweepAngle;
+  }
+  else
+    cd = (_blade.cda * alpha) * cosSweepAngle;
+
+  // make sure drag is positive
+  cd = fabs(cd);
+
+  // drag at cp
+  const ignition::math::Vector3d drag =
+    dragDirection * (cd * q * _blade.area);
+
+  // force about cg in inertial frame
+  ignition::math::Vector3d force = lift + drag;
+  force.Correct();
+
+  result.force = force;
+  result.torque = momentArm.Cross(force);
+  result.alpha = alpha;
+  result.evaluated = true;
+  return result;
+}
+
+/// \brief Whether a result is within tolerance of the reference
+/// \param[in] _value Result.
+/// \param[in] _expected Reference.
+/// \return True if close.
+static bool Near(const ignition::math::Vector3d &_value,
+  const ignition::math::Vector3d &_expected)
+{
+  const double bound = kTolerance * std::max(1.0, _expected.Length());
+  return (_value - _expected).Length() <= bound;
+}
+
+/// \brief Evaluate iris blades, some with <radial_symmetry>, through
+/// ArduPilotBladeBank and through the LiftDragPlugin transcription over
+/// random link orientations, center of gravity offsets, velocities and
+/// rotor speeds, and require the same force on every blade and the same
+/// force and torque on every link. Both stall branches and the
+/// radially symmetric blades must have been exercised.
+/// \return 0 on success, 1 on the first mismatch.
+int main()
+{
+  std::mt19937_64 random(7);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+  // the iris rotor blades of models/iris_with_ardupilot
+  ArduPilotBlade iris;
+  iris.a0 = 0.3;
+  iris.alphaStall = 1.4;
+  iris.cla = 4.25;
+  iris.cda = 0.10;
+  iris.claStall = -0.025;
+  iris.cdaStall = 0.0;
+  iris.area = 0.002;
+  iris.airDensity = 1.2041;
+  iris.upward = ignition::math::Vector3d(0, 0, 1);
+
+  ArduPilotBladeBank bank;
+  std::vector<ArduPilotBlade> blades;
+  std::vector<unsigned int> bladeLinks;
+  std::vector<ignition::math::Vector3d> cogs(kLinks);
+  for (int l = 0; l < kLinks; ++l)
+  {
+    cogs[l] = ignition::math::Vector3d(uniform(random), uniform(random),
+      uniform(random)) * 0.01;
+    const double dir = l % 2 ? 1.0 : -1.0;
+    for (int side = 0; side < 2; ++side)
+    {
+      const double sign = side ? -1.0 : 1.0;
+      ArduPilotBlade blade = iris;
+      blade.cp = ignition::math::Vector3d(0.084 * sign, 0, 0);
+      blade.forward = ignition::math::Vector3d(0, dir * sign, 0);
+      blade.radialSymmetry = l >= kLinks - 2;
+      if (l == kLinks - 1)
+      {
+        // non-unit and tilted directions, normalized on load
+        blade.forward = ignition::math::Vector3d(0.2, 2.0 * dir * sign, 0.1);
+        blade.upward = ignition::math::Vector3d(0.1, 0, 3.0);
+      }
+      bank.Add(blade, cogs[l], l);
+      blades.push_back(blade);
+      bladeLinks.push_back(l);
+    }
+  }
+
+  std::vector<ArduPilotBladeLink> links(kLinks);
+  int aboveStall = 0;
+  int belowStall = 0;
+  int radial = 0;
+  for (int step = 0; step < kSteps; ++step)
+  {
+    std::vector<ignition::math::Quaterniond> rots(kLinks);
+    std::vector<ignition::math::Vector3d> cogVels(kLinks);
+    std::vector<ignition::math::Vector3d> angVels(kLinks);
+    for (int l = 0; l < kLinks; ++l)
+    {
+      rots[l] = ignition::math::Quaterniond(IGN_PI * uniform(random),
+        IGN_PI * uniform(random), IGN_PI * uniform(random));
+      // up to 20 m/s, at times nearly still to hit the speed cutoff
+      const double speed = step % 50 == 0 ? 0.004 : 20.0;
+      cogVels[l] = ignition::math::Vector3d(uniform(random),
+        uniform(random), uniform(random)) * speed;
+      // spinning about the rotor axis up to iris speeds, plus tumbling
+      const double spin = step % 50 == 0 ? 0.0 : 1100.0 * uniform(random);
+      angVels[l] = rots[l].RotateVector(
+        ignition::math::Vector3d(0, 0, spin)) +
+        ignition::math::Vector3d(uniform(random), uniform(random),
+          uniform(random)) * 5.0;
+      links[l].Set(rots[l], cogVels[l], angVels[l]);
+    }
+
+    bank.Update(links.data());
+
+    std::vector<ignition::math::Vector3d> forces(kLinks);
+    std::vector<ignition::math::Vector3d> torques(kLinks);
+    for (size_t i = 0; i < blades.size(); ++i)
+    {
+      const unsigned int l = bladeLinks[i];
+      const Reference ref = LiftDrag(blades[i], cogs[l], rots[l],
+        cogVels[l], angVels[l]);
+      aboveStall += ref.alpha > blades[i].alphaStall;
+      belowStall += ref.alpha < -blades[i].alphaStall;
+      radial += blades[i].radialSymmetry && ref.evaluated;
+      if (!Near(bank.Force(i), ref.force))
+      {
+        std::cerr << "step " << step << " blade " << i << ": force "
+                  << bank.Force(i) << ", LiftDragPlugin " << ref.force
+                  << "\n";
+        return 1;
+      }
+      forces[l] += ref.force;
+      torques[l] += ref.torque;
+    }
+
+    for (int l = 0; l < kLinks; ++l)
+    {
+      const ignition::math::Vector3d force(links[l].force[0],
+        links[l].force[1], links[l].force[2]);
+      const ignition::math::Vector3d torque(links[l].torque[0],
+        links[l].torque[1], links[l].torque[2]);
+      if (!Near(force, forces[l]) || !Near(torque, torques[l]))
+      {
+        std::cerr << "step " << step << " link " << l << ": force "
+                  << force << " torque " << torque << ", LiftDragPlugin "
+                  << forces[l] << " torque " << torques[l] << "\n";
+        return 1;
+      }
+    }
+  }
+
+  if (aboveStall == 0 || belowStall == 0 || radial == 0)
+  {
+    std::cerr << "cases not covered: above stall " << aboveStall
+              << ", below stall " << belowStall << ", radial " << radial
+              << "\n";
+    return 1;
+  }
+
+  std::cout << kSteps * blades.size() << " blade evaluations match "
+            << "LiftDragPlugin, " << aboveStall << " above and "
+            << belowStall << " below stall\n";
+  return 0;
+}
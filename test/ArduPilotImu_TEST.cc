@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <cmath>
+#include <iostream>
+#include <ignition/math/Quaternion.hh>
+#include <ignition/math/Vector3.hh>
+#include <sdf/sdf.hh>
+#include "include/ArduPilotImu.hh"
+
+using namespace gazebo;
+
+/// \brief Physics step, s
+static const double kDt = 0.001;
+
+/// \brief Steps to run each case for
+static const int kSteps = 2000;
+
+/// \brief World gravity, z up like gazebo's default world
+static const ignition::math::Vector3d kGravity(0, 0, -9.8);
+
+/// \brief The iris <modelXYZToAirplaneXForwardZDown> rotation, its model
+/// frame is z up
+static const ignition::math::Quaterniond kBodyRot(IGN_PI, 0, 0);
+
+/// \brief Plugin sdf element, with or without an <imuPose>
+/// \param[in] _imuPose Pose value, nullptr to leave it out.
+/// \return Element.
+static sdf::ElementPtr PluginSdf(const char *_imuPose)
+{
+  sdf::ElementPtr sdf(new sdf::Element);
+  sdf->SetName("plugin");
+  if (_imuPose)
+  {
+    sdf::ElementPtr pose(new sdf::Element);
+    pose->SetName("imuPose");
+    pose->AddValue("pose", _imuPose, true);
+    sdf->InsertElement(pose);
+  }
+  return sdf;
+}
+
+/// \brief Report whether a reading is within a tolerance of the expected
+/// \param[in] _name Case name.
+/// \param[in] _value Reading.
+/// \param[in] _expected Expected reading.
+/// \param[in] _tolerance Largest allowed difference on any axis.
+/// \return True if within tolerance.
+static bool Near(const char *_name, const ignition::math::Vector3d &_value,
+  const ignition::math::Vector3d &_expected, const double _tolerance)
+{
+  const ignition::math::Vector3d error = _value - _expected;
+  if (std::fabs(error.X()) > _tolerance ||
+      std::fabs(error.Y()) > _tolerance ||
+      std::fabs(error.Z()) > _tolerance)
+  {
+    std::cerr << _name << ": read " << _value << ", expected "
+              << _expected << "\n";
+    return false;
+  }
+  return true;
+}
+
+/// \brief Load the IMU pose of the iris plugin sdf, then feed the finite
+/// difference of the synthetic IMU with the velocities of known motions,
+/// step by step:
+/// - at rest with the default pose: the IMU reads -g on z, the iris
+///   model frame is z up but the IMU is z down like its ImuSensor
+/// - at rest with an explicit zero <imuPose>: that z-up pose reads +g
+/// - hovering: the IMU reads -g on z, up through the z-down frame
+/// - free fall: the IMU reads zero
+/// - yawing at a constant rate with the IMU off the axis: the gyro reads
+///   the rate and the IMU the centripetal acceleration toward the axis
+/// \return 0 on success, 1 on the first failure.
+int main()
+{
+  ignition::math::Vector3d angularVel;
+  ignition::math::Vector3d linearAccel;
+
+  const ignition::math::Quaterniond imuRot =
+    ArduPilotImu::LoadPose(PluginSdf(nullptr), kBodyRot).Rot();
+  ArduPilotImu::Difference(ignition::math::Vector3d::Zero,
+    ignition::math::Vector3d::Zero, ignition::math::Vector3d::Zero,
+    ignition::math::Vector3d::Zero, imuRot, kGravity, kDt, angularVel,
+    linearAccel);
+  if (!Near("default pose accel", linearAccel,
+            ignition::math::Vector3d(0, 0, -9.8), 1e-9))
+  {
+    return 1;
+  }
+
+  const ignition::math::Quaterniond zUpRot =
+    ArduPilotImu::LoadPose(PluginSdf("0 0 0 0 0 0"), kBodyRot).Rot();
+  ArduPilotImu::Difference(ignition::math::Vector3d::Zero,
+    ignition::math::Vector3d::Zero, ignition::math::Vector3d::Zero,
+    ignition::math::Vector3d::Zero, zUpRot, kGravity, kDt, angularVel,
+    linearAccel);
+  if (!Near("explicit pose accel", linearAccel,
+            ignition::math::Vector3d(0, 0, 9.8), 1e-9))
+  {
+    return 1;
+  }
+
+  ignition::math::Vector3d lastVel;
+  for (int step = 1; step <= kSteps; ++step)
+  {
+    const ignition::math::Vector3d vel;
+    ArduPilotImu::Difference(lastVel, ignition::math::Vector3d::Zero, vel,
+      ignition::math::Vector3d::Zero, imuRot, kGravity, kDt, angularVel,
+      linearAccel);
+    if (!Near("hover accel", linearAccel,
+               ignition::math::Vector3d(0, 0, -9.8), 1e-9) ||
+        !Near("hover gyro", angularVel, ignition::math::Vector3d::Zero,
+              1e-12))
+    {
+      return 1;
+    }
+    lastVel = vel;
+  }
+
+  lastVel = ignition::math::Vector3d(1, 2, 0);
+  for (int step = 1; step <= kSteps; ++step)
+  {
+    const ignition::math::Vector3d vel =
+      ignition::math::Vector3d(1, 2, 0) + kGravity * (step * kDt);
+    ArduPilotImu::Difference(lastVel, ignition::math::Vector3d::Zero, vel,
+      ignition::math::Vector3d::Zero, imuRot, kGravity, kDt, angularVel,
+      linearAccel);
+    if (!Near("free fall accel", linearAccel,
+              ignition::math::Vector3d::Zero, 1e-6))
+    {
+      return 1;
+    }
+    lastVel = vel;
+  }
+
+  // IMU 0.1 m ahead of the yaw axis, hovering while yawing at 2 rad/s;
+  // the centripetal term is rate^2 * radius = 0.4 m/s^2 toward the axis,
+  // i.e. along -x of the IMU, to first order in the step
+  const double rate = 2.0;
+  const double radius = 0.1;
+  const ignition::math::Vector3d omega(0, 0, rate);
+  lastVel = omega.Cross(ignition::math::Vector3d(radius, 0, 0));
+  for (int step = 1; step <= kSteps; ++step)
+  {
+    const double yaw = rate * step * kDt;
+    const ignition::math::Quaterniond bodyRot(0, 0, yaw);
+    const ignition::math::Vector3d vel =
+      omega.Cross(bodyRot.RotateVector(ignition::math::Vector3d(radius, 0,
+        0)));
+    ArduPilotImu::Difference(lastVel, omega, vel, omega, bodyRot * imuRot,
+      kGravity, kDt, angularVel, linearAccel);
+    if (!Near("yaw accel", linearAccel,
+              ignition::math::Vector3d(-rate * rate * radius, 0, -9.8),
+              rate * rate * radius * rate * kDt) ||
+        !Near("yaw gyro", angularVel, ignition::math::Vector3d(0, 0, -rate),
+              1e-9))
+    {
+      return 1;
+    }
+    lastVel = vel;
+  }
+
+  std::cout << "synthetic imu hover, free fall and yaw readings match\n";
+  return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include <gazebo/common/PID.hh>
+#include <gazebo/common/Time.hh>
+#include "include/ArduPilotPidBank.hh"
+
+using namespace gazebo;
+
+/// \brief Loops in the bank, not a multiple of kLanes so the padding lanes
+/// are exercised too
+static const int kLoops = 13;
+
+/// \brief Steps to run
+static const int kSteps = 200000;
+
+/// \brief Whether two doubles have the same bits
+/// \param[in] _a First value.
+/// \param[in] _b Second value.
+/// \return True if identical.
+static bool SameBits(const double _a, const double _b)
+{
+  uint64_t a;
+  uint64_t b;
+  memcpy(&a, &_a, sizeof(a));
+  memcpy(&b, &_b, sizeof(b));
+  return a == b;
+}
+
+/// \brief Update random PIDs through ArduPilotPidBank and through
+/// common::PID side by side and require every command to be identical bit
+/// for bit. Gains and limits are random, some limits are zero (unlimited),
+/// errors are sometimes NaN or infinite and some steps are zero.
+/// \return 0 on success, 1 on the first mismatch.
+int main()
+{
+  std::mt19937_64 random(42);
+  std::uniform_real_distribution<double> uniform(-3.0, 3.0);
+
+  std::vector<common::PID> reference(kLoops);
+  ArduPilotPidBank bank;
+  for (int i = 0; i < kLoops; ++i)
+  {
+    const double pGain = uniform(random);
+    const double iGain = i % 3 ? uniform(random) : 0.0;
+    const double dGain = uniform(random);
+    const double iMax = i % 4 ? std::fabs(uniform(random)) : 0.0;
+    const double iMin = i % 4 ? -std::fabs(uniform(random)) : 0.0;
+    const double cmdMax = i % 5 ? std::fabs(uniform(random)) : 0.0;
+    const double cmdMin = i % 5 ? -std::fabs(uniform(random)) : 0.0;
+    reference[i].Init(pGain, iGain, dGain, iMax, iMin, cmdMax, cmdMin);
+    bank.Add(reference[i]);
+  }
+
+  for (int step = 0; step < kSteps; ++step)
+  {
+    const double dt = step % 1000 == 7 ? 0.0 : 0.001 + 1e-4 * (step % 3);
+
+    double *errors = bank.Errors();
+    std::vector<double> inputs(kLoops);
+    for (int i = 0; i < kLoops; ++i)
+    {
+      inputs[i] = uniform(random);
+      if (step % 777 == i)
+      {
+        inputs[i] = std::numeric_limits<double>::quiet_NaN();
+      }
+      else if (step % 991 == i)
+      {
+        inputs[i] = (step & 1 ? 1 : -1) *
+          std::numeric_limits<double>::infinity();
+      }
+      errors[i] = inputs[i];
+    }
+
+    // common::PID rounds the step to nanoseconds through common::Time
+    const double *cmds = bank.Update(common::Time(dt).Double());
+    for (int i = 0; i < kLoops; ++i)
+    {
+      const double expected = reference[i].Update(inputs[i],
+        common::Time(dt));
+      if (!SameBits(expected, cmds[i]))
+      {
+        std::cerr << ArduPilotPidBank::Isa() << ": step " << step
+                  << " loop " << i << " error " << inputs[i]
+                  << " common::PID " << expected << " bank " << cmds[i]
+                  << "\n";
+        return 1;
+      }
+    }
+  }
+
+  std::cout << ArduPilotPidBank::Isa() << ": " << kLoops << " loops, "
+            << kSteps << " steps identical to common::PID\n";
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2016 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <sdf/sdf.hh>
+#include "include/ArduPilotProtocol.hh"
+
+using namespace gazebo;
+
+/// \brief State messages encoded per format
+static const int kIterations = 1000000;
+
+/// \brief Plugin element selecting a wire format
+/// \param[in] _protocol <protocol> value.
+/// \param[in] _float32 <fdmFloat32> value.
+/// \return Element to load ArduPilotProtocol from.
+static sdf::ElementPtr PluginSdf(const std::string &_protocol,
+  const bool _float32)
+{
+  sdf::ElementPtr plugin(new sdf::Element);
+  plugin->SetName("plugin");
+
+  sdf::ElementPtr protocol(new sdf::Element);
+  protocol->SetName("protocol");
+  protocol->AddValue("string", _protocol, true);
+  plugin->InsertElement(protocol);
+
+  sdf::ElementPtr float32(new sdf::Element);
+  float32->SetName("fdmFloat32");
+  float32->AddValue("bool", _float32 ? "true" : "false", true);
+  plugin->InsertElement(float32);
+  return plugin;
+}
+
+/// \brief Time encoding the same state message with each wire format:
+/// the raw legacy struct, v2 binary frames in float64 and float32, and the
+/// JSON text of ArduPilot's SIM_JSON, with every optional field set.
+/// \return 0, or 1 if a format fails to load or encode.
+int main()
+{
+  fdmPacket pkt;
+  pkt.timestamp = 1234.567;
+  for (int i = 0; i < 3; ++i)
+  {
+    pkt.imuAngularVelocityRPY[i] = 0.01 * (i + 1);
+    pkt.imuLinearAccelerationXYZ[i] = -9.80665 + 0.1 * i;
+    pkt.velocityXYZ[i] = 1.5 * (i - 1);
+    pkt.positionXYZ[i] = 100.25 * (i + 1);
+  }
+  pkt.imuOrientationQuat[0] = 0.9238795;
+  pkt.imuOrientationQuat[1] = 0.0;
+  pkt.imuOrientationQuat[2] = 0.0;
+  pkt.imuOrientationQuat[3] = 0.3826834;
+
+  fdmExtension ext;
+  ext.fields = kFdmExtensionFields;
+  ext.latitude = -35.363261;
+  ext.longitude = 149.165230;
+  ext.altitude = 584.0;
+  ext.airspeed = 12.5;
+  ext.batteryVoltage = 12.1;
+  ext.batteryCurrent = 23.4;
+  ext.rangefinder = 7.25;
+  ext.escCount = 4;
+  for (unsigned i = 0; i < ext.escCount; ++i)
+  {
+    ext.escRpm[i] = 8000.0 + 100.0 * i;
+  }
+
+  struct Format
+  {
+    const char *name;
+    const char *protocol;
+    bool float32;
+  };
+  const Format formats[] = {
+    {"legacy", "legacy", false},
+    {"v2", "v2", false},
+    {"v2 float32", "v2", true},
+    {"json", "json", false}};
+
+  for (const Format &format : formats)
+  {
+    ArduPilotProtocol protocol;
+    if (!protocol.Load(PluginSdf(format.protocol, format.float32), "bench"))
+    {
+      return 1;
+    }
+    fdmExtension supported = ext;
+    supported.fields &= protocol.ExtensionFields();
+
+    size_t size = 0;
+    uint64_t checksum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i)
+    {
+      pkt.timestamp += 0.001;
+      const void *frame = protocol.EncodeFdm(pkt, supported, size);
+      if (!frame)
+      {
+        std::cerr << format.name << ": state message does not fit\n";
+        return 1;
+      }
+      checksum += static_cast<const unsigned char *>(frame)[size - 1];
+    }
+    const double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+
+    std::cout << format.name << ": " << size << " bytes, "
+              << ns / kIterations << " ns per message (checksum "
+              << checksum << ")\n";
+  }
+  return 0;
+}